@@ -10,6 +10,25 @@ uniform vec3 viewPos;
 uniform vec3 lightColor;
 uniform vec3 objectColor;
 uniform float roughness;
+uniform bool useSH; // environment ambient instead of a flat term
+uniform float shStrength;
+
+layout(std140) uniform SHIrradiance {
+    vec4 sh[9]; // irradiance / pi, see include/sh_irradiance.h
+};
+
+vec3 shIrradiance(vec3 n)
+{
+    return max(sh[0].rgb * 0.282095
+        + sh[1].rgb * 0.488603 * n.y
+        + sh[2].rgb * 0.488603 * n.z
+        + sh[3].rgb * 0.488603 * n.x
+        + sh[4].rgb * 1.092548 * n.x * n.y
+        + sh[5].rgb * 1.092548 * n.y * n.z
+        + sh[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + sh[7].rgb * 1.092548 * n.x * n.z
+        + sh[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y), vec3(0.0));
+}
 
 void main()
 {
@@ -21,7 +40,7 @@ void main()
     float NdotL = clamp(dot(normal, lightDir), 0.0, 1.0);
     float NdotV = clamp(dot(normal, viewDir), 0.0, 1.0);
 
-    vec3 ambient = 0.1 * lightColor;
+    vec3 ambient = useSH ? shStrength * shIrradiance(normal) : 0.1 * lightColor;
 
     if (NdotL <= 0.0)
     {
@@ -10,8 +10,33 @@ uniform vec3 viewPos;
 uniform vec3 lightColor;
 uniform vec3 objectColor;
 
-uniform float bands; // Number of toon shading bands
+// Number of toon shading bands. Loaded as SPIR-V (--spirv) it is a
+// specialization constant, so the quantization folds into the program.
+#if defined(GL_SPIRV) && !defined(NO_SPEC_CONSTANTS)
+layout(constant_id = 0) const float bands = 4.0;
+#else
+uniform float bands;
+#endif
 uniform float minShade; // Minimum shade factor
+uniform bool useSH; // environment ambient instead of a flat term
+uniform float shStrength;
+
+layout(std140) uniform SHIrradiance {
+    vec4 sh[9]; // irradiance / pi, see include/sh_irradiance.h
+};
+
+vec3 shIrradiance(vec3 n)
+{
+    return max(sh[0].rgb * 0.282095
+        + sh[1].rgb * 0.488603 * n.y
+        + sh[2].rgb * 0.488603 * n.z
+        + sh[3].rgb * 0.488603 * n.x
+        + sh[4].rgb * 1.092548 * n.x * n.y
+        + sh[5].rgb * 1.092548 * n.y * n.z
+        + sh[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + sh[7].rgb * 1.092548 * n.x * n.z
+        + sh[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y), vec3(0.0));
+}
 
 void main()
 {
@@ -25,7 +50,8 @@ void main()
     float q = floor(intensity * b) / b;
     float shade = mix(minShade, 1.0, q);
 
-    vec3 pixelColor = lightColor * objectColor * shade;
+    vec3 ambient = useSH ? shStrength * shIrradiance(normal) : vec3(0.0);
+    vec3 pixelColor = (lightColor * shade + ambient) * objectColor;
     color = vec4(pixelColor, 1.0);
 
 }
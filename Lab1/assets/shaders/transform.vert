@@ -0,0 +1,29 @@
+#version 330 core
+
+// The vertex stage shared by the phong, toon and Oren-Nayar fragment
+// stages when they are built as separable programs (see ProgramPipeline in
+// include/shaders.h); the same transform as their own .vert files.
+
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+out vec3 FragPos;
+out vec3 Normal;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
+{
+    vec4 worldPos = model * vec4(aPos, 1.0);
+    FragPos = worldPos.xyz;
+
+    Normal = mat3(transpose(inverse(model))) * aNormal;
+
+    gl_Position = projection * view * worldPos;
+}
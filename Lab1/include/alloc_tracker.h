@@ -0,0 +1,234 @@
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define ALLOC_TRACKER_STACKS 1
+#endif
+
+#include "profiler.h"
+
+// Counts heap allocations made through operator new, per frame and per
+// profiler zone. Define ALLOC_TRACKER_IMPLEMENTATION in exactly one source
+// file before including this header to install the global operator
+// new/delete replacements.
+//
+// "Render thread" numbers only include the thread that called
+// SetRenderThread(); steady-state checks use those, so loader threads that
+// allocate while frames are rendered do not trip them.
+class AllocTracker {
+public:
+  struct Counts {
+    unsigned long allocations;
+    unsigned long bytes;
+  };
+
+  static const int MAX_ZONES = 64;
+  static const int MAX_OFFENDERS = 8;
+  static const int STACK_DEPTH = 24;
+
+  static void SetRenderThread() { renderThread() = true; }
+
+  // allocations on the render thread during the current and last frame
+  static Counts Frame() { return counts(state().frame); }
+  static Counts Last() { return counts(state().last); }
+  // allocations on all threads since startup
+  static Counts Total() { return counts(state().total); }
+
+  // call once per frame after the buffer swap
+  static void EndFrame() {
+    State &s = state();
+    s.last[0].store(s.frame[0].load(memory_order_relaxed),
+                    memory_order_relaxed);
+    s.last[1].store(s.frame[1].load(memory_order_relaxed),
+                    memory_order_relaxed);
+    s.frame[0].store(0, memory_order_relaxed);
+    s.frame[1].store(0, memory_order_relaxed);
+  }
+
+  // From now on every render-thread allocation is an error: it is attributed
+  // to the innermost profiler zone and, where supported, its call stack is
+  // kept for the report.
+  static void BeginSteadyState() {
+    State &s = state();
+#ifdef ALLOC_TRACKER_STACKS
+    // the first backtrace() call may load libgcc and allocate; do it now
+    void *warm[2];
+    backtrace(warm, 2);
+#endif
+    memset(s.zones, 0, sizeof(s.zones));
+    s.offenderCount = 0;
+    s.steadyAllocations = 0;
+    Profiler::TrackZones(true);
+    s.steady = true;
+  }
+
+  // stops checking, prints a report and returns the allocation count
+  static unsigned long EndSteadyState() {
+    State &s = state();
+    s.steady = false;
+    Profiler::TrackZones(false);
+
+    if (s.steadyAllocations == 0) {
+      printf("AllocTracker: no render thread allocations in steady state\n");
+      return 0;
+    }
+
+    printf("AllocTracker: %lu render thread allocations in steady state\n",
+           s.steadyAllocations);
+    for (int i = 0; i < MAX_ZONES && s.zones[i].count; i++)
+      printf("  %6lu allocs %9lu bytes  in %s\n", s.zones[i].count,
+             s.zones[i].bytes, s.zones[i].name ? s.zones[i].name : "(no zone)");
+
+    for (int i = 0; i < s.offenderCount; i++) {
+      const Offender &o = s.offenders[i];
+      printf("offender %d: %lu bytes in %s\n", i, (unsigned long)o.size,
+             o.zone ? o.zone : "(no zone)");
+#ifdef ALLOC_TRACKER_STACKS
+      fflush(stdout);
+      backtrace_symbols_fd((void *const *)o.stack, o.depth, 1);
+#endif
+    }
+    return s.steadyAllocations;
+  }
+
+  // hooks used by the operator new/delete replacements
+  static void OnAlloc(size_t size) {
+    State &s = state();
+    s.total[0].fetch_add(1, memory_order_relaxed);
+    s.total[1].fetch_add(size, memory_order_relaxed);
+    if (!renderThread())
+      return;
+
+    s.frame[0].fetch_add(1, memory_order_relaxed);
+    s.frame[1].fetch_add(size, memory_order_relaxed);
+    if (s.steady && !inHook()) {
+      inHook() = true;
+      recordOffender(s, size);
+      inHook() = false;
+    }
+  }
+
+  // ImGui allocates with malloc rather than operator new; main.cpp hands
+  // these to ImGui::SetAllocatorFunctions so its allocations are counted
+  // and attributed like any other
+  static void *ImGuiAlloc(size_t size, void *) {
+    OnAlloc(size);
+    return malloc(size);
+  }
+  static void ImGuiFree(void *p, void *) { free(p); }
+
+private:
+  struct ZoneCount {
+    const char *name;
+    unsigned long count;
+    unsigned long bytes;
+  };
+
+  struct Offender {
+    size_t size;
+    const char *zone;
+    int depth;
+    void *stack[STACK_DEPTH];
+  };
+
+  // [0] = allocation count, [1] = bytes
+  struct State {
+    atomic<unsigned long> frame[2];
+    atomic<unsigned long> last[2];
+    atomic<unsigned long> total[2];
+    bool steady;
+    unsigned long steadyAllocations;
+    ZoneCount zones[MAX_ZONES];
+    Offender offenders[MAX_OFFENDERS];
+    int offenderCount;
+  };
+
+  // plain static storage: must not allocate, it is used from operator new
+  static State &state() {
+    static State s;
+    return s;
+  }
+
+  static bool &renderThread() {
+    static thread_local bool value = false;
+    return value;
+  }
+
+  static bool &inHook() {
+    static thread_local bool value = false;
+    return value;
+  }
+
+  static Counts counts(const atomic<unsigned long> *c) {
+    Counts r;
+    r.allocations = c[0].load(memory_order_relaxed);
+    r.bytes = c[1].load(memory_order_relaxed);
+    return r;
+  }
+
+  static void recordOffender(State &s, size_t size) {
+    s.steadyAllocations++;
+    const char *zone = Profiler::CurrentZone();
+
+    for (int i = 0; i < MAX_ZONES; i++) {
+      ZoneCount &z = s.zones[i];
+      if (z.count == 0)
+        z.name = zone;
+      if (z.name == zone) {
+        z.count++;
+        z.bytes += size;
+        break;
+      }
+    }
+
+    if (s.offenderCount >= MAX_OFFENDERS)
+      return;
+    Offender &o = s.offenders[s.offenderCount++];
+    o.size = size;
+    o.zone = zone;
+#ifdef ALLOC_TRACKER_STACKS
+    o.depth = backtrace(o.stack, STACK_DEPTH);
+#else
+    o.depth = 0;
+#endif
+  }
+};
+
+#ifdef ALLOC_TRACKER_IMPLEMENTATION
+#include <cstdlib>
+#include <new>
+
+void *operator new(size_t size) {
+  AllocTracker::OnAlloc(size);
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  AllocTracker::OnAlloc(size);
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  AllocTracker::OnAlloc(size);
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { free(p); }
+#endif
+
+#endif
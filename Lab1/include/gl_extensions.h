@@ -0,0 +1,150 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <set>
+#include <string>
+
+using namespace std;
+
+// glad is generated for core 3.3 without extensions, so the enums and entry
+// points of the extensions used by this project are declared here.
+#ifndef GL_VERTEX_SHADER_BIT
+#define GL_VERTEX_SHADER_BIT 0x00000001
+#endif
+#ifndef GL_FRAGMENT_SHADER_BIT
+#define GL_FRAGMENT_SHADER_BIT 0x00000002
+#endif
+#ifndef GL_PROGRAM_SEPARABLE
+#define GL_PROGRAM_SEPARABLE 0x8258
+#endif
+#ifndef GL_SHADER_BINARY_FORMAT_SPIR_V_ARB
+#define GL_SHADER_BINARY_FORMAT_SPIR_V_ARB 0x9551
+#endif
+
+// context version at least major.minor; needs a current context
+inline bool HasGLVersion(int major, int minor) {
+  GLint ctxMajor = 0, ctxMinor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+  glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+  return ctxMajor > major || (ctxMajor == major && ctxMinor >= minor);
+}
+
+// true if the current context advertises the extension; the list is read
+// once, on the first call
+inline bool HasGLExtension(const char *name) {
+  static set<string> extensions;
+  static bool loaded = false;
+  if (!loaded) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+      extensions.insert((const char *)glGetStringi(GL_EXTENSIONS, i));
+    loaded = true;
+  }
+  return extensions.count(name) != 0;
+}
+
+// f = the entry point called name, through the window system's loader
+template <typename F>
+inline bool LoadGLProc(GLADloadproc load, const char *name, F &f) {
+  f = (F)load(name);
+  return f != NULL;
+}
+
+// Separable programs and program pipeline objects: core in 4.1, and
+// ARB_separate_shader_objects on older contexts. Loaded by hand through the
+// window system's loader (glfwGetProcAddress), since glad stops at 3.3.
+struct ProgramPipelineGL {
+  GLuint(APIENTRYP CreateShaderProgramv)(GLenum type, GLsizei count,
+                                         const GLchar *const *strings);
+  void(APIENTRYP GenProgramPipelines)(GLsizei n, GLuint *pipelines);
+  void(APIENTRYP DeleteProgramPipelines)(GLsizei n, const GLuint *pipelines);
+  void(APIENTRYP BindProgramPipeline)(GLuint pipeline);
+  void(APIENTRYP UseProgramStages)(GLuint pipeline, GLbitfield stages,
+                                   GLuint program);
+  void(APIENTRYP ValidateProgramPipeline)(GLuint pipeline);
+  void(APIENTRYP GetProgramPipelineiv)(GLuint pipeline, GLenum pname,
+                                       GLint *params);
+  void(APIENTRYP GetProgramPipelineInfoLog)(GLuint pipeline, GLsizei bufSize,
+                                            GLsizei *length, GLchar *infoLog);
+  void(APIENTRYP ProgramUniform1i)(GLuint program, GLint location, GLint v0);
+  void(APIENTRYP ProgramUniform1f)(GLuint program, GLint location,
+                                   GLfloat v0);
+  void(APIENTRYP ProgramUniform3fv)(GLuint program, GLint location,
+                                    GLsizei count, const GLfloat *value);
+  void(APIENTRYP ProgramUniformMatrix4fv)(GLuint program, GLint location,
+                                          GLsizei count, GLboolean transpose,
+                                          const GLfloat *value);
+  bool loaded;
+
+  static ProgramPipelineGL &Get() {
+    static ProgramPipelineGL gl = ProgramPipelineGL();
+    return gl;
+  }
+
+  // after gladLoadGLLoader; false when the context has neither 4.1 nor the
+  // extension, or an entry point is missing
+  static bool Load(GLADloadproc load) {
+    ProgramPipelineGL &gl = Get();
+    gl.loaded = false;
+    if (!HasGLVersion(4, 1) &&
+        !HasGLExtension("GL_ARB_separate_shader_objects"))
+      return false;
+    bool ok = true;
+    ok &= LoadGLProc(load, "glCreateShaderProgramv", gl.CreateShaderProgramv);
+    ok &= LoadGLProc(load, "glGenProgramPipelines", gl.GenProgramPipelines);
+    ok &= LoadGLProc(load, "glDeleteProgramPipelines",
+                     gl.DeleteProgramPipelines);
+    ok &= LoadGLProc(load, "glBindProgramPipeline", gl.BindProgramPipeline);
+    ok &= LoadGLProc(load, "glUseProgramStages", gl.UseProgramStages);
+    ok &= LoadGLProc(load, "glValidateProgramPipeline",
+                     gl.ValidateProgramPipeline);
+    ok &= LoadGLProc(load, "glGetProgramPipelineiv", gl.GetProgramPipelineiv);
+    ok &= LoadGLProc(load, "glGetProgramPipelineInfoLog",
+                     gl.GetProgramPipelineInfoLog);
+    ok &= LoadGLProc(load, "glProgramUniform1i", gl.ProgramUniform1i);
+    ok &= LoadGLProc(load, "glProgramUniform1f", gl.ProgramUniform1f);
+    ok &= LoadGLProc(load, "glProgramUniform3fv", gl.ProgramUniform3fv);
+    ok &= LoadGLProc(load, "glProgramUniformMatrix4fv",
+                     gl.ProgramUniformMatrix4fv);
+    gl.loaded = ok;
+    return ok;
+  }
+};
+
+// SPIR-V shader modules: core in 4.6, and ARB_gl_spirv on older contexts.
+// glShaderBinary is core only from 4.1, so it is loaded here as well.
+struct SpirvGL {
+  void(APIENTRYP ShaderBinary)(GLsizei count, const GLuint *shaders,
+                               GLenum binaryFormat, const void *binary,
+                               GLsizei length);
+  void(APIENTRYP SpecializeShader)(GLuint shader, const GLchar *entryPoint,
+                                   GLuint numSpecializationConstants,
+                                   const GLuint *constantIndex,
+                                   const GLuint *constantValue);
+  bool loaded;
+
+  static SpirvGL &Get() {
+    static SpirvGL gl = SpirvGL();
+    return gl;
+  }
+
+  // after gladLoadGLLoader; false when the context has neither 4.6 nor the
+  // extension
+  static bool Load(GLADloadproc load) {
+    SpirvGL &gl = Get();
+    gl.loaded = false;
+    bool core = HasGLVersion(4, 6);
+    if (!core && !HasGLExtension("GL_ARB_gl_spirv"))
+      return false;
+    gl.loaded =
+        LoadGLProc(load, "glShaderBinary", gl.ShaderBinary) &&
+        LoadGLProc(load, core ? "glSpecializeShader" : "glSpecializeShaderARB",
+                   gl.SpecializeShader);
+    return gl.loaded;
+  }
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "profiler.h"
+#include "render_stats.h"
 #include "shaders.h"
 #include <string>
 #include <vector>
@@ -39,6 +41,10 @@ public:
     glBindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
+
+    RenderStats &stats = RenderStats::Frame();
+    stats.vaoBinds++;
+    stats.CountDraw(indices.size());
   }
 
 private:
@@ -55,6 +61,8 @@ private:
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
+    RenderStats::Frame().bufferBytes += vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int);
+
     // Position attribute
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
@@ -72,6 +80,7 @@ class Model
 public:
   Model(const char *path)
   {
+    PROFILE_SCOPE_DYNAMIC(string("Model ") + path);
     loadModel(path);
   }
 
@@ -88,8 +97,12 @@ private:
   void loadModel(string path)
   {
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path,
-                                             aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
+    const aiScene *scene;
+    {
+      PROFILE_SCOPE("Assimp::ReadFile");
+      scene = importer.ReadFile(path,
+                                aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
+    }
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
     {
@@ -98,6 +111,7 @@ private:
     }
     directory = path.substr(0, path.find_last_of('/'));
 
+    PROFILE_SCOPE("processNode+upload");
     processNode(scene->mRootNode, scene);
   }
 
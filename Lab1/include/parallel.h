@@ -0,0 +1,49 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+using namespace std;
+
+// worker count for CPU-bound loops: every core, at least one
+inline int HardwareThreads() {
+  unsigned int n = thread::hardware_concurrency();
+  return n ? (int)n : 1;
+}
+
+// Calls fn(i) for i in [0, count) on up to maxThreads threads (0 = one per
+// core). Items are handed out one at a time, so uneven items balance out.
+// Runs on the calling thread when one thread is enough.
+inline void ParallelFor(int count, const function<void(int)> &fn,
+                        int maxThreads = 0, const char *threadName = "worker") {
+  if (maxThreads <= 0)
+    maxThreads = HardwareThreads();
+  int threads = maxThreads < count ? maxThreads : count;
+  if (threads <= 1) {
+    for (int i = 0; i < count; i++)
+      fn(i);
+    return;
+  }
+
+  atomic<int> next(0);
+  auto work = [&](int worker) {
+    if (Profiler::Enabled())
+      Profiler::SetThreadName(string(threadName) + " " + to_string(worker));
+    for (int i = next++; i < count; i = next++)
+      fn(i);
+  };
+
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++)
+    workers.push_back(thread(work, t));
+  for (size_t t = 0; t < workers.size(); t++)
+    workers[t].join();
+}
+
+#endif
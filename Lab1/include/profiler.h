@@ -0,0 +1,279 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#if defined(PROFILER_USE_RDTSC) && (defined(__x86_64__) || defined(_M_X64))
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROFILER_RDTSC 1
+#endif
+
+using namespace std;
+
+// one closed zone; names must outlive the profiler (literals or Intern())
+struct ProfileEvent {
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+};
+
+// Per-thread ring buffer. Only the owning thread writes; the exporter reads
+// up to the published count, so export while worker threads are idle.
+struct ProfileThreadBuffer {
+  static const size_t CAPACITY = 1 << 15;
+
+  vector<ProfileEvent> events;
+  atomic<uint64_t> count;
+  unsigned int tid;
+  string name;
+
+  explicit ProfileThreadBuffer(unsigned int tid)
+      : events(CAPACITY), count(0), tid(tid) {}
+};
+
+// Scoped CPU profiler exporting Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). Zones cost one relaxed atomic load while disabled;
+// define PROFILER_DISABLED to compile them out entirely.
+class Profiler {
+public:
+  enum ModeFlags {
+    RECORD = 1,      // write zones to the trace
+    TRACK_ZONES = 2, // only maintain CurrentZone(), e.g. for AllocTracker
+  };
+
+  static int Mode() { return modeFlags().load(memory_order_relaxed); }
+  static bool Enabled() { return (Mode() & RECORD) != 0; }
+
+  static void Enable(bool on) {
+    if (on)
+      calibrate();
+    setFlag(RECORD, on);
+  }
+
+  static void TrackZones(bool on) { setFlag(TRACK_ZONES, on); }
+
+  // innermost open zone on the calling thread, or nullptr
+  static const char *&CurrentZone() {
+    static thread_local const char *zone = nullptr;
+    return zone;
+  }
+
+  // raw clock ticks; nanoseconds unless built with PROFILER_USE_RDTSC
+  static uint64_t Now() {
+#ifdef PROFILER_RDTSC
+    return __rdtsc();
+#else
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+               chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  static ProfileThreadBuffer &ThreadBuffer() {
+    static thread_local ProfileThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+      lock_guard<mutex> lock(registryMutex());
+      vector<shared_ptr<ProfileThreadBuffer>> &all = registry();
+      all.push_back(make_shared<ProfileThreadBuffer>((unsigned int)all.size()));
+      buffer = all.back().get();
+    }
+    return *buffer;
+  }
+
+  static void SetThreadName(const string &name) { ThreadBuffer().name = name; }
+
+  // returns a stable copy of a runtime string for use as a zone name
+  static const char *Intern(const string &name) {
+    static set<string> names;
+    lock_guard<mutex> lock(registryMutex());
+    return names.insert(name).first->c_str();
+  }
+
+  static void Record(const char *name, uint64_t start, uint64_t end) {
+    ProfileThreadBuffer &b = ThreadBuffer();
+    uint64_t n = b.count.load(memory_order_relaxed);
+    ProfileEvent &e = b.events[n % ProfileThreadBuffer::CAPACITY];
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    b.count.store(n + 1, memory_order_release);
+  }
+
+  static bool WriteChromeTrace(const string &path) {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+      cout << "ERROR::PROFILER::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+
+    double usPerTick = microsecondsPerTick();
+    uint64_t origin = epoch();
+    size_t written = 0;
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    lock_guard<mutex> lock(registryMutex());
+    vector<shared_ptr<ProfileThreadBuffer>> &all = registry();
+    for (size_t t = 0; t < all.size(); t++) {
+      ProfileThreadBuffer &b = *all[t];
+      string name = b.name.empty() ? "thread " + to_string(b.tid) : b.name;
+      fprintf(f,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+              "\"args\":{\"name\":\"%s\"}}",
+              written++ ? ",\n" : "", b.tid, escape(name).c_str());
+
+      uint64_t count = b.count.load(memory_order_acquire);
+      uint64_t first = count > ProfileThreadBuffer::CAPACITY
+                           ? count - ProfileThreadBuffer::CAPACITY
+                           : 0;
+      for (uint64_t i = first; i < count; i++) {
+        const ProfileEvent &e = b.events[i % ProfileThreadBuffer::CAPACITY];
+        double ts = e.start >= origin ? (e.start - origin) * usPerTick : 0.0;
+        fprintf(f,
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                escape(e.name).c_str(), b.tid, ts,
+                (e.end - e.start) * usPerTick);
+        written++;
+      }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    cout << "Profile trace written to " << path << endl;
+    return true;
+  }
+
+private:
+  static atomic<int> &modeFlags() {
+    static atomic<int> flags(0);
+    return flags;
+  }
+
+  static void setFlag(int flag, bool on) {
+    if (on)
+      modeFlags().fetch_or(flag, memory_order_relaxed);
+    else
+      modeFlags().fetch_and(~flag, memory_order_relaxed);
+  }
+
+  static mutex &registryMutex() {
+    static mutex m;
+    return m;
+  }
+
+  static vector<shared_ptr<ProfileThreadBuffer>> &registry() {
+    static vector<shared_ptr<ProfileThreadBuffer>> buffers;
+    return buffers;
+  }
+
+  // tick value treated as t = 0 in the trace
+  static uint64_t &epoch() {
+    static uint64_t value = Now();
+    return value;
+  }
+
+  static chrono::steady_clock::time_point &epochTime() {
+    static chrono::steady_clock::time_point value = chrono::steady_clock::now();
+    return value;
+  }
+
+  static void calibrate() {
+    epoch();
+    epochTime();
+  }
+
+  static double microsecondsPerTick() {
+#ifdef PROFILER_RDTSC
+    // the TSC rate is measured over the whole profiled run
+    double elapsedUs = chrono::duration<double, micro>(
+                           chrono::steady_clock::now() - epochTime())
+                           .count();
+    uint64_t ticks = Now() - epoch();
+    return ticks ? elapsedUs / ticks : 0.0;
+#else
+    return 0.001;
+#endif
+  }
+
+  static string escape(const char *s) {
+    string out;
+    for (; s && *s; s++) {
+      if (*s == '"' || *s == '\\')
+        out += '\\';
+      out += *s;
+    }
+    return out;
+  }
+  static string escape(const string &s) { return escape(s.c_str()); }
+};
+
+class ProfileZone {
+public:
+  explicit ProfileZone(const char *name)
+      : name(name), active(false), recording(false) {
+    int mode = Profiler::Mode();
+    if (!mode)
+      return;
+    parent = Profiler::CurrentZone();
+    Profiler::CurrentZone() = name;
+    active = true;
+    if (mode & Profiler::RECORD) {
+      recording = true;
+      start = Profiler::Now();
+    }
+  }
+
+  ~ProfileZone() { End(); }
+
+  // closes the zone before the end of its scope
+  void End() {
+    if (!active)
+      return;
+    if (recording)
+      Profiler::Record(name, start, Profiler::Now());
+    Profiler::CurrentZone() = parent;
+    active = false;
+  }
+
+private:
+  const char *name;
+  const char *parent;
+  bool active;
+  bool recording;
+  uint64_t start;
+
+  ProfileZone(const ProfileZone &);
+  ProfileZone &operator=(const ProfileZone &);
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILER_DISABLED
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_DYNAMIC(expr)
+#else
+// zone for the rest of the enclosing block; name must be a literal
+#define PROFILE_SCOPE(name)                                                    \
+  ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+// zone named by a runtime string, only built when profiling is enabled
+#define PROFILE_SCOPE_DYNAMIC(expr)                                            \
+  ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(                           \
+      Profiler::Enabled() ? Profiler::Intern(expr) : "")
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <cstddef>
+
+// Per-frame render counters, filled in by Mesh, Shader and the texture
+// loaders. Counts are exact, so they show the effect of an optimization
+// without the noise of frame timings. GL calls only happen on the main thread,
+// so the counters are not synchronized.
+struct RenderStats {
+  unsigned long drawCalls;
+  unsigned long triangles;
+  unsigned long vertices; // vertices submitted, i.e. index count when indexed
+  unsigned long programBinds;
+  unsigned long vaoBinds;
+  unsigned long textureBinds;
+  unsigned long uniformUploads;
+  unsigned long bufferBytes; // buffer and texture data uploaded
+  unsigned long culledObjects;
+
+  RenderStats() { Reset(); }
+
+  void Reset() {
+    drawCalls = triangles = vertices = 0;
+    programBinds = vaoBinds = textureBinds = uniformUploads = 0;
+    bufferBytes = culledObjects = 0;
+  }
+
+  void CountDraw(unsigned long vertexCount) {
+    drawCalls++;
+    vertices += vertexCount;
+    triangles += vertexCount / 3;
+  }
+
+  // calls f(name, value) for every counter, in display order
+  template <typename F> void ForEach(F f) const {
+    f("draw_calls", (double)drawCalls);
+    f("triangles", (double)triangles);
+    f("vertices", (double)vertices);
+    f("program_binds", (double)programBinds);
+    f("vao_binds", (double)vaoBinds);
+    f("texture_binds", (double)textureBinds);
+    f("uniform_uploads", (double)uniformUploads);
+    f("buffer_bytes", (double)bufferBytes);
+    f("culled_objects", (double)culledObjects);
+  }
+
+  // counters of the frame being rendered
+  static RenderStats &Frame() {
+    static RenderStats stats;
+    return stats;
+  }
+
+  // counters of the last completed frame
+  static const RenderStats &Last() { return last(); }
+
+  // everything since startup, including loading
+  static const RenderStats &Total() { return total(); }
+
+  // call once per frame after the buffer swap
+  static void EndFrame() {
+    RenderStats &f = Frame();
+    RenderStats &t = total();
+    t.drawCalls += f.drawCalls;
+    t.triangles += f.triangles;
+    t.vertices += f.vertices;
+    t.programBinds += f.programBinds;
+    t.vaoBinds += f.vaoBinds;
+    t.textureBinds += f.textureBinds;
+    t.uniformUploads += f.uniformUploads;
+    t.bufferBytes += f.bufferBytes;
+    t.culledObjects += f.culledObjects;
+    last() = f;
+    f.Reset();
+  }
+
+private:
+  static RenderStats &last() {
+    static RenderStats stats;
+    return stats;
+  }
+
+  static RenderStats &total() {
+    static RenderStats stats;
+    return stats;
+  }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef SH_IRRADIANCE_H
+#define SH_IRRADIANCE_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Diffuse environment lighting as 9 spherical harmonics coefficients (bands
+// 0-2), after Ramamoorthi & Hanrahan, "An Efficient Representation for
+// Irradiance Environment Maps". Projection weights every cube texel by its
+// solid angle; the coefficients are then convolved with the clamped cosine
+// lobe and divided by pi, so shaders get Lambertian ambient for a normal n as
+//   sum(sh[i] * Y_i(n))
+// with no texture reads. Shaders declare the matching uniform block:
+//   layout(std140) uniform SHIrradiance { vec4 sh[9]; };
+struct SHIrradiance {
+  static const GLuint BINDING = 0; // uniform buffer binding point
+
+  float coeffs[9][3]; // RGB per basis function
+  double projectMs;
+
+  SHIrradiance() : projectMs(0.0) {
+    for (int i = 0; i < 9; i++)
+      coeffs[i][0] = coeffs[i][1] = coeffs[i][2] = 0.0f;
+  }
+
+  // basis functions in the order the shaders use
+  static void Basis(float x, float y, float z, float out[9]) {
+    out[0] = 0.282095f;
+    out[1] = 0.488603f * y;
+    out[2] = 0.488603f * z;
+    out[3] = 0.488603f * x;
+    out[4] = 1.092548f * x * y;
+    out[5] = 1.092548f * y * z;
+    out[6] = 0.315392f * (3.0f * z * z - 1.0f);
+    out[7] = 1.092548f * x * z;
+    out[8] = 0.546274f * (x * x - y * y);
+  }
+
+  // Projects six faceSize^2 linear RGB faces (GL face order and
+  // orientation). Rows of all faces are spread over worker threads; each row
+  // keeps its own sums, added up in a fixed order so results do not depend
+  // on the thread count.
+  void Project(const vector<float> faces[6], int faceSize, int threads = 0) {
+    PROFILE_SCOPE("SHIrradiance::Project");
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    int rows = 6 * faceSize;
+    vector<double> rowSums((size_t)rows * 27);
+    ParallelFor(
+        rows,
+        [&](int job) {
+          projectRow(faces, faceSize, job / faceSize, job % faceSize,
+                     &rowSums[(size_t)job * 27]);
+        },
+        threads, "sh");
+
+    double total[27] = {0.0};
+    for (int row = 0; row < rows; row++)
+      for (int i = 0; i < 27; i++)
+        total[i] += rowSums[(size_t)row * 27 + i];
+
+    // cosine lobe convolution (pi, 2pi/3, pi/4 per band), divided by pi
+    const float band[9] = {1.0f,         2.0f / 3.0f, 2.0f / 3.0f,
+                           2.0f / 3.0f,  0.25f,       0.25f,
+                           0.25f,        0.25f,       0.25f};
+    for (int i = 0; i < 9; i++)
+      for (int c = 0; c < 3; c++)
+        coeffs[i][c] = (float)total[i * 3 + c] * band[i];
+
+    projectMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                start)
+                    .count();
+  }
+
+  // ambient for a unit normal, as the shaders compute it
+  void Evaluate(float x, float y, float z, float out[3]) const {
+    float basis[9];
+    Basis(x, y, z, basis);
+    out[0] = out[1] = out[2] = 0.0f;
+    for (int i = 0; i < 9; i++)
+      for (int c = 0; c < 3; c++)
+        out[c] += coeffs[i][c] * basis[i];
+  }
+
+  // Plain text, one "r g b" line per coefficient after a key line, so the
+  // coefficients can be copied between labs or edited by hand. A key of 0
+  // accepts any file.
+  bool Write(const string &path, uint64_t key = 0) const {
+    FILE *f = fopen(path.c_str(), "w");
+    if (!f) {
+      cout << "ERROR::SH::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+    fprintf(f, "sh9 %llu\n", (unsigned long long)key);
+    for (int i = 0; i < 9; i++)
+      fprintf(f, "%.9g %.9g %.9g\n", coeffs[i][0], coeffs[i][1], coeffs[i][2]);
+    fclose(f);
+    return true;
+  }
+
+  bool Read(const string &path, uint64_t key = 0) {
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+      return false;
+    unsigned long long fileKey = 0;
+    bool ok = fscanf(f, "sh9 %llu", &fileKey) == 1 &&
+              (key == 0 || fileKey == key);
+    for (int i = 0; ok && i < 9; i++)
+      ok = fscanf(f, "%f %f %f", &coeffs[i][0], &coeffs[i][1],
+                  &coeffs[i][2]) == 3;
+    fclose(f);
+    return ok;
+  }
+
+  // std140 vec4[9] uniform buffer on BINDING; needs a current GL context
+  GLuint CreateUniformBuffer() const {
+    float data[9][4];
+    for (int i = 0; i < 9; i++) {
+      for (int c = 0; c < 3; c++)
+        data[i][c] = coeffs[i][c];
+      data[i][3] = 0.0f;
+    }
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return ubo;
+  }
+
+private:
+  static const int LANES = 8;
+
+  // Sums one row into out[27]. The row is split into structure-of-arrays
+  // blocks and every sum keeps LANES partial accumulators, so the loops
+  // vectorize without reassociating float additions.
+  static void projectRow(const vector<float> faces[6], int faceSize, int face,
+                         int y, double *out) {
+    // direction = centre + u * right + v * down, per the GL face table
+    static const float axes[6][9] = {
+        {1, 0, 0, 0, 0, -1, 0, -1, 0},  {-1, 0, 0, 0, 0, 1, 0, -1, 0},
+        {0, 1, 0, 1, 0, 0, 0, 0, 1},    {0, -1, 0, 1, 0, 0, 0, 0, -1},
+        {0, 0, 1, 1, 0, 0, 0, -1, 0},   {0, 0, -1, -1, 0, 0, 0, -1, 0}};
+    const float *a = axes[face];
+    float v = 2.0f * (y + 0.5f) / faceSize - 1.0f;
+    float texelArea = (2.0f / faceSize) * (2.0f / faceSize);
+    const float *rgb = &faces[face][(size_t)y * faceSize * 3];
+
+    float acc[27][LANES] = {{0.0f}};
+    for (int x0 = 0; x0 < faceSize; x0 += LANES) {
+      int n = faceSize - x0 < LANES ? faceSize - x0 : LANES;
+      float c[3][LANES], w[LANES], basis[9][LANES];
+      for (int k = 0; k < LANES; k++) {
+        // lanes past the row end get zero weight
+        int x = x0 + (k < n ? k : 0);
+        float u = 2.0f * (x + 0.5f) / faceSize - 1.0f;
+        float r2 = 1.0f + u * u + v * v;
+        float invLen = 1.0f / sqrtf(r2);
+        float dx = (a[0] + u * a[3] + v * a[6]) * invLen;
+        float dy = (a[1] + u * a[4] + v * a[7]) * invLen;
+        float dz = (a[2] + u * a[5] + v * a[8]) * invLen;
+        // dA * cos / r^2 = 4 / (size^2 (1 + u^2 + v^2)^1.5) on a 2x2 face
+        w[k] = k < n ? texelArea * invLen / r2 : 0.0f;
+        basis[0][k] = 0.282095f;
+        basis[1][k] = 0.488603f * dy;
+        basis[2][k] = 0.488603f * dz;
+        basis[3][k] = 0.488603f * dx;
+        basis[4][k] = 1.092548f * dx * dy;
+        basis[5][k] = 1.092548f * dy * dz;
+        basis[6][k] = 0.315392f * (3.0f * dz * dz - 1.0f);
+        basis[7][k] = 1.092548f * dx * dz;
+        basis[8][k] = 0.546274f * (dx * dx - dy * dy);
+        for (int ch = 0; ch < 3; ch++)
+          c[ch][k] = rgb[x * 3 + ch] * w[k];
+      }
+      for (int i = 0; i < 9; i++)
+        for (int ch = 0; ch < 3; ch++)
+          for (int k = 0; k < LANES; k++)
+            acc[i * 3 + ch][k] += basis[i][k] * c[ch][k];
+    }
+
+    for (int i = 0; i < 27; i++) {
+      double sum = 0.0;
+      for (int k = 0; k < LANES; k++)
+        sum += acc[i][k];
+      out[i] = sum;
+    }
+  }
+};
+
+#endif
@@ -6,13 +6,74 @@
 
 #include <glad/glad.h>
 
+#include <sys/stat.h>
+
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "gl_extensions.h"
+#include "profiler.h"
+#include "render_stats.h"
+#include "spirv_reflect.h"
 
 using namespace std;
 
+// --original-shaders: load the hand-written GLSL even where the
+// optimize_shaders target has written an optimized copy
+inline bool &UseOptimizedShaders() {
+  static bool use = true;
+  return use;
+}
+
+// dir/optimized/name + suffix for dir/name when tools/shader_opt has
+// written it and it is newer than the source, so an edited shader is never
+// shadowed by a stale copy; otherwise ""
+inline string OptimizedShaderPath(const char *path, const string &suffix = "") {
+  string source = path;
+  size_t slash = source.find_last_of('/');
+  string optimized = slash == string::npos
+                         ? "optimized/" + source
+                         : source.substr(0, slash + 1) + "optimized/" +
+                               source.substr(slash + 1);
+  optimized += suffix;
+  struct stat sourceInfo, optimizedInfo;
+  if (stat(optimized.c_str(), &optimizedInfo) != 0 ||
+      stat(path, &sourceInfo) != 0 ||
+      optimizedInfo.st_mtime < sourceInfo.st_mtime)
+    return "";
+  return optimized;
+}
+
+// the optimized copy of path if there is a current one, else path itself
+inline string ShaderSourcePath(const char *path) {
+  string optimized = UseOptimizedShaders() ? OptimizedShaderPath(path) : "";
+  return optimized.empty() ? string(path) : optimized;
+}
+
+// the SPIR-V module tools/shader_opt built from path, or ""
+inline string SpirvModulePath(const char *path) {
+  return OptimizedShaderPath(path, ".spv");
+}
+
+// a specialization constant of a SPIR-V program: the name it has in the
+// shader and its value's 32 bits
+struct SpecConstant {
+  string name;
+  GLuint bits;
+
+  SpecConstant(const string &name, float value) : name(name) {
+    memcpy(&bits, &value, sizeof(bits));
+  }
+  SpecConstant(const string &name, int value)
+      : name(name), bits((GLuint)value) {}
+};
+
 class Shader {
 public:
   // the program ID
@@ -20,36 +81,18 @@ public:
 
   // constructor reads and builds the shader
   Shader(const char *vertexPath, const char *fragmentPath) {
+    PROFILE_SCOPE_DYNAMIC(string("Shader ") + vertexPath);
     string vertexCode;
     string fragmentCode;
-    ifstream vShaderFile;
-    ifstream fShaderFile;
-
-    vShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
-    fShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
-
-    // read shader file
-    try {
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      stringstream vShaderStream, fShaderStream;
-
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
-
-      vShaderFile.close();
-      fShaderFile.close();
-
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (ifstream::failure &e) {
+    if (!readFile(vertexPath, vertexCode) ||
+        !readFile(fragmentPath, fragmentCode))
       cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
-    }
 
     const char *vShaderCode = vertexCode.c_str();
     const char *fShaderCode = fragmentCode.c_str();
 
     // compile shaders
+    PROFILE_SCOPE("compile+link");
     unsigned int vertex, fragment;
     int success;
     char infoLog[512];
@@ -91,28 +134,392 @@ public:
     glDeleteShader(fragment);
   };
 
+  // A separable program of one stage (GL_VERTEX_SHADER or
+  // GL_FRAGMENT_SHADER) for a ProgramPipeline. Needs ProgramPipelineGL::Load().
+  Shader(GLenum stage, const char *path) : separable(true) {
+    PROFILE_SCOPE_DYNAMIC(string("Shader ") + path);
+    string code;
+    if (!readFile(path, code))
+      cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+    const char *source = code.c_str();
+
+    PROFILE_SCOPE("compile+link");
+    ID = ProgramPipelineGL::Get().CreateShaderProgramv(stage, 1, &source);
+    int success;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if (!success) {
+      // holds the compile log too
+      char infoLog[512];
+      glGetProgramInfoLog(ID, 512, NULL, infoLog);
+      cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+    }
+  };
+
+  // A program from SPIR-V modules (see SpirvModulePath), specialized with
+  // the given constants. The driver skips the GLSL front end. Needs
+  // SpirvGL::Load(). If Linked() is false afterwards, the caller deletes the
+  // program and falls back to the GLSL constructor.
+  Shader(const char *vertexPath, const char *fragmentPath,
+         const vector<SpecConstant> &constants)
+      : spirv(true) {
+    PROFILE_SCOPE_DYNAMIC(string("Shader ") + vertexPath);
+    const char *paths[2] = {vertexPath, fragmentPath};
+    const GLenum stages[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+    const char *stageNames[2] = {"VERTEX", "FRAGMENT"};
+    vector<bool> specialized(constants.size(), false);
+    ID = glCreateProgram();
+    for (int s = 0; s < 2; s++) {
+      vector<uint32_t> words;
+      SpirvReflection reflection;
+      if (!SpirvReflection::ReadFile(paths[s], words) ||
+          !reflection.Parse(words)) {
+        cout << "ERROR::SHADER::SPIRV::CANNOT_READ " << paths[s] << endl;
+        words.assign(1, 0);
+      }
+
+      vector<GLuint> ids, values;
+      for (size_t c = 0; c < constants.size(); c++)
+        for (size_t r = 0; r < reflection.constants.size(); r++)
+          if (reflection.constants[r].first == constants[c].name) {
+            ids.push_back((GLuint)reflection.constants[r].second);
+            values.push_back(constants[c].bits);
+            specialized[c] = true;
+          }
+
+      PROFILE_SCOPE("specialize");
+      GLuint shader = glCreateShader(stages[s]);
+      SpirvGL &gl = SpirvGL::Get();
+      gl.ShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB,
+                      &words[0], (GLsizei)(words.size() * 4));
+      gl.SpecializeShader(shader, "main", (GLuint)ids.size(),
+                          ids.empty() ? NULL : &ids[0],
+                          values.empty() ? NULL : &values[0]);
+      int success;
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+      if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        cout << "ERROR::SHADER::" << stageNames[s]
+             << "::SPECIALIZATION_FAILED\n"
+             << infoLog << endl;
+      }
+      glAttachShader(ID, shader);
+      glDeleteShader(shader); // freed with the program
+
+      // the locations are fixed by the module, so there is nothing to query
+      for (size_t u = 0; u < reflection.uniforms.size(); u++)
+        if (!cached(reflection.uniforms[u].first))
+          locations.push_back(reflection.uniforms[u]);
+      blockBindings.insert(blockBindings.end(), reflection.blocks.begin(),
+                           reflection.blocks.end());
+    }
+    for (size_t c = 0; c < constants.size(); c++)
+      if (!specialized[c])
+        cout << "ERROR::SHADER::SPIRV::UNKNOWN_CONSTANT " << constants[c].name
+             << endl;
+
+    PROFILE_SCOPE("link");
+    glLinkProgram(ID);
+    if (!Linked()) {
+      char infoLog[512];
+      glGetProgramInfoLog(ID, 512, NULL, infoLog);
+      cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
+    }
+  };
+
+  bool Linked() const {
+    GLint success = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    return success != 0;
+  }
+
+  // built from SPIR-V modules, so specialization constants are fixed
+  bool Spirv() const { return spirv; }
+
+  // Build time of each program from GLSL and from its SPIR-V modules, best
+  // of runs. Programs without current modules are skipped. Needs
+  // SpirvGL::Load().
+  static void BenchmarkSpirv(const char *const *vertexPaths,
+                             const char *const *fragmentPaths, int count,
+                             int runs) {
+    double totals[2] = {0.0, 0.0};
+    for (int p = 0; p < count; p++) {
+      string vertexModule = SpirvModulePath(vertexPaths[p]);
+      string fragmentModule = SpirvModulePath(fragmentPaths[p]);
+      if (vertexModule.empty() || fragmentModule.empty()) {
+        cout << fragmentPaths[p] << ": no SPIR-V modules" << endl;
+        continue;
+      }
+      double best[2] = {1e9, 1e9};
+      for (int r = 0; r < runs; r++)
+        for (int mode = 0; mode < 2; mode++) {
+          chrono::steady_clock::time_point start = chrono::steady_clock::now();
+          Shader shader =
+              mode == 0 ? Shader(vertexPaths[p], fragmentPaths[p])
+                        : Shader(vertexModule.c_str(), fragmentModule.c_str(),
+                                 vector<SpecConstant>());
+          shader.Linked();
+          double ms = chrono::duration<double, milli>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+          if (ms < best[mode])
+            best[mode] = ms;
+          glDeleteProgram(shader.ID);
+        }
+      cout << fragmentPaths[p] << ": GLSL " << best[0] << " ms, SPIR-V "
+           << best[1] << " ms" << endl;
+      totals[0] += best[0];
+      totals[1] += best[1];
+    }
+    cout << "Program build, best of " << runs << ": GLSL " << totals[0]
+         << " ms, SPIR-V " << totals[1] << " ms" << endl;
+  }
+
   // use/activate the shader
-  void use() { glUseProgram(ID); };
+  void use() {
+    glUseProgram(ID);
+    RenderStats::Frame().programBinds++;
+  };
 
-  // utility uniform functions
-  void setBool(const string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+  // attaches a uniform block of this program to a buffer binding point
+  void bindUniformBlock(const char *name, GLuint binding) const {
+    GLuint index =
+        spirv ? spirvBlockIndex(name) : glGetUniformBlockIndex(ID, name);
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(ID, index, binding);
   };
 
-  void setInt(const string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+  // utility uniform functions; a separable stage is written directly,
+  // whichever program or pipeline is bound
+  void setBool(const char *name, bool value) const {
+    setInt(name, (int)value);
   };
-  void setFloat(const string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+
+  void setInt(const char *name, int value) const {
+    RenderStats::Frame().uniformUploads++;
+    if (separable)
+      ProgramPipelineGL::Get().ProgramUniform1i(ID, location(name), value);
+    else
+      glUniform1i(location(name), value);
+  };
+  void setFloat(const char *name, float value) const {
+    RenderStats::Frame().uniformUploads++;
+    if (separable)
+      ProgramPipelineGL::Get().ProgramUniform1f(ID, location(name), value);
+    else
+      glUniform1f(location(name), value);
   };
-  void setVec3(const string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1,
-                 glm::value_ptr(value));
+  void setVec3(const char *name, const glm::vec3 &value) const {
+    RenderStats::Frame().uniformUploads++;
+    if (separable)
+      ProgramPipelineGL::Get().ProgramUniform3fv(ID, location(name), 1,
+                                                 glm::value_ptr(value));
+    else
+      glUniform3fv(location(name), 1, glm::value_ptr(value));
   };
-  void setMat4(const string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  void setMat4(const char *name, const glm::mat4 &mat) const {
+    RenderStats::Frame().uniformUploads++;
+    if (separable)
+      ProgramPipelineGL::Get().ProgramUniformMatrix4fv(
+          ID, location(name), 1, GL_FALSE, glm::value_ptr(mat));
+    else
+      glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(mat));
   };
+
+private:
+  bool separable = false;
+  bool spirv = false;
+  vector<pair<string, int>> blockBindings; // SPIR-V: block name, binding
+
+  static bool readFile(const char *path, string &code) {
+    ifstream file;
+    file.exceptions(ifstream::failbit | ifstream::badbit);
+    try {
+      file.open(ShaderSourcePath(path).c_str());
+      stringstream stream;
+      stream << file.rdbuf();
+      file.close();
+      code = stream.str();
+    } catch (ifstream::failure &e) {
+      return false;
+    }
+    return true;
+  }
+
+  // uniform locations, looked up once per name so the per-frame setters
+  // neither query the driver nor allocate
+  mutable vector<pair<string, GLint>> locations;
+
+  bool cached(const string &name) const {
+    for (size_t i = 0; i < locations.size(); i++)
+      if (locations[i].first == name)
+        return true;
+    return false;
+  }
+
+  // A SPIR-V program's blocks have no names to query, so the block is found
+  // by the binding its module gave it
+  GLuint spirvBlockIndex(const char *name) const {
+    for (size_t b = 0; b < blockBindings.size(); b++) {
+      if (blockBindings[b].first != name)
+        continue;
+      GLint count = 0;
+      glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+      for (GLint i = 0; i < count; i++) {
+        GLint binding = -1;
+        glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+        if (binding == blockBindings[b].second)
+          return (GLuint)i;
+      }
+    }
+    return GL_INVALID_INDEX;
+  }
+
+  GLint location(const char *name) const {
+    for (size_t i = 0; i < locations.size(); i++)
+      if (strcmp(locations[i].first.c_str(), name) == 0)
+        return locations[i].second;
+    GLint loc = glGetUniformLocation(ID, name);
+    locations.push_back(make_pair(string(name), loc));
+    return loc;
+  }
+};
+
+// A program pipeline object: one separable vertex stage combined with any
+// of several separable fragment stages. The vertex stage is compiled once
+// for every BRDF, and switching BRDFs between draws replaces only the
+// fragment stage. Needs ProgramPipelineGL::Load().
+class ProgramPipeline {
+public:
+  GLuint ID;
+  Shader vertex; // uniforms of the vertex stage are set here
+
+  explicit ProgramPipeline(const char *vertexPath)
+      : vertex(GL_VERTEX_SHADER, vertexPath), fragment(0) {
+    ProgramPipelineGL &gl = ProgramPipelineGL::Get();
+    gl.GenProgramPipelines(1, &ID);
+    gl.UseProgramStages(ID, GL_VERTEX_SHADER_BIT, vertex.ID);
+  }
+
+  // a program bound with glUseProgram overrides the pipeline, so unbind it
+  void bind() {
+    glUseProgram(0);
+    ProgramPipelineGL::Get().BindProgramPipeline(ID);
+    RenderStats::Frame().programBinds++;
+  }
+
+  // a separable fragment stage, e.g. Shader(GL_FRAGMENT_SHADER, path)
+  void useFragment(const Shader &stage) {
+    if (stage.ID == fragment)
+      return;
+    ProgramPipelineGL::Get().UseProgramStages(ID, GL_FRAGMENT_SHADER_BIT,
+                                              stage.ID);
+    fragment = stage.ID;
+    RenderStats::Frame().programBinds++;
+  }
+
+  // checks the stages fit together; call once with the pipeline complete
+  bool validate() const {
+    ProgramPipelineGL &gl = ProgramPipelineGL::Get();
+    gl.ValidateProgramPipeline(ID);
+    GLint success = 0;
+    gl.GetProgramPipelineiv(ID, GL_VALIDATE_STATUS, &success);
+    if (!success) {
+      char infoLog[512];
+      gl.GetProgramPipelineInfoLog(ID, 512, NULL, infoLog);
+      cout << "ERROR::SHADER::PIPELINE::VALIDATION_FAILED\n"
+           << infoLog << endl;
+    }
+    return success != 0;
+  }
+
+  // Build time of count monolithic programs against one shared vertex
+  // stage plus count fragment stages, then the CPU cost of draws that switch
+  // between them every time (glUseProgram against glUseProgramStages), each
+  // against draws that never switch. Needs a current context with the
+  // pipeline entry points loaded.
+  static void Benchmark(const char *const *vertexPaths,
+                        const char *sharedVertexPath,
+                        const char *const *fragmentPaths, int count,
+                        int draws) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<Shader> programs;
+    for (int i = 0; i < count; i++)
+      programs.push_back(Shader(vertexPaths[i], fragmentPaths[i]));
+    glFinish();
+    double monolithicMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    ProgramPipeline pipeline(sharedVertexPath);
+    vector<Shader> stages;
+    for (int i = 0; i < count; i++)
+      stages.push_back(Shader(GL_FRAGMENT_SHADER, fragmentPaths[i]));
+    glFinish();
+    double separableMs = elapsedMs(start);
+    pipeline.useFragment(stages[0]);
+    pipeline.validate();
+
+    // one small triangle, so the draws measure submission and state
+    // validation, not fill
+    float triangle[18] = {0, 0, 0, 0, 0, 1, 0.01f, 0, 0,
+                          0, 0, 1, 0,    0.01f, 0, 0, 0, 1};
+    GLuint vao, vbo;
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                          (void *)(3 * sizeof(float)));
+
+    double us[4];
+    for (int mode = 0; mode < 4; mode++) {
+      bool separate = mode >= 2, switching = mode % 2 == 1;
+      if (separate)
+        pipeline.bind();
+      glFinish();
+      start = chrono::steady_clock::now();
+      for (int d = 0; d < draws; d++) {
+        int i = switching ? d % count : 0;
+        if (separate)
+          pipeline.useFragment(stages[i]);
+        else
+          glUseProgram(programs[i].ID);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+      }
+      glFinish();
+      us[mode] = elapsedMs(start) * 1000.0 / draws;
+    }
+
+    cout << "Programs for " << count << " BRDFs: monolithic " << monolithicMs
+         << " ms, shared vertex stage " << separableMs << " ms" << endl;
+    cout << "Per draw (" << draws << " draws): glUseProgram " << us[0]
+         << " us, switching " << us[1] << " us; glUseProgramStages " << us[2]
+         << " us, switching " << us[3] << " us" << endl;
+
+    glBindVertexArray(0);
+    glDeleteBuffers(1, &vbo);
+    glDeleteVertexArrays(1, &vao);
+    ProgramPipelineGL::Get().BindProgramPipeline(0);
+    ProgramPipelineGL::Get().DeleteProgramPipelines(1, &pipeline.ID);
+    for (int i = 0; i < count; i++) {
+      glDeleteProgram(programs[i].ID);
+      glDeleteProgram(stages[i].ID);
+    }
+    glDeleteProgram(pipeline.vertex.ID);
+  }
+
+private:
+  GLuint fragment; // current fragment stage
+
+  static double elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since)
+        .count();
+  }
 };
 
 #endif
@@ -0,0 +1,98 @@
+#ifndef SPIRV_REFLECT_H
+#define SPIRV_REFLECT_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// What a SPIR-V module for OpenGL declares about its default-block uniforms,
+// uniform blocks and specialization constants. Drivers need not keep names
+// for SPIR-V programs, so glGetUniformLocation() and glGetUniformBlockIndex()
+// cannot be relied on. Locations, bindings and constant IDs come from the
+// module's decorations instead, and names from its debug info (OpName),
+// which glslang writes and spirv-opt keeps.
+struct SpirvReflection {
+  vector<pair<string, int>> uniforms;  // name, location
+  vector<pair<string, int>> blocks;    // block name, binding
+  vector<pair<string, int>> constants; // name, constant_id
+
+  // false if words is not a SPIR-V module
+  bool Parse(const vector<uint32_t> &words) {
+    uniforms.clear();
+    blocks.clear();
+    constants.clear();
+    if (words.size() < 5 || words[0] != 0x07230203)
+      return false;
+
+    map<uint32_t, string> names;
+    map<uint32_t, int> locations, bindings, specIds;
+    map<uint32_t, uint32_t> pointee; // pointer type -> pointed-to type
+    vector<pair<uint32_t, uint32_t>> variables; // id, pointer type
+    vector<uint32_t> blockVariables;            // ids, same order
+    for (size_t i = 5; i < words.size();) {
+      uint32_t op = words[i] & 0xffff, length = words[i] >> 16;
+      if (length == 0 || i + length > words.size())
+        return false;
+      const uint32_t *w = &words[i];
+      if (op == 5 && length >= 3) // OpName
+        names[w[1]] = readString(w + 2, length - 2);
+      else if (op == 71 && length >= 4) { // OpDecorate with a literal
+        if (w[2] == 30) // Location
+          locations[w[1]] = (int)w[3];
+        else if (w[2] == 33) // Binding
+          bindings[w[1]] = (int)w[3];
+        else if (w[2] == 1) // SpecId
+          specIds[w[1]] = (int)w[3];
+      } else if (op == 32 && length >= 4) // OpTypePointer
+        pointee[w[1]] = w[3];
+      else if (op == 59 && length >= 4) { // OpVariable
+        if (w[3] == 0) // UniformConstant
+          variables.push_back(make_pair(w[2], w[1]));
+        if (w[3] == 2) { // Uniform, i.e. a uniform block
+          blockVariables.push_back(w[2]);
+          pointee[w[2]] = pointee[w[1]];
+        }
+      }
+      i += length;
+    }
+
+    for (size_t v = 0; v < variables.size(); v++)
+      if (locations.count(variables[v].first))
+        uniforms.push_back(make_pair(names[variables[v].first],
+                                     locations[variables[v].first]));
+    // a block is known by the name of its type, as in GLSL
+    for (size_t v = 0; v < blockVariables.size(); v++)
+      if (bindings.count(blockVariables[v]))
+        blocks.push_back(make_pair(names[pointee[blockVariables[v]]],
+                                   bindings[blockVariables[v]]));
+    for (map<uint32_t, int>::iterator it = specIds.begin();
+         it != specIds.end(); ++it)
+      constants.push_back(make_pair(names[it->first], it->second));
+    return true;
+  }
+
+  static bool ReadFile(const char *path, vector<uint32_t> &words) {
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+      return false;
+    streamsize bytes = file.tellg();
+    if (bytes <= 0 || bytes % 4 != 0)
+      return false;
+    words.resize((size_t)bytes / 4);
+    file.seekg(0);
+    return (bool)file.read((char *)&words[0], bytes);
+  }
+
+private:
+  static string readString(const uint32_t *w, uint32_t count) {
+    string s((const char *)w, count * 4);
+    return s.substr(0, s.find('\0'));
+  }
+};
+
+#endif
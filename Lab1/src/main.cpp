@@ -14,14 +14,24 @@
 
 #include <string>
 
+#define ALLOC_TRACKER_IMPLEMENTATION
+#include "alloc_tracker.h"
+#include "benchmark.h"
 #include "camera.h"
+#include "gpu_timer.h"
+#include "input_replay.h"
 #include "model.h"
+#include "perf_overlay.h"
+#include "profiler.h"
+#include "render_stats.h"
 #include "shaders.h"
+#include "sh_irradiance.h"
 
 using namespace std;
 
 int width = 1920, height = 1080;
 bool showUI = true;
+bool showPerfOverlay = true;
 const char *project_name = "Lab 1 - Reflectance Models";
 
 // camera at +Z looking toward origin (-Z)
@@ -29,18 +39,22 @@ Camera camera(0.0f, 3.0f, 12.0f, 0.0f, 1.0f, 0.0f, -90.0f, -10.0f);
 
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+float sceneTime = 0.0f; // advances by deltaTime, fixed while benchmarking
 
 // --- globals for input ---
 Camera *gCamera = nullptr;
 float gLastX = 0.0f;
 float gLastY = 0.0f;
 bool gFirstMouse = true;
+InputLog inputLog; // --record / --replay
 
 float spacing = 4.0f; // spacing between models
 
 glm::vec3 lightPos(50.0f, 50.0f, 50.0f);
 glm::vec3 lightColor(1.0f);
 float lightIntensity = 1.0f;
+bool useSH = false; // SH environment ambient (--env-sh) instead of flat
+float shStrength = 0.5f;
 float orenRoughness = 0.5f;
 float toonBands = 4.0f;
 float toonMinShade = 0.1f;
@@ -60,6 +74,9 @@ void framebuffer_size_callback(GLFWwindow *window, int w, int h) {
 
 void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
 
+  if (!inputLog.OnCursor(xpos, ypos))
+    return;
+
   if (showUI)
     return;
 
@@ -83,13 +100,20 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
   if (!gCamera)
     return;
-  if (ImGui::GetIO().WantCaptureMouse)
+  // ImGui does not see the mouse during replay; the log only holds scrolls
+  // that reached the camera
+  if (!inputLog.Replaying() && ImGui::GetIO().WantCaptureMouse)
+    return;
+  if (!inputLog.OnScroll(xoffset, yoffset))
     return;
   gCamera->ProcessMouseScroll((float)yoffset);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action,
                   int mods) {
+  if (!inputLog.OnKey(key, action, mods))
+    return;
+
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
 
@@ -110,24 +134,85 @@ void processInput(GLFWwindow *window) {
   if (!gCamera)
     return;
 
-  if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_W))
     gCamera->ProcessKeyboard(FRONT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_S))
     gCamera->ProcessKeyboard(BACK, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_A))
     gCamera->ProcessKeyboard(LEFT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_D))
     gCamera->ProcessKeyboard(RIGHT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_SPACE))
     gCamera->ProcessKeyboard(UP, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_LEFT_SHIFT))
     gCamera->ProcessKeyboard(DOWN, deltaTime);
 }
 
-int main() {
+int main(int argc, char **argv) {
+
+  bool runBenchmark = false;
+  bool allocTest = false;
+  bool headless = false;
+  bool monolithic = false;
+  bool spirvRequested = false;
+  int pipelineBenchmarkDraws = 0;
+  int spirvBenchmarkRuns = 0;
+  string benchmarkOut = "benchmark";
+  string recordPath, replayPath, profilePath;
+  string shPath;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--benchmark") {
+      runBenchmark = true;
+    } else if (arg == "--benchmark-out" && i + 1 < argc) {
+      benchmarkOut = argv[++i];
+    } else if (arg == "--record" && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (arg == "--profile" && i + 1 < argc) {
+      profilePath = argv[++i];
+    } else if (arg == "--env-sh" && i + 1 < argc) {
+      shPath = argv[++i];
+    } else if (arg == "--alloc-test") {
+      allocTest = true;
+    } else if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--monolithic") {
+      monolithic = true;
+    } else if (arg == "--spirv") {
+      spirvRequested = true;
+    } else if (arg == "--spirv-benchmark") {
+      spirvBenchmarkRuns = 10;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        spirvBenchmarkRuns = atoi(argv[++i]);
+    } else if (arg == "--original-shaders") {
+      UseOptimizedShaders() = false;
+    } else if (arg == "--pipeline-benchmark") {
+      pipelineBenchmarkDraws = 100000;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        pipelineBenchmarkDraws = atoi(argv[++i]);
+    } else if (arg == "--compare" && i + 2 < argc) {
+      // --compare baseline.csv current.csv [--tolerance percent]
+      double tolerance = 5.0;
+      if (i + 4 < argc && string(argv[i + 3]) == "--tolerance")
+        tolerance = atof(argv[i + 4]);
+      int regressions = Benchmark::Compare(argv[i + 1], argv[i + 2], tolerance);
+      return regressions == 0 ? 0 : 1;
+    }
+  }
+
+  AllocTracker::SetRenderThread();
+
+  if (!profilePath.empty())
+    Profiler::Enable(true);
+  Profiler::SetThreadName("main");
 
+  ProfileZone glfwInitZone("glfwInit");
   if (!glfwInit())
     return -1;
+  glfwInitZone.End();
 
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -137,8 +222,14 @@ int main() {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+  // headless runs still need a GL context, just not a visible window
+  if (headless)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  ProfileZone windowZone("glfwCreateWindow");
   GLFWwindow *window =
       glfwCreateWindow(width, height, project_name, nullptr, nullptr);
+  windowZone.End();
 
   if (!window) {
     cerr << "Failed to create window\n";
@@ -154,18 +245,70 @@ int main() {
 
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 
+  ProfileZone gladZone("gladLoadGLLoader");
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
     cerr << "Failed to initialize GLAD\n";
     return -1;
   }
+  gladZone.End();
+
+  // --spirv: programs from the SPIR-V modules written by the
+  // optimize_shaders target, where the context can load them
+  bool spirv =
+      SpirvGL::Load((GLADloadproc)glfwGetProcAddress) && spirvRequested;
+  if (spirvRequested && !spirv)
+    cout << "ERROR::SHADER::SPIRV::NOT_SUPPORTED, using GLSL" << endl;
+
+  // one shared vertex stage plus a fragment stage per BRDF, unless the
+  // context cannot do separable programs or --monolithic asks for the old
+  // vertex+fragment programs; SPIR-V programs are always monolithic
+  bool separable = !monolithic && !spirv &&
+                   ProgramPipelineGL::Load((GLADloadproc)glfwGetProcAddress);
+
+  if (pipelineBenchmarkDraws > 0) {
+    if (!ProgramPipelineGL::Get().loaded) {
+      cout << "ERROR::SHADER::PIPELINE::NOT_SUPPORTED" << endl;
+      return -1;
+    }
+    const char *vertexPaths[3] = {"assets/shaders/phong.vert",
+                                  "assets/shaders/toon.vert",
+                                  "assets/shaders/oren_nayer.vert"};
+    const char *fragmentPaths[3] = {"assets/shaders/phong.frag",
+                                    "assets/shaders/toon.frag",
+                                    "assets/shaders/oren_nayer.frag"};
+    ProgramPipeline::Benchmark(vertexPaths, "assets/shaders/transform.vert",
+                               fragmentPaths, 3, pipelineBenchmarkDraws);
+    glfwTerminate();
+    return 0;
+  }
+
+  if (spirvBenchmarkRuns > 0) {
+    if (!SpirvGL::Get().loaded) {
+      cout << "ERROR::SHADER::SPIRV::NOT_SUPPORTED" << endl;
+      return -1;
+    }
+    const char *vertexPaths[3] = {"assets/shaders/phong.vert",
+                                  "assets/shaders/toon.vert",
+                                  "assets/shaders/oren_nayer.vert"};
+    const char *fragmentPaths[3] = {"assets/shaders/phong.frag",
+                                    "assets/shaders/toon.frag",
+                                    "assets/shaders/oren_nayer.frag"};
+    Shader::BenchmarkSpirv(vertexPaths, fragmentPaths, 3, spirvBenchmarkRuns);
+    glfwTerminate();
+    return 0;
+  }
 
+  ProfileZone imguiZone("ImGui init");
   IMGUI_CHECKVERSION();
+  ImGui::SetAllocatorFunctions(AllocTracker::ImGuiAlloc,
+                               AllocTracker::ImGuiFree);
   ImGui::CreateContext();
   ImGui::StyleColorsDark();
   ApplyCustomStyle();
 
   ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init("#version 330 core");
+  imguiZone.End();
 
   gCamera = &camera;
   gLastX = width / 2.0f;
@@ -177,25 +320,141 @@ int main() {
   glEnable(GL_DEPTH_TEST);
 
   // Load shaders
-  Shader phongShader("assets/shaders/phong.vert", "assets/shaders/phong.frag");
-
-  Shader toonShader("assets/shaders/toon.vert", "assets/shaders/toon.frag");
+  ProgramPipeline *pipeline = nullptr;
+  if (separable)
+    pipeline = new ProgramPipeline("assets/shaders/transform.vert");
+
+  // a vertex+fragment program, from SPIR-V when --spirv is on and the
+  // modules are there and link, else from GLSL
+  auto loadProgram = [spirv](const char *vertexPath, const char *fragmentPath,
+                             const vector<SpecConstant> &constants) -> Shader {
+    string vertexModule = SpirvModulePath(vertexPath);
+    string fragmentModule = SpirvModulePath(fragmentPath);
+    if (spirv && !vertexModule.empty() && !fragmentModule.empty()) {
+      Shader program(vertexModule.c_str(), fragmentModule.c_str(), constants);
+      if (program.Linked())
+        return program;
+      glDeleteProgram(program.ID);
+    }
+    if (spirv)
+      cout << "ERROR::SHADER::SPIRV::USING_GLSL " << fragmentPath << endl;
+    return Shader(vertexPath, fragmentPath);
+  };
+
+  Shader phongShader =
+      separable ? Shader(GL_FRAGMENT_SHADER, "assets/shaders/phong.frag")
+                : loadProgram("assets/shaders/phong.vert",
+                              "assets/shaders/phong.frag",
+                              vector<SpecConstant>());
+
+  // toon bands are a specialization constant of the SPIR-V program
+  vector<SpecConstant> toonConstants(1, SpecConstant("bands", toonBands));
+  float toonShaderBands = toonBands;
+  Shader toonShader =
+      separable ? Shader(GL_FRAGMENT_SHADER, "assets/shaders/toon.frag")
+                : loadProgram("assets/shaders/toon.vert",
+                              "assets/shaders/toon.frag", toonConstants);
+
+  Shader orenNayer =
+      separable ? Shader(GL_FRAGMENT_SHADER, "assets/shaders/oren_nayer.frag")
+                : loadProgram("assets/shaders/oren_nayer.vert",
+                              "assets/shaders/oren_nayer.frag",
+                              vector<SpecConstant>());
+
+  if (pipeline) {
+    pipeline->useFragment(phongShader);
+    pipeline->validate();
+  }
 
-  Shader orenNayer("assets/shaders/oren_nayer.vert",
-                   "assets/shaders/oren_nayer.frag");
+  // Environment ambient from SH coefficients written by lab2 --export-sh
+  SHIrradiance irradiance;
+  bool haveSH = !shPath.empty() && irradiance.Read(shPath);
+  if (!shPath.empty() && !haveSH)
+    cout << "ERROR::SH::CANNOT_READ " << shPath << endl;
+  useSH = haveSH;
+  irradiance.CreateUniformBuffer(); // stays bound for the whole run
+  phongShader.bindUniformBlock("SHIrradiance", SHIrradiance::BINDING);
+  toonShader.bindUniformBlock("SHIrradiance", SHIrradiance::BINDING);
+  orenNayer.bindUniformBlock("SHIrradiance", SHIrradiance::BINDING);
 
   // Load model
   Model kolobok("assets/models/kolobok/source/Kolobok.fbx");
   // Model kolobok("assets/models/utah_teapot.obj");
 
+  Benchmark benchmark;
+  GpuPassTimer gpuTimer;
+  gpuTimer.Init();
+  gpuTimer.onResult = [&benchmark](int tag, const string &series, double ms) {
+    benchmark.AddSceneSample(tag, series, ms);
+  };
+
+  if (runBenchmark) {
+    glfwSwapInterval(0); // measure frame cost, not vsync
+    benchmark.Start(camera);
+  }
+
+  // UI-edited values, recorded whenever they change
+  inputLog.TrackState(&lightPos, sizeof(lightPos));
+  inputLog.TrackState(&lightColor, sizeof(lightColor));
+  inputLog.TrackState(&lightIntensity, sizeof(lightIntensity));
+  inputLog.TrackState(&spacing, sizeof(spacing));
+  inputLog.TrackState(&linkModelColors, sizeof(linkModelColors));
+  inputLog.TrackState(&globalObjectColor, sizeof(globalObjectColor));
+  inputLog.TrackState(modelColors, sizeof(modelColors));
+  inputLog.TrackState(&orenRoughness, sizeof(orenRoughness));
+  inputLog.TrackState(&toonBands, sizeof(toonBands));
+  inputLog.TrackState(&toonMinShade, sizeof(toonMinShade));
+  inputLog.TrackState(&phongShininess, sizeof(phongShininess));
+  inputLog.TrackState(&phongSpecularStrength, sizeof(phongSpecularStrength));
+
+  if (!replayPath.empty()) {
+    if (!inputLog.StartReplay(replayPath))
+      return -1;
+    // live input must not leak into the replayed session
+    ImGui::GetIO().ConfigFlags |=
+        ImGuiConfigFlags_NoMouse | ImGuiConfigFlags_NoKeyboard;
+    if (headless)
+      glfwSwapInterval(0);
+  } else if (!recordPath.empty()) {
+    inputLog.StartRecording(recordPath);
+  }
+
+  // --alloc-test: after warmup, the render loop must not allocate
+  const int allocWarmupFrames = 120;
+  const int allocTestFrames = 600;
+  int frameNumber = 0;
+  unsigned long steadyAllocations = 0;
+  if (allocTest)
+    glfwSwapInterval(0);
+
   // Render loop
   while (!glfwWindowShouldClose(window)) {
+    PROFILE_SCOPE("frame");
+
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
-    processInput(window);
-
+    if (benchmark.Active())
+      deltaTime = benchmark.fixedDelta;
+    else if (inputLog.Recording() || inputLog.Replaying())
+      deltaTime = inputLog.fixedDelta;
+    else if (allocTest)
+      deltaTime = 1.0f / 60.0f;
+    sceneTime += deltaTime;
+
+    ProfileZone inputZone("input");
+    benchmark.BeginFrame(camera);
+    gpuTimer.BeginFrame(benchmark.FrameTag());
+    inputLog.BeginFrame();
+    if (inputLog.Finished())
+      glfwSetWindowShouldClose(window, true);
+
+    if (!benchmark.Active())
+      processInput(window);
+    inputZone.End();
+
+    ProfileZone uiZone("UI build");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -206,11 +465,19 @@ int main() {
 
     ImGui::Begin("Scene Controls");
 
+    ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
+    DrawRenderStats();
+    ImGui::Separator();
+
     // ----- LIGHT -----
     ImGui::Text("Light");
     ImGui::DragFloat3("Light Position", &lightPos.x, 0.5f);
     ImGui::ColorEdit3("Light Color", &lightColor.x);
     ImGui::SliderFloat("Light Intensity", &lightIntensity, 0.0f, 5.0f);
+    if (haveSH) {
+      ImGui::Checkbox("SH Ambient", &useSH);
+      ImGui::SliderFloat("SH Strength", &shStrength, 0.0f, 2.0f);
+    }
 
     ImGui::Separator();
 
@@ -244,13 +511,21 @@ int main() {
                        1.0f);
     ImGui::Separator();
 
+    ImGui::Checkbox("Performance Overlay", &showPerfOverlay);
+
     ImGui::End();
 
+    if (showPerfOverlay)
+      DrawPerfOverlay(gpuTimer);
+
+    inputLog.EndFrame();
+    uiZone.End();
+
     // Set transformations
     glm::mat4 projection = glm::perspective(
         glm::radians(camera.zoom), (float)width / (float)height, 0.1f, 1000.0f);
     glm::mat4 view = camera.GetViewMatrix();
-    float angle = glfwGetTime();
+    float angle = sceneTime;
 
     // Put three copies along X
     // spacing for teapot = 15.0f
@@ -258,21 +533,46 @@ int main() {
                               glm::vec3(0.0f, 0.0f, 0.0f),
                               glm::vec3(spacing, 0.0f, 0.0f)};
 
+    // the band count is built into a SPIR-V toon program, so a new count
+    // means a new specialization, on each frame the slider moves
+    if (toonShader.Spirv() && toonBands != toonShaderBands) {
+      glDeleteProgram(toonShader.ID);
+      toonConstants[0] = SpecConstant("bands", toonBands);
+      toonShader = loadProgram("assets/shaders/toon.vert",
+                               "assets/shaders/toon.frag", toonConstants);
+      toonShader.bindUniformBlock("SHIrradiance", SHIrradiance::BINDING);
+      toonShaderBands = toonBands;
+    }
+
     Shader *shaders[3] = {&phongShader, &toonShader, &orenNayer};
 
+    gpuTimer.Begin("mesh");
+    if (pipeline) {
+      // the vertex stage is shared, so its camera uniforms are set once
+      pipeline->bind();
+      pipeline->vertex.setMat4("projection", projection);
+      pipeline->vertex.setMat4("view", view);
+    }
     for (int i = 0; i < 3; i++) {
 
       glm::vec3 colorToUse =
           linkModelColors ? globalObjectColor : modelColors[i];
 
-      shaders[i]->use();
-      shaders[i]->setMat4("projection", projection);
-      shaders[i]->setMat4("view", view);
+      ProfileZone uniformZone("uniforms");
+      if (pipeline) {
+        pipeline->useFragment(*shaders[i]);
+      } else {
+        shaders[i]->use();
+        shaders[i]->setMat4("projection", projection);
+        shaders[i]->setMat4("view", view);
+      }
 
       shaders[i]->setVec3("lightPos", lightPos);
       shaders[i]->setVec3("lightColor", lightColor * lightIntensity);
       shaders[i]->setVec3("objectColor", colorToUse);
       shaders[i]->setVec3("viewPos", camera.position);
+      shaders[i]->setBool("useSH", useSH);
+      shaders[i]->setFloat("shStrength", shStrength);
 
       if (shaders[i] == &toonShader) {
         shaders[i]->setFloat("bands", toonBands);
@@ -292,22 +592,62 @@ int main() {
       model = glm::translate(model, positions[i]);
       model = glm::rotate(model, angle, glm::vec3(0.0f, 1.0f, 0.0f));
       model = glm::scale(model, glm::vec3(2.0f));
-      shaders[i]->setMat4("model", model);
+      if (pipeline)
+        pipeline->vertex.setMat4("model", model);
+      else
+        shaders[i]->setMat4("model", model);
+      uniformZone.End();
 
+      PROFILE_SCOPE("draw");
       kolobok.Draw(*shaders[i]);
     }
+    gpuTimer.End();
 
+    ProfileZone imguiRenderZone("ImGui render");
+    gpuTimer.Begin("imgui");
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    gpuTimer.End();
+    imguiRenderZone.End();
+
+    gpuTimer.EndFrame();
+    if (benchmark.Active())
+      RenderStats::Frame().ForEach([&benchmark](const char *name, double v) {
+        benchmark.AddSample(name, v);
+      });
+    benchmark.EndFrame(camera);
+    if (benchmark.Finished()) {
+      gpuTimer.Flush();
+      benchmark.WriteResults(benchmarkOut + ".csv", benchmarkOut + ".json");
+      glfwSetWindowShouldClose(window, true);
+    }
+
+    PROFILE_SCOPE("swap");
     glfwSwapBuffers(window);
-    glfwPollEvents();
+    inputLog.PollEvents(window, key_callback, mouse_callback, scroll_callback);
+    RenderStats::EndFrame();
+    AllocTracker::EndFrame();
+
+    frameNumber++;
+    if (allocTest && frameNumber == allocWarmupFrames)
+      AllocTracker::BeginSteadyState();
+    if (allocTest && frameNumber == allocWarmupFrames + allocTestFrames) {
+      steadyAllocations = AllocTracker::EndSteadyState();
+      glfwSetWindowShouldClose(window, true);
+    }
   }
 
+  if (inputLog.Recording())
+    inputLog.Save();
+  if (!profilePath.empty())
+    Profiler::WriteChromeTrace(profilePath);
+
   // Cleanup
+  delete pipeline;
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
   glfwTerminate();
 
-  return 0;
+  return steadyAllocations == 0 ? 0 : 1;
 }
@@ -0,0 +1,238 @@
+// Offline GLSL optimizer: runs every shader through glslang (GLSL to
+// SPIR-V), spirv-opt -O and spirv-cross (SPIR-V back to GLSL of the same
+// #version) and writes the result under the output directory, where
+// ShaderSourcePath() picks it up at runtime.
+//
+//   shader_opt [--glslang path] [--spirv-opt path] [--spirv-cross path]
+//              [--modules] -o shaders/optimized shaders/main.vert
+//              shaders/main.frag ...
+//
+// Also writes <output>/report.csv with each shader's instruction counts
+// before and after optimization: ALU, texture, branch and all instructions
+// in function bodies of the SPIR-V. They are static counts (a loop body
+// counts once) and are meant for review: commit the report next to the
+// shaders and a change that makes a BRDF more expensive shows in its diff.
+// A shader whose counts changed since the previous report is marked.
+//
+// --modules also writes <output>/<shader>.spv, the optimized SPIR-V module
+// itself, for programs that load SPIR-V (ARB_gl_spirv) instead of GLSL; see
+// SpirvModulePath(). Those keep their specialization constants, while the
+// GLSL copies are compiled with NO_SPEC_CONSTANTS defined so the shader can
+// keep a uniform in their place.
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct SpirvCounts {
+  int alu = 0, texture = 0, branch = 0, total = 0;
+};
+
+// Counts the instructions of the functions in a SPIR-V module. ALU is
+// arithmetic, GLSL.std.450 calls, conversions, comparisons, logic, bit and
+// derivative ops; texture is image sampling, fetches, gathers, reads,
+// writes and queries; branch is conditional branches and switches.
+static bool countSpirv(const string &path, SpirvCounts &counts) {
+  ifstream file(path.c_str(), ios::binary);
+  vector<char> bytes((istreambuf_iterator<char>(file)),
+                     istreambuf_iterator<char>());
+  if (bytes.size() < 20 || bytes.size() % 4 != 0)
+    return false;
+  vector<uint32_t> words(bytes.size() / 4);
+  memcpy(&words[0], &bytes[0], bytes.size());
+  if (words[0] != 0x07230203)
+    return false;
+
+  counts = SpirvCounts();
+  bool inFunction = false;
+  for (size_t i = 5; i < words.size();) {
+    uint32_t op = words[i] & 0xffff, length = words[i] >> 16;
+    if (length == 0 || i + length > words.size())
+      return false;
+    i += length;
+    if (op == 54) // OpFunction
+      inFunction = true;
+    if (!inFunction)
+      continue;
+    if (op == 56) // OpFunctionEnd
+      inFunction = false;
+    counts.total++;
+    if (op == 12 || (op >= 109 && op <= 124) || op == 84 ||
+        (op >= 126 && op <= 152) || (op >= 154 && op <= 191) ||
+        (op >= 194 && op <= 205) || (op >= 207 && op <= 215))
+      counts.alu++;
+    else if ((op >= 87 && op <= 99) || (op >= 101 && op <= 107) ||
+             (op >= 305 && op <= 314) || op == 320)
+      counts.texture++;
+    else if (op == 250 || op == 251)
+      counts.branch++;
+  }
+  return true;
+}
+
+// "#version 330 core" -> "330"; spirv-cross writes the same version back
+static string glslVersion(const string &path) {
+  ifstream file(path.c_str());
+  string line;
+  while (getline(file, line)) {
+    size_t at = line.find("version");
+    if (line.find('#') == string::npos || at == string::npos)
+      continue;
+    string digits;
+    for (size_t i = at + 7; i < line.size(); i++)
+      if (line[i] >= '0' && line[i] <= '9')
+        digits += line[i];
+      else if (!digits.empty())
+        break;
+    return digits;
+  }
+  return "330";
+}
+
+static string baseName(const string &path) {
+  size_t slash = path.find_last_of("/\\");
+  return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+// SPIR-V for OpenGL has one uniform location space per program, but glslang
+// numbers the loose uniforms of each stage from its --uniform-base, so every
+// stage starts from its own
+static int uniformBase(const string &name) {
+  const char *stages[] = {".vert", ".tesc", ".tese", ".geom", ".frag"};
+  for (int s = 0; s < 5; s++) {
+    size_t at = name.rfind(stages[s]);
+    if (at != string::npos && at + strlen(stages[s]) == name.size())
+      return s * 64;
+  }
+  return 0;
+}
+
+static string quoted(const string &s) { return "\"" + s + "\""; }
+
+static bool run(const string &command) {
+  if (system(command.c_str()) == 0)
+    return true;
+  cout << "ERROR::SHADER_OPT::COMMAND_FAILED " << command << endl;
+  return false;
+}
+
+// previous report: shader -> its eight counts
+static map<string, string> readReport(const string &path) {
+  map<string, string> rows;
+  ifstream file(path.c_str());
+  string line;
+  getline(file, line); // header
+  while (getline(file, line)) {
+    size_t comma = line.find(',');
+    if (comma != string::npos)
+      rows[line.substr(0, comma)] = line.substr(comma + 1);
+  }
+  return rows;
+}
+
+int main(int argc, char **argv) {
+  string glslang = "glslangValidator", spirvOpt = "spirv-opt",
+         spirvCross = "spirv-cross", outDir;
+  vector<string> shaders;
+  bool modules = false;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--glslang" && i + 1 < argc) {
+      glslang = argv[++i];
+    } else if (arg == "--spirv-opt" && i + 1 < argc) {
+      spirvOpt = argv[++i];
+    } else if (arg == "--spirv-cross" && i + 1 < argc) {
+      spirvCross = argv[++i];
+    } else if (arg == "--modules") {
+      modules = true;
+    } else if (arg == "-o" && i + 1 < argc) {
+      outDir = argv[++i];
+    } else {
+      shaders.push_back(arg);
+    }
+  }
+  if (shaders.empty() || outDir.empty()) {
+    cout << "usage: shader_opt [--glslang path] [--spirv-opt path] "
+            "[--spirv-cross path] [--modules] -o outdir shaders..."
+         << endl;
+    return 1;
+  }
+
+  string spvDir = outDir + "/spv";
+  mkdir(outDir.c_str(), 0755);
+  mkdir(spvDir.c_str(), 0755);
+  string reportPath = outDir + "/report.csv";
+  map<string, string> previous = readReport(reportPath);
+
+  ostringstream report;
+  report << "shader,alu_before,alu_after,texture_before,texture_after,"
+            "branch_before,branch_after,total_before,total_after\n";
+  printf("%-22s %16s %12s %10s %14s\n", "shader", "ALU", "texture", "branch",
+         "total");
+  int failed = 0;
+  for (size_t s = 0; s < shaders.size(); s++) {
+    const string &source = shaders[s];
+    string name = baseName(source);
+    string spv = spvDir + "/" + name + ".spv";
+    string optimized = spvDir + "/" + name + ".opt.spv";
+
+    // -G: SPIR-V for OpenGL, which needs explicit locations and bindings on
+    // loose uniforms; spirv-cross drops them again for the 3.3 target, so
+    // the programs are still set up by name
+    SpirvCounts before, after;
+    bool ok =
+        run(quoted(glslang) + " -G --auto-map-locations --auto-map-bindings "
+            "-DNO_SPEC_CONSTANTS -o " + quoted(spv) + " " + quoted(source)) &&
+        run(quoted(spirvOpt) + " -O " + quoted(spv) + " -o " +
+            quoted(optimized)) &&
+        run(quoted(spirvCross) + " --version " + glslVersion(source) +
+            " --no-es --no-420pack-extension --output " +
+            quoted(outDir + "/" + name) + " " + quoted(optimized));
+    if (ok && modules) {
+      string module = spvDir + "/" + name + ".module.spv";
+      ostringstream base;
+      base << uniformBase(name);
+      ok = run(quoted(glslang) + " -G --auto-map-locations "
+               "--auto-map-bindings --uniform-base " + base.str() + " -o " +
+               quoted(module) + " " + quoted(source)) &&
+           run(quoted(spirvOpt) + " -O " + quoted(module) + " -o " +
+               quoted(outDir + "/" + name + ".spv"));
+    }
+    if (ok && (!countSpirv(spv, before) || !countSpirv(optimized, after))) {
+      cout << "ERROR::SHADER_OPT::BAD_SPIRV " << name << endl;
+      ok = false;
+    }
+    if (!ok) {
+      failed++;
+      continue;
+    }
+
+    ostringstream row;
+    row << before.alu << "," << after.alu << "," << before.texture << ","
+        << after.texture << "," << before.branch << "," << after.branch << ","
+        << before.total << "," << after.total;
+    report << name << "," << row.str() << "\n";
+    bool changed = previous.count(name) && previous[name] != row.str();
+    printf("%-22s %6d -> %-6d %4d -> %-4d %3d -> %-3d %5d -> %-5d%s\n",
+           name.c_str(), before.alu, after.alu, before.texture, after.texture,
+           before.branch, after.branch, before.total, after.total,
+           changed ? "  changed since last report" : "");
+  }
+
+  ofstream(reportPath.c_str()) << report.str();
+  printf("optimized sources and %s written, %d failed\n", reportPath.c_str(),
+         failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "lz4_block.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Single-file asset archive written by tools/asset_bake and mapped read-only
+// at runtime. Layout, all little-endian:
+//
+//   "RTPK" u32 version, u32 entry count, u64 TOC offset
+//   chunk data
+//   TOC: per entry u16 name length, name, u32 type, u64 source hash,
+//        u64 size, u32 chunk count, then per chunk
+//        u64 offset, u32 stored size, u32 size
+//
+// Entries are split into CHUNK_SIZE pieces compressed independently with LZ4,
+// so one large entry decompresses on several threads. A chunk whose stored
+// size equals its size did not compress and is kept as is.
+
+enum AssetType {
+  ASSET_RAW,
+  ASSET_SHADER,  // GLSL source
+  ASSET_TEXTURE, // image blob, see EncodeImageBlob
+  ASSET_MESH,    // mesh blob, see Model::Bake
+};
+
+struct AssetChunk {
+  uint64_t offset;
+  uint32_t storedSize;
+  uint32_t size;
+};
+
+struct AssetEntry {
+  string name;
+  AssetType type;
+  uint64_t sourceHash; // of the source file, for incremental bakes
+  uint64_t size;
+  vector<AssetChunk> chunks;
+};
+
+const uint32_t ASSET_PACK_VERSION = 1;
+const uint32_t ASSET_PACK_CHUNK_SIZE = 256 * 1024;
+
+// FNV-1a, used for source hashes
+inline uint64_t AssetHash(const void *data, size_t bytes,
+                          uint64_t hash = 1469598103934665603ULL) {
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < bytes; i++)
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  return hash;
+}
+
+inline bool ReadFileBytes(const string &path, vector<unsigned char> &data) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return false;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data.resize(size > 0 ? size : 0);
+  bool ok = size <= 0 || fread(&data[0], size, 1, f) == 1;
+  fclose(f);
+  return ok;
+}
+
+class AssetPack {
+public:
+  AssetPack() : base(NULL), mappedSize(0) {}
+  ~AssetPack() { Close(); }
+
+  // the pack lab2 opened with --pack; empty unless opened
+  static AssetPack &Default() {
+    static AssetPack pack;
+    return pack;
+  }
+
+  bool Open(const string &path) {
+    PROFILE_SCOPE("AssetPack::Open");
+    Close();
+    if (!file.Open(path))
+      return false;
+    base = file.Data();
+    mappedSize = file.Size();
+    if (!base || !parse()) {
+      cout << "ERROR::ASSET_PACK::INVALID " << path << endl;
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close() {
+    file.Close();
+    base = NULL;
+    mappedSize = 0;
+    entries.clear();
+    index.clear();
+  }
+
+  bool IsOpen() const { return base != NULL; }
+  const vector<AssetEntry> &Entries() const { return entries; }
+
+  const AssetEntry *Find(const string &name) const {
+    map<string, size_t>::const_iterator it = index.find(name);
+    return it == index.end() ? NULL : &entries[it->second];
+  }
+
+  // stored bytes of one chunk, still compressed; points into the mapping
+  const unsigned char *ChunkData(const AssetChunk &chunk) const {
+    return base + chunk.offset;
+  }
+
+  // Decompresses an entry, its chunks spread over up to maxThreads threads.
+  bool Read(const string &name, vector<unsigned char> &data,
+            int maxThreads = 0) const {
+    const AssetEntry *entry = Find(name);
+    if (!entry)
+      return false;
+    PROFILE_SCOPE("AssetPack::Read");
+    data.resize(entry->size);
+    vector<size_t> starts(entry->chunks.size());
+    for (size_t i = 1; i < starts.size(); i++)
+      starts[i] = starts[i - 1] + entry->chunks[i - 1].size;
+
+    vector<char> ok(entry->chunks.size(), 1);
+    ParallelFor(
+        (int)entry->chunks.size(),
+        [&](int i) { ok[i] = readChunk(entry->chunks[i], &data[starts[i]]); },
+        maxThreads, "unpack");
+    for (size_t i = 0; i < ok.size(); i++)
+      if (!ok[i]) {
+        cout << "ERROR::ASSET_PACK::CORRUPT_ENTRY " << name << endl;
+        return false;
+      }
+    return true;
+  }
+
+  // Decompresses several entries at once, in parallel across entries; each
+  // entry's chunks run on its own worker. Missing names leave empty data.
+  void ReadMany(const vector<string> &names,
+                vector<vector<unsigned char> > &data,
+                int maxThreads = 0) const {
+    data.clear();
+    data.resize(names.size());
+    ParallelFor(
+        (int)names.size(), [&](int i) { Read(names[i], data[i], 1); },
+        maxThreads, "unpack");
+  }
+
+  bool ReadString(const string &name, string &text) const {
+    vector<unsigned char> data;
+    if (!Read(name, data))
+      return false;
+    text.assign(data.begin(), data.end());
+    return true;
+  }
+
+private:
+  MappedFile file;
+  const unsigned char *base;
+  size_t mappedSize;
+  vector<AssetEntry> entries;
+  map<string, size_t> index;
+
+  bool readChunk(const AssetChunk &chunk, unsigned char *out) const {
+    if (chunk.storedSize == chunk.size) {
+      memcpy(out, base + chunk.offset, chunk.size);
+      return true;
+    }
+    return Lz4Decompress(base + chunk.offset, chunk.storedSize, out,
+                         chunk.size);
+  }
+
+  // bounds-checked reads of the TOC; pos may be anything a corrupt pack
+  // says, so the check is written not to overflow
+  template <typename T> bool get(size_t &pos, T &value) const {
+    if (pos > mappedSize || sizeof(T) > mappedSize - pos)
+      return false;
+    memcpy(&value, base + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+  }
+
+  bool parse() {
+    uint32_t version = 0, count = 0;
+    uint64_t tocOffset = 0;
+    size_t pos = 4;
+    if (mappedSize < 20 || memcmp(base, "RTPK", 4) != 0 ||
+        !get(pos, version) || version != ASSET_PACK_VERSION ||
+        !get(pos, count) || !get(pos, tocOffset))
+      return false;
+
+    // each entry takes at least 26 bytes of TOC and each chunk 16, so a
+    // corrupt count is caught before it sizes a vector
+    pos = (size_t)tocOffset;
+    if (pos > mappedSize || count > (mappedSize - pos) / 26)
+      return false;
+    entries.resize(count);
+    for (uint32_t e = 0; e < count; e++) {
+      AssetEntry &entry = entries[e];
+      uint16_t nameLength = 0;
+      uint32_t type = 0, chunkCount = 0;
+      if (!get(pos, nameLength) || nameLength > mappedSize - pos)
+        return false;
+      entry.name.assign((const char *)base + pos, nameLength);
+      pos += nameLength;
+      if (!get(pos, type) || !get(pos, entry.sourceHash) ||
+          !get(pos, entry.size) || !get(pos, chunkCount) ||
+          chunkCount > (mappedSize - pos) / 16)
+        return false;
+      entry.type = (AssetType)type;
+      entry.chunks.resize(chunkCount);
+      uint64_t total = 0;
+      for (uint32_t c = 0; c < chunkCount; c++) {
+        AssetChunk &chunk = entry.chunks[c];
+        if (!get(pos, chunk.offset) || !get(pos, chunk.storedSize) ||
+            !get(pos, chunk.size) ||
+            chunk.offset > mappedSize ||
+            chunk.storedSize > mappedSize - chunk.offset)
+          return false;
+        total += chunk.size;
+      }
+      if (total != entry.size)
+        return false;
+      index[entry.name] = e;
+    }
+    return true;
+  }
+};
+
+// Builds a pack in memory and writes it in one go.
+class AssetPackWriter {
+public:
+  // compresses data in CHUNK_SIZE pieces on up to maxThreads threads
+  void Add(const string &name, AssetType type, uint64_t sourceHash,
+           const vector<unsigned char> &data, int maxThreads = 0) {
+    PendingEntry pending;
+    pending.entry.name = name;
+    pending.entry.type = type;
+    pending.entry.sourceHash = sourceHash;
+    pending.entry.size = data.size();
+    int chunkCount =
+        (int)((data.size() + ASSET_PACK_CHUNK_SIZE - 1) / ASSET_PACK_CHUNK_SIZE);
+    pending.entry.chunks.resize(chunkCount);
+    pending.stored.resize(chunkCount);
+    ParallelFor(
+        chunkCount,
+        [&](int c) {
+          size_t start = (size_t)c * ASSET_PACK_CHUNK_SIZE;
+          int size = (int)(data.size() - start < ASSET_PACK_CHUNK_SIZE
+                               ? data.size() - start
+                               : ASSET_PACK_CHUNK_SIZE);
+          vector<unsigned char> &out = pending.stored[c];
+          out.resize(Lz4CompressBound(size));
+          int storedSize = Lz4Compress(&data[start], size, &out[0]);
+          if (storedSize >= size) // incompressible: keep it raw
+            out.assign(data.begin() + start, data.begin() + start + size);
+          else
+            out.resize(storedSize);
+          pending.entry.chunks[c].size = size;
+          pending.entry.chunks[c].storedSize = (uint32_t)out.size();
+        },
+        maxThreads, "compress");
+    pendingEntries.push_back(pending);
+  }
+
+  // copies an entry from an earlier pack without recompressing it
+  void Reuse(const AssetPack &pack, const AssetEntry &entry) {
+    PendingEntry pending;
+    pending.entry = entry;
+    pending.stored.resize(entry.chunks.size());
+    for (size_t c = 0; c < entry.chunks.size(); c++) {
+      const unsigned char *p = pack.ChunkData(entry.chunks[c]);
+      pending.stored[c].assign(p, p + entry.chunks[c].storedSize);
+    }
+    pendingEntries.push_back(pending);
+  }
+
+  // total sizes, for reporting
+  void Sizes(uint64_t &raw, uint64_t &stored) const {
+    raw = stored = 0;
+    for (size_t e = 0; e < pendingEntries.size(); e++)
+      for (size_t c = 0; c < pendingEntries[e].stored.size(); c++) {
+        raw += pendingEntries[e].entry.chunks[c].size;
+        stored += pendingEntries[e].stored[c].size();
+      }
+  }
+
+  // writes next to path and renames, so an open mapping of the old pack
+  // stays valid until it is closed
+  bool Write(const string &path) {
+    string temp = path + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+      cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << temp << endl;
+      return false;
+    }
+    uint32_t count = (uint32_t)pendingEntries.size();
+    uint64_t offset = 20, tocOffset = 0;
+    fwrite("RTPK", 4, 1, f);
+    fwrite(&ASSET_PACK_VERSION, 4, 1, f);
+    fwrite(&count, 4, 1, f);
+    fwrite(&tocOffset, 8, 1, f); // patched below
+
+    for (size_t e = 0; e < pendingEntries.size(); e++) {
+      PendingEntry &pending = pendingEntries[e];
+      for (size_t c = 0; c < pending.stored.size(); c++) {
+        pending.entry.chunks[c].offset = offset;
+        if (!pending.stored[c].empty())
+          fwrite(&pending.stored[c][0], pending.stored[c].size(), 1, f);
+        offset += pending.stored[c].size();
+      }
+    }
+
+    tocOffset = offset;
+    for (size_t e = 0; e < pendingEntries.size(); e++) {
+      const AssetEntry &entry = pendingEntries[e].entry;
+      uint16_t nameLength = (uint16_t)entry.name.size();
+      uint32_t type = entry.type, chunkCount = (uint32_t)entry.chunks.size();
+      fwrite(&nameLength, 2, 1, f);
+      fwrite(entry.name.data(), nameLength, 1, f);
+      fwrite(&type, 4, 1, f);
+      fwrite(&entry.sourceHash, 8, 1, f);
+      fwrite(&entry.size, 8, 1, f);
+      fwrite(&chunkCount, 4, 1, f);
+      for (size_t c = 0; c < entry.chunks.size(); c++) {
+        fwrite(&entry.chunks[c].offset, 8, 1, f);
+        fwrite(&entry.chunks[c].storedSize, 4, 1, f);
+        fwrite(&entry.chunks[c].size, 4, 1, f);
+      }
+    }
+    fseek(f, 12, SEEK_SET);
+    fwrite(&tocOffset, 8, 1, f);
+    bool ok = ferror(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (ok && rename(temp.c_str(), path.c_str()) != 0)
+      ok = false;
+    if (!ok)
+      cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << path << endl;
+    return ok;
+  }
+
+private:
+  struct PendingEntry {
+    AssetEntry entry;
+    vector<vector<unsigned char> > stored; // per chunk
+  };
+  vector<PendingEntry> pendingEntries;
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef ASSIMP_IO_H
+#define ASSIMP_IO_H
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "asset_pack.h"
+#include "async_io.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// Assimp file access without stdio: files prefetched by AsyncFileReader are
+// served from memory, other files are memory-mapped, and raw entries of an
+// asset pack (a model kept as source with `asset_bake --raw-models`, plus
+// its .mtl/.bin companions) are served from the pack. Multi-file formats
+// work because Assimp opens every companion through the same IOSystem.
+
+// Read-only stream over bytes owned by a mapping, a decompressed buffer, a
+// prefetched file or (for stored single-chunk pack entries) the pack mapping
+// itself.
+class MemoryIOStream : public Assimp::IOStream {
+public:
+  MappedFile file;                   // set when backed by a file
+  vector<unsigned char> owned;       // set when decompressed from a pack
+  AsyncFileReader::Buffer prefetched; // set when read ahead
+  const unsigned char *data;
+  size_t size;
+  size_t position;
+
+  MemoryIOStream() : data(NULL), size(0), position(0) {}
+
+  size_t Read(void *buffer, size_t elementSize, size_t count) {
+    if (elementSize == 0)
+      return 0;
+    size_t available = (size - position) / elementSize;
+    count = count < available ? count : available;
+    if (count)
+      memcpy(buffer, data + position, count * elementSize);
+    position += count * elementSize;
+    return count;
+  }
+
+  size_t Write(const void *, size_t, size_t) { return 0; }
+
+  aiReturn Seek(size_t offset, aiOrigin origin) {
+    size_t target = origin == aiOrigin_SET   ? offset
+                    : origin == aiOrigin_CUR ? position + offset
+                                             : size + offset;
+    if (target > size)
+      return aiReturn_FAILURE;
+    position = target;
+    return aiReturn_SUCCESS;
+  }
+
+  size_t Tell() const { return position; }
+  size_t FileSize() const { return size; }
+  void Flush() {}
+};
+
+// what one import read, for reporting
+struct AssimpIOStats {
+  int files;
+  int fromPack;
+  int prefetched;
+  size_t bytes;
+
+  AssimpIOStats() : files(0), fromPack(0), prefetched(0), bytes(0) {}
+};
+
+// Hand a new instance to Importer::SetIOHandler; the importer deletes it,
+// which releases the prefetched files it served.
+class MappedIOSystem : public Assimp::IOSystem {
+public:
+  MappedIOSystem(const AssetPack &pack, AssimpIOStats *stats = NULL)
+      : pack(pack), stats(stats) {}
+
+  ~MappedIOSystem() {
+    for (size_t i = 0; i < served.size(); i++)
+      AsyncFileReader::Default().Release(served[i]);
+  }
+
+  bool Exists(const char *path) const {
+    string name = normalize(path);
+    const AssetEntry *entry = packEntry(name);
+    struct stat st;
+    return AsyncFileReader::Default().Find(name) || entry ||
+           stat(name.c_str(), &st) == 0;
+  }
+
+  char getOsSeparator() const { return '/'; }
+
+  Assimp::IOStream *Open(const char *path, const char *mode = "rb") {
+    if (strchr(mode, 'w') || strchr(mode, 'a'))
+      return NULL; // read-only
+    string name = normalize(path);
+    MemoryIOStream *stream = new MemoryIOStream();
+
+    const AssetEntry *entry = packEntry(name);
+    stream->prefetched = AsyncFileReader::Default().Find(name);
+    bool ok;
+    if (stream->prefetched) {
+      stream->data = stream->prefetched->empty() ? NULL
+                                                 : &(*stream->prefetched)[0];
+      stream->size = stream->prefetched->size();
+      served.push_back(name);
+      entry = NULL;
+      ok = true;
+    } else if (entry && entry->chunks.size() == 1 &&
+        entry->chunks[0].storedSize == entry->chunks[0].size) {
+      // stored uncompressed: read straight from the pack mapping
+      stream->data = pack.ChunkData(entry->chunks[0]);
+      stream->size = entry->size;
+      ok = true;
+    } else if (entry) {
+      ok = pack.Read(name, stream->owned);
+      stream->data = stream->owned.empty() ? NULL : &stream->owned[0];
+      stream->size = stream->owned.size();
+    } else {
+      ok = stream->file.Open(name);
+      stream->file.AdviseSequential();
+      stream->data = stream->file.Data();
+      stream->size = stream->file.Size();
+    }
+    if (!ok) {
+      delete stream;
+      return NULL;
+    }
+    if (stats) {
+      stats->files++;
+      stats->fromPack += entry ? 1 : 0;
+      stats->prefetched += stream->prefetched ? 1 : 0;
+      stats->bytes += stream->size;
+    }
+    return stream;
+  }
+
+  void Close(Assimp::IOStream *stream) { delete stream; }
+
+private:
+  const AssetPack &pack;
+  AssimpIOStats *stats;
+  vector<string> served; // prefetched paths
+
+  const AssetEntry *packEntry(const string &name) const {
+    const AssetEntry *entry = pack.IsOpen() ? pack.Find(name) : NULL;
+    return entry && entry->type == ASSET_RAW ? entry : NULL;
+  }
+
+  // pack entries use forward slashes and no leading "./"
+  static string normalize(const char *path) {
+    string name = path;
+    for (size_t i = 0; i < name.size(); i++)
+      if (name[i] == '\\')
+        name[i] = '/';
+    while (name.compare(0, 2, "./") == 0)
+      name.erase(0, 2);
+    for (size_t at = name.find("/./"); at != string::npos;
+         at = name.find("/./"))
+      name.erase(at, 2);
+    return name;
+  }
+};
+
+#endif
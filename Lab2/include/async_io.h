@@ -0,0 +1,601 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ASYNC_IO_URING 1
+#endif
+#endif
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asset_pack.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+
+// Batched whole-file reads for startup. Every file a scene needs is read in
+// one batch in the background, through io_uring on Linux (one syscall
+// submits many reads and the kernel keeps the disk queue full) or a pool of
+// threads doing pread elsewhere. Shader, DecodeImage and the Assimp
+// IOSystem look for a file here before opening it themselves, so they decode
+// from memory instead of blocking on the disk one file at a time.
+
+enum IoBackend {
+  IO_BACKEND_AUTO,    // io_uring when the kernel allows it, else threads
+  IO_BACKEND_URING,
+  IO_BACKEND_THREADS,
+  IO_BACKEND_SYNC,    // one file after the other, like ifstream
+};
+
+inline const char *IoBackendName(IoBackend backend) {
+  return backend == IO_BACKEND_URING     ? "io_uring"
+         : backend == IO_BACKEND_THREADS ? "threads"
+         : backend == IO_BACKEND_SYNC    ? "sync"
+                                         : "auto";
+}
+
+struct FileRead {
+  string path;
+  vector<unsigned char> data;
+  bool ok;
+
+  FileRead() : ok(false) {}
+};
+
+// called with a file's index once its read has finished or failed, from
+// whichever thread did the read
+typedef function<void(size_t)> FileDoneFn;
+
+// reads one file with pread, retrying short reads
+inline bool ReadWholeFile(FileRead &file) {
+  int fd = open(file.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return file.ok = false;
+  struct stat st;
+  file.ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  if (file.ok) {
+    file.data.resize((size_t)st.st_size);
+    size_t done = 0;
+    while (file.ok && done < file.data.size()) {
+      ssize_t n = pread(fd, &file.data[done], file.data.size() - done,
+                        (off_t)done);
+      if (n < 0 && errno == EINTR)
+        continue;
+      file.ok = n > 0; // 0 means the file shrank
+      if (n > 0)
+        done += (size_t)n;
+    }
+  }
+  close(fd);
+  return file.ok;
+}
+
+#ifdef ASYNC_IO_URING
+// The smallest io_uring that does the job, on raw syscalls (no liburing):
+// one submission and one completion ring mapped from the kernel.
+class IoUring {
+public:
+  IoUring()
+      : fd(-1), sqRing(NULL), cqRing(NULL), sqRingSize(0), cqRingSize(0),
+        sqes(NULL), sqesSize(0), unsubmitted(0) {}
+  ~IoUring() { Close(); }
+
+  bool Init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+      return false; // old kernel, or disabled by seccomp/sysctl
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+      sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize
+                                                        : cqRingSize;
+#endif
+    sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+    cqRing = single ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mapRing(sqesSize, IORING_OFF_SQES);
+    if (!sqRing || !cqRing || !sqes) {
+      Close();
+      return false;
+    }
+
+    char *sq = (char *)sqRing, *cq = (char *)cqRing;
+    sqHead = (unsigned *)(sq + params.sq_off.head);
+    sqTail = (unsigned *)(sq + params.sq_off.tail);
+    sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sqEntries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sqArray = (unsigned *)(sq + params.sq_off.array);
+    cqHead = (unsigned *)(cq + params.cq_off.head);
+    cqTail = (unsigned *)(cq + params.cq_off.tail);
+    cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void Close() {
+    if (sqes)
+      munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing)
+      munmap(cqRing, cqRingSize);
+    if (sqRing)
+      munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+    sqRing = cqRing = NULL;
+    sqes = NULL;
+  }
+
+  // queues a one-iovec read; false when the submission ring is full. The
+  // iovec must stay valid until the read completes.
+  bool PushRead(int file, const iovec *iov, uint64_t offset,
+                uint64_t userData) {
+    unsigned tail = *sqTail; // only this thread writes the tail
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+      return false;
+    unsigned index = tail & sqMask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV; // READ needs 5.6, READV works since 5.1
+    sqe->fd = file;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = userData;
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+    return true;
+  }
+
+  // submits everything queued and waits for at least minComplete reads
+  bool Submit(unsigned minComplete) {
+    for (;;) {
+      int n = (int)syscall(__NR_io_uring_enter, fd, unsubmitted, minComplete,
+                           minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if (n >= 0) {
+        unsubmitted -= (unsigned)n;
+        return true;
+      }
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return false;
+    }
+  }
+
+  bool PopCompletion(uint64_t &userData, int &result) {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+      return false;
+    const io_uring_cqe &cqe = cqes[head & cqMask];
+    userData = cqe.user_data;
+    result = cqe.res;
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+private:
+  int fd;
+  void *sqRing, *cqRing;
+  size_t sqRingSize, cqRingSize;
+  io_uring_sqe *sqes;
+  size_t sqesSize;
+  unsigned *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+  unsigned *cqHead, *cqTail, cqMask;
+  io_uring_cqe *cqes;
+  unsigned unsubmitted;
+
+  void *mapRing(size_t size, uint64_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, (off_t)offset);
+    return p == MAP_FAILED ? NULL : p;
+  }
+
+  IoUring(const IoUring &);
+  IoUring &operator=(const IoUring &);
+};
+
+// Reads every file through one ring. Files are split into CHUNK-sized reads
+// so a large texture is read in parallel too; files are opened as the queue
+// drains, so a batch of thousands stays far below the fd limit. Returns
+// false only when io_uring is unavailable.
+inline bool ReadFilesIoUring(vector<FileRead> &files,
+                             const FileDoneFn &onDone = FileDoneFn(),
+                             unsigned depth = 64) {
+  const unsigned CHUNK = 512 * 1024;
+  const int MAX_OPEN = 256;
+
+  IoUring ring;
+  if (!ring.Init(depth))
+    return false;
+
+  struct Read {
+    int file;
+    uint64_t offset;
+    size_t length;
+  };
+  struct Open {
+    int fd;
+    int outstanding; // reads queued or in flight
+  };
+  vector<Open> opened(files.size());
+  deque<Read> queue;
+  vector<Read> slots(depth);
+  vector<iovec> iovecs(depth);
+  vector<unsigned> freeSlots;
+  for (unsigned i = 0; i < depth; i++)
+    freeSlots.push_back(depth - 1 - i);
+
+  size_t nextFile = 0;
+  int openFiles = 0;
+  unsigned inFlight = 0;
+  auto finishRead = [&](int file) {
+    if (--opened[file].outstanding == 0) {
+      close(opened[file].fd);
+      openFiles--;
+      if (onDone)
+        onDone((size_t)file);
+    }
+  };
+
+  for (;;) {
+    while (queue.size() < depth && nextFile < files.size() &&
+           openFiles < MAX_OPEN) {
+      int i = (int)nextFile++;
+      FileRead &file = files[i];
+      int fd = open(file.path.c_str(), O_RDONLY);
+      struct stat st;
+      file.ok = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+      if (!file.ok || st.st_size == 0) {
+        if (fd >= 0)
+          close(fd);
+        if (onDone)
+          onDone((size_t)i);
+        continue;
+      }
+      file.data.resize((size_t)st.st_size);
+      opened[i].fd = fd;
+      opened[i].outstanding = 0;
+      openFiles++;
+      for (size_t at = 0; at < file.data.size(); at += CHUNK) {
+        Read read = {i, at, min((size_t)CHUNK, file.data.size() - at)};
+        queue.push_back(read);
+        opened[i].outstanding++;
+      }
+    }
+
+    while (!queue.empty() && !freeSlots.empty()) {
+      Read read = queue.front();
+      if (!files[read.file].ok) { // an earlier read of this file failed
+        queue.pop_front();
+        finishRead(read.file);
+        continue;
+      }
+      unsigned slot = freeSlots.back();
+      slots[slot] = read;
+      iovecs[slot].iov_base = &files[read.file].data[read.offset];
+      iovecs[slot].iov_len = read.length;
+      if (!ring.PushRead(opened[read.file].fd, &iovecs[slot], read.offset,
+                         slot))
+        break;
+      freeSlots.pop_back();
+      queue.pop_front();
+      inFlight++;
+    }
+
+    if (inFlight == 0) {
+      if (queue.empty() && nextFile == files.size())
+        break;
+      continue; // files failed to open; open more
+    }
+    if (!ring.Submit(1)) {
+      // cannot happen once the ring exists; fail what is left
+      for (size_t i = 0; i < files.size(); i++)
+        files[i].ok = false;
+      break;
+    }
+
+    uint64_t slot;
+    int result;
+    while (ring.PopCompletion(slot, result)) {
+      Read read = slots[slot];
+      freeSlots.push_back((unsigned)slot);
+      inFlight--;
+      if (result == -EAGAIN || result == -EINTR) {
+        queue.push_front(read);
+      } else if (result <= 0) {
+        files[read.file].ok = false; // error, or the file shrank
+        finishRead(read.file);
+      } else if ((size_t)result < read.length) {
+        read.offset += (uint64_t)result; // short read: queue the rest
+        read.length -= (size_t)result;
+        queue.push_front(read);
+      } else {
+        finishRead(read.file);
+      }
+    }
+  }
+
+  // a ring error above may leave files open
+  for (size_t i = 0; i < nextFile; i++)
+    if (files[i].ok == false && opened[i].outstanding > 0)
+      close(opened[i].fd);
+  return true;
+}
+#endif
+
+// I/O-bound, so more threads than cores pay off
+inline void ReadFilesThreaded(vector<FileRead> &files,
+                              const FileDoneFn &onDone = FileDoneFn(),
+                              int threads = 16) {
+  ParallelFor(
+      (int)files.size(),
+      [&](int i) {
+        ReadWholeFile(files[i]);
+        if (onDone)
+          onDone((size_t)i);
+      },
+      threads, "file read");
+}
+
+// Reads a batch with the given backend and returns the one that ran.
+// onDone, if set, hears about each file as soon as it is in.
+inline IoBackend ReadFiles(vector<FileRead> &files,
+                           IoBackend backend = IO_BACKEND_AUTO,
+                           const FileDoneFn &onDone = FileDoneFn()) {
+  PROFILE_SCOPE("ReadFiles");
+#ifdef ASYNC_IO_URING
+  if ((backend == IO_BACKEND_AUTO || backend == IO_BACKEND_URING) &&
+      ReadFilesIoUring(files, onDone))
+    return IO_BACKEND_URING;
+#endif
+  if (backend == IO_BACKEND_SYNC) {
+    for (size_t i = 0; i < files.size(); i++) {
+      ReadWholeFile(files[i]);
+      if (onDone)
+        onDone(i);
+    }
+    return IO_BACKEND_SYNC;
+  }
+  ReadFilesThreaded(files, onDone);
+  return IO_BACKEND_THREADS;
+}
+
+// Prefetched files for the loaders. Submit starts a batch on a background
+// thread and returns at once. Each file is published as soon as its own read
+// finishes, so Find waits only when the file asked for is still in flight,
+// and only until that file is in. Buffers are shared, so Release and Clear
+// never pull memory from under a decoder that already has it.
+class AsyncFileReader {
+public:
+  typedef shared_ptr<const vector<unsigned char>> Buffer;
+
+  static AsyncFileReader &Default() {
+    static AsyncFileReader reader;
+    return reader;
+  }
+
+  AsyncFileReader() : backend(IO_BACKEND_AUTO), batchMs(0), batchBytes(0) {}
+  ~AsyncFileReader() { Wait(); }
+
+  void Submit(const vector<string> &paths,
+              IoBackend requested = IO_BACKEND_AUTO) {
+    Wait();
+    lock_guard<mutex> lock(filesMutex);
+    batch.assign(paths.size(), FileRead());
+    batchBytes = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+      batch[i].path = paths[i];
+      pending.insert(paths[i]);
+    }
+    worker = thread([this, requested]() {
+      if (Profiler::Enabled())
+        Profiler::SetThreadName("file prefetch");
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      backend = ReadFiles(batch, requested, [this](size_t i) {
+        lock_guard<mutex> lock(filesMutex);
+        publish(batch[i]);
+        fileDone.notify_all();
+      });
+      batchMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                start)
+                    .count();
+      // every backend reports each file, but an io_uring error can cut the
+      // batch short; whatever it left is failed here
+      lock_guard<mutex> lock(filesMutex);
+      for (size_t i = 0; i < batch.size(); i++)
+        publish(batch[i]);
+      fileDone.notify_all();
+    });
+  }
+
+  // blocks until the current batch is in
+  void Wait() {
+    lock_guard<mutex> waitLock(waitMutex);
+    if (!worker.joinable())
+      return;
+    worker.join();
+    lock_guard<mutex> lock(filesMutex);
+    batch.clear();
+  }
+
+  // NULL when the file was not prefetched (or could not be read)
+  Buffer Find(const string &path) {
+    unique_lock<mutex> lock(filesMutex);
+    fileDone.wait(lock, [&]() { return pending.count(path) == 0; });
+    map<string, Buffer>::const_iterator it = files.find(path);
+    return it == files.end() ? Buffer() : it->second;
+  }
+
+  // drops a file once its loader is done with it
+  void Release(const string &path) {
+    lock_guard<mutex> lock(filesMutex);
+    files.erase(path);
+  }
+
+  void Clear() {
+    Wait();
+    lock_guard<mutex> lock(filesMutex);
+    files.clear();
+  }
+
+  // of the last batch, valid after Wait
+  IoBackend Backend() const { return backend; }
+  double BatchMs() const { return batchMs; }
+  size_t BatchBytes() const { return batchBytes; }
+
+  // Reads paths with every backend, cold (evicted from the page cache) and
+  // warm, and prints the times. Cold runs need POSIX_FADV_DONTNEED.
+  static void Benchmark(const vector<string> &paths, int repeats = 3) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+      struct stat st;
+      if (stat(paths[i].c_str(), &st) == 0)
+        bytes += (size_t)st.st_size;
+    }
+    cout << "Reading " << paths.size() << " files, " << bytes / 1048576.0
+         << " MB, best of " << repeats << endl;
+    const IoBackend backends[] = {IO_BACKEND_SYNC, IO_BACKEND_THREADS,
+                                  IO_BACKEND_URING};
+    for (int b = 0; b < 3; b++) {
+      double best[2] = {1e30, 1e30};
+      IoBackend ran = backends[b];
+      int failed = 0;
+      for (int r = 0; r < repeats; r++) {
+        for (int warm = 0; warm < 2; warm++) {
+          if (!warm)
+            for (size_t i = 0; i < paths.size(); i++)
+              EvictFromPageCache(paths[i]);
+          vector<FileRead> files(paths.size());
+          for (size_t i = 0; i < paths.size(); i++)
+            files[i].path = paths[i];
+          chrono::steady_clock::time_point start =
+              chrono::steady_clock::now();
+          ran = ReadFiles(files, backends[b]);
+          double ms = chrono::duration<double, milli>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+          best[warm] = ms < best[warm] ? ms : best[warm];
+          failed = 0;
+          for (size_t i = 0; i < files.size(); i++)
+            failed += files[i].ok ? 0 : 1;
+        }
+      }
+      cout << "  " << IoBackendName(backends[b]);
+      if (ran != backends[b])
+        cout << " (unavailable, ran " << IoBackendName(ran) << ")";
+      cout << ": cold " << best[0] << " ms, warm " << best[1] << " ms";
+      if (failed)
+        cout << ", " << failed << " failed";
+      cout << endl;
+    }
+  }
+
+private:
+  mutex waitMutex;  // one joiner at a time
+  mutex filesMutex; // files, pending, batchBytes and batch setup
+  condition_variable fileDone; // a pending file was published
+  thread worker;
+  vector<FileRead> batch; // owned by the worker while it runs
+  set<string> pending;
+  map<string, Buffer> files;
+  IoBackend backend;
+  double batchMs;
+  size_t batchBytes;
+
+  // moves a finished read into files; filesMutex held. Only the first call
+  // for a path does anything, so the worker's final sweep skips it.
+  void publish(FileRead &read) {
+    if (pending.erase(read.path) == 0)
+      return;
+    if (!read.ok)
+      return;
+    batchBytes += read.data.size();
+    shared_ptr<vector<unsigned char>> data(new vector<unsigned char>());
+    data->swap(read.data);
+    files[read.path] = data;
+  }
+
+  AsyncFileReader(const AsyncFileReader &);
+  AsyncFileReader &operator=(const AsyncFileReader &);
+};
+
+// A file's bytes wherever the loaders may find them: the prefetched files,
+// a raw asset pack entry, or a memory mapping of the file itself. A
+// prefetched buffer is released from the reader as soon as it is taken, so it
+// lives exactly as long as this object.
+class AssetBytes {
+public:
+  AssetBytes() : data(NULL), size(0) {}
+
+  bool Open(const string &path) {
+    prefetched = AsyncFileReader::Default().Find(path);
+    if (prefetched)
+      AsyncFileReader::Default().Release(path);
+    const AssetPack &pack = AssetPack::Default();
+    const AssetEntry *entry = pack.IsOpen() ? pack.Find(path) : NULL;
+    if (prefetched) {
+      data = prefetched->empty() ? NULL : &(*prefetched)[0];
+      size = prefetched->size();
+    } else if (entry && entry->type == ASSET_RAW && pack.Read(path, unpacked)) {
+      data = unpacked.empty() ? NULL : &unpacked[0];
+      size = unpacked.size();
+    } else if (file.Open(path)) {
+      file.AdviseSequential();
+      data = file.Data();
+      size = file.Size();
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  const unsigned char *Data() const { return data; }
+  size_t Size() const { return size; }
+
+private:
+  AsyncFileReader::Buffer prefetched;
+  vector<unsigned char> unpacked;
+  MappedFile file;
+  const unsigned char *data;
+  size_t size;
+
+  AssetBytes(const AssetBytes &);
+  AssetBytes &operator=(const AssetBytes &);
+};
+
+#endif
@@ -0,0 +1,568 @@
+#ifndef BC_CODEC_H
+#define BC_CODEC_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+
+using namespace std;
+
+// CPU encoders for BC1 (DXT1, 4 bpp, opaque RGB) and BC7 mode 6 (8 bpp,
+// RGBA with 16 interpolation steps), plus sRGB-correct mip generation.
+// Encoding is offline (tools/texcompress) so the encoders favour quality
+// over speed: PCA endpoints followed by a least-squares refit. Inner loops
+// are plain float loops over 16 pixels that the compiler vectorizes.
+//
+// Blocks are 4x4 RGBA8 pixels, row-major, 64 bytes.
+
+enum BcFormat {
+  BC_FORMAT_BC1,
+  BC_FORMAT_BC7,
+};
+
+inline int BcBlockBytes(BcFormat format) {
+  return format == BC_FORMAT_BC1 ? 8 : 16;
+}
+
+// bytes for a size x size image, rounded up to whole blocks
+inline size_t BcImageBytes(BcFormat format, int size) {
+  size_t blocks = (size_t)((size + 3) / 4);
+  return blocks * blocks * BcBlockBytes(format);
+}
+
+// ---- shared helpers --------------------------------------------------------
+
+inline float BcClamp(float v, float lo, float hi) {
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// mean and dominant direction of the block's colours (power iteration on the
+// covariance matrix)
+inline void BcPrincipalAxis(const float px[16][4], int channels, float mean[4],
+                            float axis[4]) {
+  for (int c = 0; c < 4; c++) {
+    mean[c] = 0.0f;
+    for (int i = 0; i < 16; i++)
+      mean[c] += px[i][c];
+    mean[c] /= 16.0f;
+  }
+
+  float cov[4][4] = {{0}};
+  for (int i = 0; i < 16; i++)
+    for (int a = 0; a < channels; a++)
+      for (int b = 0; b < channels; b++)
+        cov[a][b] += (px[i][a] - mean[a]) * (px[i][b] - mean[b]);
+
+  // start from the covariance row of the widest channel; a fixed start
+  // vector can be orthogonal to the answer (e.g. red up, green down)
+  int widest = 0;
+  for (int a = 1; a < channels; a++)
+    if (cov[a][a] > cov[widest][widest])
+      widest = a;
+  float v[4] = {0, 0, 0, 0};
+  for (int a = 0; a < channels; a++)
+    v[a] = cov[widest][a];
+  for (int iter = 0; iter < 8; iter++) {
+    float r[4] = {0, 0, 0, 0};
+    for (int a = 0; a < channels; a++)
+      for (int b = 0; b < channels; b++)
+        r[a] += cov[a][b] * v[b];
+    float len = 0.0f;
+    for (int a = 0; a < channels; a++)
+      len += r[a] * r[a];
+    if (len < 1e-12f)
+      break;
+    len = 1.0f / sqrtf(len);
+    for (int a = 0; a < channels; a++)
+      v[a] = r[a] * len;
+  }
+  float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2] + v[3] * v[3]);
+  for (int c = 0; c < 4; c++)
+    axis[c] = len > 0.0f ? v[c] / len : 0.0f;
+}
+
+// endpoints at the extremes of the projection onto the principal axis
+inline void BcAxisEndpoints(const float px[16][4], int channels, float e0[4],
+                            float e1[4]) {
+  float mean[4], axis[4];
+  BcPrincipalAxis(px, channels, mean, axis);
+  float tmin = 0.0f, tmax = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int c = 0; c < channels; c++)
+      t += (px[i][c] - mean[c]) * axis[c];
+    tmin = t < tmin ? t : tmin;
+    tmax = t > tmax ? t : tmax;
+  }
+  for (int c = 0; c < 4; c++) {
+    e0[c] = BcClamp(mean[c] + axis[c] * tmax, 0.0f, 255.0f);
+    e1[c] = BcClamp(mean[c] + axis[c] * tmin, 0.0f, 255.0f);
+  }
+}
+
+// Least-squares endpoints for fixed indices: weights[i] is the share of e1
+// in pixel i. Returns false if the system is singular.
+inline bool BcRefitEndpoints(const float px[16][4], const float weights[16],
+                             float e0[4], float e1[4]) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[4] = {0, 0, 0, 0}, bx[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float b = weights[i], a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < 4; c++) {
+      ax[c] += a * px[i][c];
+      bx[c] += b * px[i][c];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (fabsf(det) < 1e-6f)
+    return false;
+  det = 1.0f / det;
+  for (int c = 0; c < 4; c++) {
+    e0[c] = BcClamp((ax[c] * bb - bx[c] * ab) * det, 0.0f, 255.0f);
+    e1[c] = BcClamp((bx[c] * aa - ax[c] * ab) * det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+inline void BcLoadBlock(const unsigned char *rgba, float px[16][4]) {
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 4; c++)
+      px[i][c] = rgba[i * 4 + c];
+}
+
+// ---- BC1 -------------------------------------------------------------------
+
+inline uint16_t Bc1Pack565(const float c[4]) {
+  int r = (int)(BcClamp(c[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+  int g = (int)(BcClamp(c[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+  int b = (int)(BcClamp(c[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void Bc1Unpack565(uint16_t v, int c[3]) {
+  int r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+  c[0] = (r << 3) | (r >> 2);
+  c[1] = (g << 2) | (g >> 4);
+  c[2] = (b << 3) | (b >> 2);
+}
+
+// palette in index order; opaque four-colour mode needs c0 > c1
+inline void Bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+  Bc1Unpack565(c0, palette[0]);
+  Bc1Unpack565(c1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    if (c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+}
+
+// encodes with the given endpoints; returns the squared error
+inline float Bc1Try(const float px[16][4], const float e0[4],
+                    const float e1[4], unsigned char *out,
+                    float weights[16]) {
+  uint16_t c0 = Bc1Pack565(e0), c1 = Bc1Pack565(e1);
+  if (c0 < c1) {
+    uint16_t t = c0;
+    c0 = c1;
+    c1 = t;
+  }
+  int palette[4][3];
+  Bc1Palette(c0, c1, palette);
+  // share of c1 in each palette entry, for the refit
+  const float share[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+  uint32_t indices = 0;
+  float error = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    int best = 0;
+    float bestError = 1e30f;
+    // equal endpoints leave three-colour mode: only index 0 is meaningful
+    int entries = c0 > c1 ? 4 : 1;
+    for (int p = 0; p < entries; p++) {
+      float d = 0.0f;
+      for (int c = 0; c < 3; c++) {
+        float diff = px[i][c] - palette[p][c];
+        d += diff * diff;
+      }
+      if (d < bestError) {
+        bestError = d;
+        best = p;
+      }
+    }
+    indices |= (uint32_t)best << (i * 2);
+    weights[i] = share[best];
+    error += bestError;
+  }
+
+  out[0] = (unsigned char)(c0 & 0xFF);
+  out[1] = (unsigned char)(c0 >> 8);
+  out[2] = (unsigned char)(c1 & 0xFF);
+  out[3] = (unsigned char)(c1 >> 8);
+  for (int b = 0; b < 4; b++)
+    out[4 + b] = (unsigned char)(indices >> (b * 8));
+  return error;
+}
+
+// rgba: 16 RGBA8 pixels; out: 8 bytes. Alpha is ignored.
+inline void EncodeBC1Block(const unsigned char *rgba, unsigned char *out) {
+  float px[16][4];
+  BcLoadBlock(rgba, px);
+
+  float e0[4], e1[4];
+  BcAxisEndpoints(px, 3, e0, e1);
+  // pull the endpoints in slightly: the extremes are rarely worth an entry
+  for (int c = 0; c < 3; c++) {
+    float inset = (e0[c] - e1[c]) / 32.0f;
+    e0[c] -= inset;
+    e1[c] += inset;
+  }
+
+  float weights[16];
+  float error = Bc1Try(px, e0, e1, out, weights);
+  for (int iter = 0; iter < 2 && error > 0.0f; iter++) {
+    // weights follow the stored endpoint order, so the refit keeps it
+    float r0[4], r1[4];
+    if (!BcRefitEndpoints(px, weights, r0, r1))
+      break;
+    unsigned char candidate[8];
+    float candidateWeights[16];
+    float e = Bc1Try(px, r0, r1, candidate, candidateWeights);
+    if (e >= error)
+      break;
+    error = e;
+    memcpy(out, candidate, 8);
+    memcpy(weights, candidateWeights, sizeof(weights));
+  }
+}
+
+inline void DecodeBC1Block(const unsigned char *in, unsigned char *rgba) {
+  uint16_t c0 = in[0] | (in[1] << 8), c1 = in[2] | (in[3] << 8);
+  uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+  int palette[4][3];
+  Bc1Palette(c0, c1, palette);
+  for (int i = 0; i < 16; i++) {
+    int p = (indices >> (i * 2)) & 3;
+    for (int c = 0; c < 3; c++)
+      rgba[i * 4 + c] = (unsigned char)palette[p][c];
+    rgba[i * 4 + 3] = (c0 <= c1 && p == 3) ? 0 : 255;
+  }
+}
+
+// ---- BC7 mode 6 -------------------------------------------------------------
+
+static const int BC7_WEIGHTS4[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                     34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Bc7BitWriter {
+  unsigned char *out;
+  int pos;
+
+  void Write(uint32_t value, int bits) {
+    for (int b = 0; b < bits; b++, pos++)
+      if (value & (1u << b))
+        out[pos >> 3] |= (unsigned char)(1u << (pos & 7));
+  }
+};
+
+struct Bc7BitReader {
+  const unsigned char *in;
+  int pos;
+
+  uint32_t Read(int bits) {
+    uint32_t value = 0;
+    for (int b = 0; b < bits; b++, pos++)
+      value |= (uint32_t)((in[pos >> 3] >> (pos & 7)) & 1) << b;
+    return value;
+  }
+};
+
+// Mode 6 endpoints are 7 bits per channel plus one shared low bit (p-bit)
+// per endpoint; pick the p-bit that lands closest to the float endpoint.
+// p = 0 is always taken first, so q and pbit are set even if the error is NaN.
+inline void Bc7QuantizeEndpoint(const float e[4], int q[4], int &pbit) {
+  float bestError = 0.0f;
+  for (int p = 0; p < 2; p++) {
+    int candidate[4];
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      int v = (int)((e[c] - p) / 2.0f + 0.5f);
+      v = v < 0 ? 0 : (v > 127 ? 127 : v);
+      candidate[c] = v;
+      float d = e[c] - (float)((v << 1) | p);
+      error += d * d;
+    }
+    if (p == 0 || error < bestError) {
+      bestError = error;
+      pbit = p;
+      memcpy(q, candidate, sizeof(candidate));
+    }
+  }
+}
+
+inline float Bc7Try(const float px[16][4], const float e0[4],
+                    const float e1[4], unsigned char *out, float weights[16]) {
+  int q[2][4], pbit[2];
+  Bc7QuantizeEndpoint(e0, q[0], pbit[0]);
+  Bc7QuantizeEndpoint(e1, q[1], pbit[1]);
+
+  int end[2][4];
+  for (int e = 0; e < 2; e++)
+    for (int c = 0; c < 4; c++)
+      end[e][c] = (q[e][c] << 1) | pbit[e];
+
+  float palette[16][4];
+  for (int p = 0; p < 16; p++)
+    for (int c = 0; c < 4; c++)
+      palette[p][c] = (float)(((64 - BC7_WEIGHTS4[p]) * end[0][c] +
+                               BC7_WEIGHTS4[p] * end[1][c] + 32) >>
+                              6);
+
+  // project onto the endpoint line, then check the neighbouring entries
+  float axis[4], axisLen = 0.0f;
+  for (int c = 0; c < 4; c++) {
+    axis[c] = (float)(end[1][c] - end[0][c]);
+    axisLen += axis[c] * axis[c];
+  }
+
+  int indices[16];
+  float error = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    int guess = 0;
+    if (axisLen > 0.0f) {
+      float t = 0.0f;
+      for (int c = 0; c < 4; c++)
+        t += (px[i][c] - end[0][c]) * axis[c];
+      guess = (int)(BcClamp(t / axisLen, 0.0f, 1.0f) * 15.0f + 0.5f);
+    }
+    int best = guess;
+    float bestError = 1e30f;
+    int lo = guess > 0 ? guess - 1 : 0, hi = guess < 15 ? guess + 1 : 15;
+    for (int p = lo; p <= hi; p++) {
+      float d = 0.0f;
+      for (int c = 0; c < 4; c++) {
+        float diff = px[i][c] - palette[p][c];
+        d += diff * diff;
+      }
+      if (d < bestError) {
+        bestError = d;
+        best = p;
+      }
+    }
+    indices[i] = best;
+    weights[i] = BC7_WEIGHTS4[best] / 64.0f;
+    error += bestError;
+  }
+
+  // the anchor (first) index is stored with its top bit implied zero
+  int first = 0, second = 1;
+  if (indices[0] & 8) {
+    first = 1;
+    second = 0;
+    for (int i = 0; i < 16; i++)
+      indices[i] = 15 - indices[i];
+  }
+
+  memset(out, 0, 16);
+  Bc7BitWriter writer = {out, 0};
+  writer.Write(1u << 6, 7); // mode 6
+  for (int c = 0; c < 4; c++) {
+    writer.Write(q[first][c], 7);
+    writer.Write(q[second][c], 7);
+  }
+  writer.Write(pbit[first], 1);
+  writer.Write(pbit[second], 1);
+  writer.Write(indices[0], 3);
+  for (int i = 1; i < 16; i++)
+    writer.Write(indices[i], 4);
+  return error;
+}
+
+// rgba: 16 RGBA8 pixels; out: 16 bytes
+inline void EncodeBC7Block(const unsigned char *rgba, unsigned char *out) {
+  float px[16][4];
+  BcLoadBlock(rgba, px);
+
+  bool opaque = true;
+  for (int i = 0; i < 16; i++)
+    opaque = opaque && px[i][3] == 255.0f;
+
+  float e0[4], e1[4], weights[16];
+  BcAxisEndpoints(px, opaque ? 3 : 4, e0, e1);
+  float error = Bc7Try(px, e0, e1, out, weights);
+
+  for (int iter = 0; iter < 2 && error > 0.0f; iter++) {
+    // weights refer to e0/e1 as passed in, before any anchor swap
+    float r0[4], r1[4];
+    if (!BcRefitEndpoints(px, weights, r0, r1))
+      break;
+    unsigned char candidate[16];
+    float candidateWeights[16];
+    float e = Bc7Try(px, r0, r1, candidate, candidateWeights);
+    if (e >= error)
+      break;
+    error = e;
+    memcpy(out, candidate, 16);
+    memcpy(weights, candidateWeights, sizeof(weights));
+  }
+}
+
+// decodes mode 6 blocks; other modes come out magenta
+inline void DecodeBC7Block(const unsigned char *in, unsigned char *rgba) {
+  Bc7BitReader reader = {in, 0};
+  if (reader.Read(7) != (1u << 6)) {
+    for (int i = 0; i < 16; i++) {
+      rgba[i * 4 + 0] = 255;
+      rgba[i * 4 + 1] = 0;
+      rgba[i * 4 + 2] = 255;
+      rgba[i * 4 + 3] = 255;
+    }
+    return;
+  }
+
+  int end[2][4];
+  for (int c = 0; c < 4; c++) {
+    end[0][c] = reader.Read(7) << 1;
+    end[1][c] = reader.Read(7) << 1;
+  }
+  int p0 = reader.Read(1), p1 = reader.Read(1);
+  for (int c = 0; c < 4; c++) {
+    end[0][c] |= p0;
+    end[1][c] |= p1;
+  }
+  for (int i = 0; i < 16; i++) {
+    int index = reader.Read(i == 0 ? 3 : 4);
+    int w = BC7_WEIGHTS4[index];
+    for (int c = 0; c < 4; c++)
+      rgba[i * 4 + c] =
+          (unsigned char)(((64 - w) * end[0][c] + w * end[1][c] + 32) >> 6);
+  }
+}
+
+// ---- images ----------------------------------------------------------------
+
+// Compresses a size x size RGBA8 image (size a multiple of 4, or 1 or 2 for
+// the smallest mips), block rows spread over worker threads.
+inline void CompressImage(const unsigned char *rgba, int size, BcFormat format,
+                          vector<unsigned char> &out, int threads = 0) {
+  PROFILE_SCOPE("CompressImage");
+  int blocks = (size + 3) / 4;
+  int blockBytes = BcBlockBytes(format);
+  out.resize(BcImageBytes(format, size));
+
+  ParallelFor(
+      blocks,
+      [&](int by) {
+        unsigned char block[64];
+        for (int bx = 0; bx < blocks; bx++) {
+          // clamp at the edge for images smaller than a block
+          for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 4; x++) {
+              int sx = bx * 4 + x < size ? bx * 4 + x : size - 1;
+              int sy = by * 4 + y < size ? by * 4 + y : size - 1;
+              memcpy(&block[(y * 4 + x) * 4],
+                     &rgba[((size_t)sy * size + sx) * 4], 4);
+            }
+          unsigned char *dst = &out[((size_t)by * blocks + bx) * blockBytes];
+          if (format == BC_FORMAT_BC1)
+            EncodeBC1Block(block, dst);
+          else
+            EncodeBC7Block(block, dst);
+        }
+      },
+      threads, "encode");
+}
+
+inline void DecompressImage(const unsigned char *data, int size,
+                            BcFormat format, vector<unsigned char> &rgba) {
+  int blocks = (size + 3) / 4;
+  int blockBytes = BcBlockBytes(format);
+  rgba.resize((size_t)size * size * 4);
+  unsigned char block[64];
+  for (int by = 0; by < blocks; by++)
+    for (int bx = 0; bx < blocks; bx++) {
+      const unsigned char *src = &data[((size_t)by * blocks + bx) * blockBytes];
+      if (format == BC_FORMAT_BC1)
+        DecodeBC1Block(src, block);
+      else
+        DecodeBC7Block(src, block);
+      for (int y = 0; y < 4 && by * 4 + y < size; y++)
+        for (int x = 0; x < 4 && bx * 4 + x < size; x++)
+          memcpy(&rgba[((size_t)(by * 4 + y) * size + bx * 4 + x) * 4],
+                 &block[(y * 4 + x) * 4], 4);
+    }
+}
+
+// ---- sRGB mips -------------------------------------------------------------
+
+struct SrgbTable {
+  float toLinear[256];
+
+  SrgbTable() {
+    for (int i = 0; i < 256; i++) {
+      float c = i / 255.0f;
+      toLinear[i] =
+          c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+  }
+};
+
+inline const float *SrgbToLinearTable() {
+  static const SrgbTable table;
+  return table.toLinear;
+}
+
+inline unsigned char LinearToSrgb(float c) {
+  c = BcClamp(c, 0.0f, 1.0f);
+  float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+  return (unsigned char)(s * 255.0f + 0.5f);
+}
+
+// Halves a square RGBA8 image. Colour is averaged in linear space, so dark
+// and bright texels mix the way they would on screen; alpha is linear.
+inline void DownsampleSrgb(const vector<unsigned char> &src, int srcSize,
+                           vector<unsigned char> &dst) {
+  const float *toLinear = SrgbToLinearTable();
+  int size = srcSize > 1 ? srcSize / 2 : 1;
+  int step = srcSize > 1 ? 1 : 0;
+  dst.resize((size_t)size * size * 4);
+  for (int y = 0; y < size; y++)
+    for (int x = 0; x < size; x++) {
+      const unsigned char *a = &src[((size_t)(y * 2) * srcSize + x * 2) * 4];
+      const unsigned char *b = a + step * 4;
+      const unsigned char *c = a + (size_t)step * srcSize * 4;
+      const unsigned char *d = c + step * 4;
+      unsigned char *out = &dst[((size_t)y * size + x) * 4];
+      for (int ch = 0; ch < 3; ch++)
+        out[ch] = LinearToSrgb((toLinear[a[ch]] + toLinear[b[ch]] +
+                                toLinear[c[ch]] + toLinear[d[ch]]) *
+                               0.25f);
+      out[3] = (unsigned char)((a[3] + b[3] + c[3] + d[3] + 2) >> 2);
+    }
+}
+
+// PSNR of the RGB channels, in dB
+inline double ImagePsnr(const unsigned char *a, const unsigned char *b,
+                        size_t pixels) {
+  double sum = 0.0;
+  for (size_t i = 0; i < pixels; i++)
+    for (int c = 0; c < 3; c++) {
+      double d = (double)a[i * 4 + c] - b[i * 4 + c];
+      sum += d * d;
+    }
+  double mse = sum / (pixels * 3.0);
+  return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+#endif
@@ -0,0 +1,332 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "camera.h"
+
+using namespace std;
+
+// summary of one timing series, all values in milliseconds
+struct FrameTimeStats {
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+
+  static FrameTimeStats From(vector<double> samples) {
+    FrameTimeStats s;
+    if (samples.empty())
+      return s;
+
+    sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < samples.size(); i++)
+      sum += samples[i];
+
+    s.mean = sum / samples.size();
+    s.p50 = percentile(samples, 50.0);
+    s.p95 = percentile(samples, 95.0);
+    s.p99 = percentile(samples, 99.0);
+    s.max = samples.back();
+    return s;
+  }
+
+private:
+  // nearest-rank percentile on an already sorted series
+  static double percentile(const vector<double> &sorted, double p) {
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    if (rank < 1)
+      rank = 1;
+    return sorted[min(rank, sorted.size()) - 1];
+  }
+};
+
+// one stop of the scripted camera path
+struct BenchmarkScene {
+  const char *name;
+  int preset; // Camera::SetPresetPosition index, -1 keeps the start camera
+};
+
+// Drives the camera through a fixed sequence of presets with a fixed
+// timestep and records CPU frame times per scene. Frames are measured from
+// BeginFrame() to EndFrame(); call EndFrame() before the buffer swap so vsync
+// waits are not counted as CPU work. GPU timings arrive a few frames late, so
+// they are tagged with FrameTag() and handed back through AddSceneSample().
+class Benchmark {
+public:
+  float fixedDelta;
+  int warmupFrames;
+  int measureFrames;
+
+  Benchmark(float fixedDelta = 1.0f / 60.0f, int warmupFrames = 30,
+            int measureFrames = 240)
+      : fixedDelta(fixedDelta), warmupFrames(warmupFrames),
+        measureFrames(measureFrames), active(false), sceneIndex(0),
+        sceneFrame(0) {
+    scenes.push_back({"start", -1});
+    scenes.push_back({"preset0", 0});
+    scenes.push_back({"preset1", 1});
+    scenes.push_back({"preset2", 2});
+    scenes.push_back({"preset3", 3});
+  }
+
+  bool Active() const { return active; }
+  bool Finished() const { return !active && sceneIndex >= scenes.size(); }
+  const char *CurrentScene() const {
+    return sceneIndex < scenes.size() ? scenes[sceneIndex].name : "";
+  }
+
+  // scene index of the current frame, or -1 during warmup
+  int FrameTag() const {
+    return active && sceneFrame >= warmupFrames ? (int)sceneIndex : -1;
+  }
+
+  void Start(Camera &camera) {
+    startCamera = camera;
+    camera = startCamera;
+    results.assign(scenes.size(), SceneResult());
+    sceneIndex = 0;
+    sceneFrame = 0;
+    active = true;
+    enterScene(camera);
+  }
+
+  void BeginFrame(Camera &camera) {
+    if (!active)
+      return;
+
+    camera.UpdateTransition(fixedDelta);
+    cpuStart = chrono::steady_clock::now();
+  }
+
+  void EndFrame(Camera &camera) {
+    if (!active)
+      return;
+
+    double cpuMs = chrono::duration<double, milli>(
+                       chrono::steady_clock::now() - cpuStart)
+                       .count();
+    AddSample("cpu_ms", cpuMs);
+
+    sceneFrame++;
+    if (sceneFrame >= warmupFrames + measureFrames) {
+      sceneIndex++;
+      if (sceneIndex >= scenes.size())
+        finish(camera);
+      else
+        enterScene(camera);
+    }
+  }
+
+  // records a value into a named per-scene series for the current frame;
+  // ignored during warmup
+  void AddSample(const string &series, double value) {
+    if (!active || sceneFrame < warmupFrames)
+      return;
+    addSample(sceneIndex, series, value);
+  }
+
+  // records a late value for the scene returned by FrameTag() at the time;
+  // negative tags (warmup frames) are ignored
+  void AddSceneSample(int scene, const string &series, double value) {
+    if (scene < 0 || (size_t)scene >= results.size())
+      return;
+    addSample(scene, series, value);
+  }
+
+  bool WriteResults(const string &csvPath, const string &jsonPath) const {
+    ofstream csv(csvPath.c_str());
+    ofstream json(jsonPath.c_str());
+    if (!csv || !json) {
+      cout << "ERROR::BENCHMARK::CANNOT_WRITE_RESULTS" << endl;
+      return false;
+    }
+
+    vector<string> names = seriesNames();
+
+    csv << "scene,frames";
+    for (size_t n = 0; n < names.size(); n++)
+      for (int k = 0; k < STAT_COUNT; k++)
+        csv << "," << names[n] << "_" << StatNames()[k];
+    csv << "\n";
+
+    json << "{\n  \"warmup_frames\": " << warmupFrames
+         << ",\n  \"fixed_delta\": " << fixedDelta << ",\n  \"scenes\": [\n";
+
+    for (size_t s = 0; s < scenes.size(); s++) {
+      csv << scenes[s].name << "," << measureFrames;
+      json << "    {\"name\": \"" << scenes[s].name
+           << "\", \"frames\": " << measureFrames;
+
+      for (size_t n = 0; n < names.size(); n++) {
+        FrameTimeStats st = FrameTimeStats::From(series(s, names[n]));
+        double v[STAT_COUNT] = {st.mean, st.p50, st.p95, st.p99, st.max};
+        json << ", \"" << names[n] << "\": {";
+        for (int k = 0; k < STAT_COUNT; k++) {
+          csv << "," << v[k];
+          json << (k ? ", " : "") << "\"" << StatNames()[k] << "\": " << v[k];
+        }
+        json << "}";
+      }
+      csv << "\n";
+      json << "}" << (s + 1 < scenes.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    cout << "Benchmark results written to " << csvPath << " and " << jsonPath
+         << endl;
+    return true;
+  }
+
+  // Compares two result CSVs column by column and prints every value that
+  // grew by more than tolerancePct. Returns the number of regressions, or -1
+  // if either file could not be read.
+  static int Compare(const string &baselinePath, const string &currentPath,
+                     double tolerancePct) {
+    map<string, map<string, double>> baseline, current;
+    if (!readCsv(baselinePath, baseline) || !readCsv(currentPath, current))
+      return -1;
+
+    int regressions = 0;
+    for (map<string, map<string, double>>::const_iterator s = baseline.begin();
+         s != baseline.end(); ++s) {
+      map<string, map<string, double>>::const_iterator c =
+          current.find(s->first);
+      if (c == current.end()) {
+        cout << "missing scene in current results: " << s->first << endl;
+        continue;
+      }
+
+      for (map<string, double>::const_iterator m = s->second.begin();
+           m != s->second.end(); ++m) {
+        map<string, double>::const_iterator v = c->second.find(m->first);
+        if (v == c->second.end() || m->first == "frames")
+          continue;
+
+        double base = m->second;
+        double limit = base * (1.0 + tolerancePct / 100.0);
+        if (v->second > limit && v->second - base > 1e-6) {
+          double delta = base > 0.0 ? (v->second / base - 1.0) * 100.0 : 0.0;
+          printf("REGRESSION %-10s %-18s %10.3f -> %10.3f (%+.1f%%)\n",
+                 s->first.c_str(), m->first.c_str(), base, v->second, delta);
+          regressions++;
+        }
+      }
+    }
+
+    if (regressions == 0)
+      cout << "No regressions beyond " << tolerancePct << "% tolerance"
+           << endl;
+    return regressions;
+  }
+
+private:
+  static const int STAT_COUNT = 5;
+  static const char *const *StatNames() {
+    static const char *const names[STAT_COUNT] = {"mean", "p50", "p95",
+                                                  "p99", "max"};
+    return names;
+  }
+
+  struct SceneResult {
+    vector<pair<string, vector<double>>> series;
+  };
+
+  vector<BenchmarkScene> scenes;
+  vector<SceneResult> results;
+  Camera startCamera;
+  bool active;
+  size_t sceneIndex;
+  int sceneFrame;
+  chrono::steady_clock::time_point cpuStart;
+
+  void enterScene(Camera &camera) {
+    sceneFrame = 0;
+    if (scenes[sceneIndex].preset >= 0)
+      camera.SetPresetPosition(scenes[sceneIndex].preset);
+    else
+      camera = startCamera;
+  }
+
+  void finish(Camera &camera) {
+    camera = startCamera;
+    active = false;
+  }
+
+  void addSample(size_t scene, const string &name, double value) {
+    vector<pair<string, vector<double>>> &list = results[scene].series;
+    for (size_t i = 0; i < list.size(); i++) {
+      if (list[i].first == name) {
+        list[i].second.push_back(value);
+        return;
+      }
+    }
+    list.push_back(make_pair(name, vector<double>(1, value)));
+  }
+
+  vector<double> series(size_t scene, const string &name) const {
+    const vector<pair<string, vector<double>>> &list = results[scene].series;
+    for (size_t i = 0; i < list.size(); i++)
+      if (list[i].first == name)
+        return list[i].second;
+    return vector<double>();
+  }
+
+  // union of series names across scenes, in first-seen order
+  vector<string> seriesNames() const {
+    vector<string> names;
+    for (size_t s = 0; s < results.size(); s++)
+      for (size_t i = 0; i < results[s].series.size(); i++)
+        if (find(names.begin(), names.end(), results[s].series[i].first) ==
+            names.end())
+          names.push_back(results[s].series[i].first);
+    return names;
+  }
+
+  static bool readCsv(const string &path,
+                      map<string, map<string, double>> &out) {
+    ifstream file(path.c_str());
+    if (!file) {
+      cout << "ERROR::BENCHMARK::CANNOT_READ " << path << endl;
+      return false;
+    }
+
+    string line;
+    vector<string> header;
+    if (getline(file, line))
+      header = splitCsv(line);
+
+    while (getline(file, line)) {
+      vector<string> cells = splitCsv(line);
+      if (cells.empty() || cells.size() != header.size())
+        continue;
+      for (size_t i = 1; i < cells.size(); i++)
+        out[cells[0]][header[i]] = atof(cells[i].c_str());
+    }
+    return true;
+  }
+
+  static vector<string> splitCsv(const string &line) {
+    vector<string> cells;
+    stringstream ss(line);
+    string cell;
+    while (getline(ss, cell, ','))
+      cells.push_back(cell);
+    return cells;
+  }
+};
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef CUBEMAP_STREAM_H
+#define CUBEMAP_STREAM_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_decode.h"
+#include "profiler.h"
+#include "render_stats.h"
+
+using namespace std;
+
+// Loads a cubemap progressively. Start() puts a small preview into one of the
+// texture's lower mip levels and returns at once; a worker thread then decodes
+// the full faces and builds the mip chain, and Update() uploads it a few rows
+// per frame, finest level last. GL_TEXTURE_BASE_LEVEL moves down as each level
+// completes, so the texture object never changes and the skybox sharpens
+// without a hitch. Prepare() does the file work of Start() ahead of time,
+// on any thread, so decoding can begin before the GL context exists.
+//
+// The preview comes from a small cache file written next to the first face
+// after a full decode, from a scaled libjpeg decode, or failing both from a
+// flat grey 1x1 level.
+class CubemapStreamer {
+public:
+  static const int PREVIEW_SIZE = 256;
+
+  CubemapStreamer()
+      : texture(0), size(0), channels(3), levelCount(0), baseLevel(0),
+        firstLevel(0), prepared(false), previewCached(false), uploadLevel(-1),
+        uploadFace(0), uploadRow(0),
+        decoded(false),
+        failed(false), streamFrames(0) {}
+
+  ~CubemapStreamer() {
+    if (worker.joinable())
+      worker.join();
+  }
+
+  GLuint Texture() const { return texture; }
+  int BaseLevel() const { return baseLevel; }
+  // also true when nothing was started
+  bool Done() const { return baseLevel == 0 && uploadLevel < 0; }
+  int StreamFrames() const { return streamFrames; }
+
+  // The part of Start() that needs no GL context: reads the face size and
+  // the preview, and starts the worker decoding the full faces. Can run on
+  // any thread before the context exists. Faces are in
+  // GL_TEXTURE_CUBE_MAP_POSITIVE_X order.
+  bool Prepare(const char *faces[6], int decodeThreads = 6) {
+    PROFILE_SCOPE("CubemapStreamer::Prepare");
+    for (int i = 0; i < 6; i++)
+      paths[i] = faces[i];
+
+    int w = 0, h = 0;
+    if (!stbi_info(faces[0], &w, &h, &channels) || w != h) {
+      cout << "ERROR::CUBEMAP::CANNOT_READ " << faces[0] << endl;
+      return false;
+    }
+    size = w;
+    levelCount = 1;
+    while ((size >> levelCount) > 0)
+      levelCount++;
+
+    firstLevel = previewLevel();
+    previewCached = readPreviewCache(firstLevel, previewFaces);
+    if (!previewCached && !decodeScaledPreview(firstLevel, previewFaces))
+      firstLevel = levelCount - 1; // grey 1x1 level
+    prepared = true;
+
+    // a preview at level 0 is already the whole texture
+    if (firstLevel > 0)
+      worker = thread(&CubemapStreamer::decode, this, decodeThreads);
+    return true;
+  }
+
+  // needs a current GL context; prepares first unless Prepare() ran
+  GLuint Start(const char *faces[6], int decodeThreads = 6) {
+    if (!prepared && !Prepare(faces, decodeThreads))
+      return 0;
+    return Start();
+  }
+
+  // GL half of Start() after Prepare(): the texture with its preview level
+  GLuint Start() {
+    PROFILE_SCOPE("CubemapStreamer::Start");
+    if (!prepared || size == 0)
+      return 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    RenderStats::Frame().textureBinds++;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = 0; level < levelCount; level++)
+      for (int face = 0; face < 6; face++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level,
+                     internalFormat(), levelSize(level), levelSize(level), 0,
+                     format(), GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    uploadPreview();
+    setBaseLevel(firstLevel);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return texture;
+  }
+
+  // Uploads up to byteBudget bytes of the next mip level; call once per
+  // frame on the GL thread.
+  void Update(size_t byteBudget = 4 << 20) {
+    if (!texture || Done() || failed)
+      return;
+    streamFrames++;
+    if (!decoded.load(memory_order_acquire))
+      return;
+    if (uploadLevel < 0)
+      uploadLevel = baseLevel - 1;
+
+    PROFILE_SCOPE("skybox stream");
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    RenderStats::Frame().textureBinds++;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    while (uploadLevel >= 0 && byteBudget > 0) {
+      int s = levelSize(uploadLevel);
+      size_t rowBytes = (size_t)s * channels;
+      size_t rows = byteBudget / rowBytes;
+      if (rows < 1)
+        rows = 1;
+      if (rows > (size_t)(s - uploadRow))
+        rows = s - uploadRow;
+
+      const unsigned char *src =
+          &levels[uploadLevel].faces[uploadFace][0] + uploadRow * rowBytes;
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + uploadFace, uploadLevel,
+                      0, uploadRow, s, (GLsizei)rows, format(),
+                      GL_UNSIGNED_BYTE, src);
+      size_t bytes = rows * rowBytes;
+      RenderStats::Frame().bufferBytes += bytes;
+      byteBudget = bytes < byteBudget ? byteBudget - bytes : 0;
+
+      uploadRow += (int)rows;
+      if (uploadRow < s)
+        continue;
+      uploadRow = 0;
+      if (++uploadFace < 6)
+        continue;
+
+      // level complete: show it and release its pixels
+      uploadFace = 0;
+      setBaseLevel(uploadLevel);
+      for (int face = 0; face < 6; face++)
+        vector<unsigned char>().swap(levels[uploadLevel].faces[face]);
+      uploadLevel--;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (Done() && worker.joinable())
+      worker.join();
+  }
+
+  // blocks until the full-resolution texture is resident
+  void Finish() {
+    if (worker.joinable())
+      worker.join();
+    while (texture && !Done() && !failed)
+      Update((size_t)-1);
+  }
+
+private:
+  GLuint texture;
+  string paths[6];
+  int size;
+  int channels;
+  int levelCount;
+  int baseLevel;
+  int firstLevel; // where the preview goes; fixed once prepared
+  bool prepared;
+  bool previewCached;
+  vector<unsigned char> previewFaces[6]; // until Start() uploads them
+
+  struct Level {
+    vector<unsigned char> faces[6];
+  };
+
+  // filled by the worker, consumed by Update()
+  vector<Level> levels;
+  int uploadLevel;
+  int uploadFace;
+  int uploadRow;
+
+  thread worker;
+  atomic<bool> decoded;
+  atomic<bool> failed;
+  int streamFrames;
+
+  CubemapStreamer(const CubemapStreamer &);
+  CubemapStreamer &operator=(const CubemapStreamer &);
+
+  int levelSize(int level) const {
+    int s = size >> level;
+    return s > 0 ? s : 1;
+  }
+
+  GLenum format() const {
+    return channels == 4 ? GL_RGBA : channels == 1 ? GL_RED : GL_RGB;
+  }
+  GLint internalFormat() const { return (GLint)format(); }
+
+  void setBaseLevel(int level) {
+    baseLevel = level;
+    // only the base level is sampled (GL_LINEAR), so it alone must be complete
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, level);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, level);
+  }
+
+  int previewLevel() const {
+    int level = 0;
+    while (levelSize(level) > PREVIEW_SIZE && level < levelCount - 1)
+      level++;
+    return level;
+  }
+
+  string previewPath() const { return paths[0] + ".preview"; }
+
+  // source file identity, so a stale preview is never shown
+  void sourceStamps(int64_t stamps[12]) const {
+    for (int i = 0; i < 6; i++) {
+      struct stat st;
+      if (stat(paths[i].c_str(), &st) != 0)
+        memset(&st, 0, sizeof(st));
+      stamps[i * 2] = (int64_t)st.st_mtime;
+      stamps[i * 2 + 1] = (int64_t)st.st_size;
+    }
+  }
+
+  // uploads what Prepare() found for firstLevel
+  void uploadPreview() {
+    int s = levelSize(firstLevel);
+    if (!previewFaces[0].empty()) {
+      PROFILE_SCOPE("upload preview");
+      for (int face = 0; face < 6; face++) {
+        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, firstLevel, 0,
+                        0, s, s, format(), GL_UNSIGNED_BYTE,
+                        &previewFaces[face][0]);
+        RenderStats::Frame().bufferBytes += previewFaces[face].size();
+        vector<unsigned char>().swap(previewFaces[face]);
+      }
+      return;
+    }
+
+    // nothing quick to show: a mid-grey 1x1 level
+    unsigned char grey[4] = {128, 128, 128, 255};
+    for (int face = 0; face < 6; face++)
+      glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, firstLevel, 0, 0,
+                      1, 1, format(), GL_UNSIGNED_BYTE, grey);
+  }
+
+  bool readPreviewCache(int level, vector<unsigned char> faces[6]) {
+    PROFILE_SCOPE("read preview cache");
+    FILE *f = fopen(previewPath().c_str(), "rb");
+    if (!f)
+      return false;
+
+    char magic[4];
+    int32_t header[2];
+    int64_t stamps[12], expected[12];
+    sourceStamps(expected);
+    int s = levelSize(level);
+    bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, "RTPV", 4) == 0 &&
+              fread(header, sizeof(header), 1, f) == 1 && header[0] == s &&
+              header[1] == channels && fread(stamps, sizeof(stamps), 1, f) == 1 &&
+              memcmp(stamps, expected, sizeof(stamps)) == 0;
+
+    size_t faceBytes = (size_t)s * s * channels;
+    for (int face = 0; ok && face < 6; face++) {
+      faces[face].resize(faceBytes);
+      ok = fread(&faces[face][0], faceBytes, 1, f) == 1;
+    }
+    fclose(f);
+    return ok;
+  }
+
+  void writePreviewCache(int level) {
+    FILE *f = fopen(previewPath().c_str(), "wb");
+    if (!f)
+      return;
+    int32_t header[2] = {levelSize(level), channels};
+    int64_t stamps[12];
+    sourceStamps(stamps);
+    fwrite("RTPV", 4, 1, f);
+    fwrite(header, sizeof(header), 1, f);
+    fwrite(stamps, sizeof(stamps), 1, f);
+    for (int face = 0; face < 6; face++)
+      fwrite(&levels[level].faces[face][0], levels[level].faces[face].size(),
+             1, f);
+    fclose(f);
+  }
+
+  bool decodeScaledPreview(int level, vector<unsigned char> faces[6]) {
+#ifdef USE_LIBJPEG
+    // libjpeg scales by at most 1/8
+    if (level == 0 || level > 3 || !HasJpegExtension(paths[0].c_str()))
+      return false;
+    PROFILE_SCOPE("decode scaled preview");
+    int s = levelSize(level);
+    for (int face = 0; face < 6; face++) {
+      DecodedImage image;
+      if (!DecodeWithLibjpeg(paths[face].c_str(), image, 1 << level) ||
+          image.width != s || image.height != s || image.channels != channels)
+        return false;
+      faces[face].swap(image.pixels);
+    }
+    return true;
+#else
+    (void)level;
+    (void)faces;
+    return false;
+#endif
+  }
+
+  // worker thread: full decode, then a box-filtered mip chain down to the
+  // level below the preview
+  void decode(int decodeThreads) {
+    if (Profiler::Enabled())
+      Profiler::SetThreadName("skybox stream");
+    PROFILE_SCOPE("decode skybox");
+
+    const char *faces[6];
+    for (int i = 0; i < 6; i++)
+      faces[i] = paths[i].c_str();
+    vector<DecodedImage> images;
+    DecodeImagesParallel(faces, 6, images, decodeThreads);
+
+    for (int face = 0; face < 6; face++) {
+      const DecodedImage &image = images[face];
+      if (!image.ok || image.width != size || image.height != size ||
+          image.channels != channels) {
+        cout << "Cubemap texture failed to load at path: " << faces[face]
+             << endl;
+        failed = true;
+        return;
+      }
+    }
+
+    int preview = previewLevel();
+    int last = firstLevel > preview ? firstLevel : preview;
+    levels.resize(last + 1);
+    for (int face = 0; face < 6; face++)
+      levels[0].faces[face].swap(images[face].pixels);
+    {
+      PROFILE_SCOPE("build mips");
+      for (int level = 1; level <= last; level++)
+        for (int face = 0; face < 6; face++)
+          downsample(levels[level - 1].faces[face], levelSize(level - 1),
+                     levels[level].faces[face]);
+    }
+
+    if (preview > 0 && !previewCached)
+      writePreviewCache(preview);
+    // the preview level itself is already resident
+    for (int level = firstLevel; level <= last; level++)
+      for (int face = 0; face < 6; face++)
+        vector<unsigned char>().swap(levels[level].faces[face]);
+
+    decoded.store(true, memory_order_release);
+  }
+
+  // 2x2 box filter of a square image
+  void downsample(const vector<unsigned char> &src, int srcSize,
+                  vector<unsigned char> &dst) const {
+    int s = srcSize > 1 ? srcSize / 2 : 1;
+    dst.resize((size_t)s * s * channels);
+    size_t srcRow = (size_t)srcSize * channels;
+    for (int y = 0; y < s; y++) {
+      const unsigned char *a = &src[(size_t)(y * 2) * srcRow];
+      const unsigned char *b = srcSize > 1 ? a + srcRow : a;
+      unsigned char *out = &dst[(size_t)y * s * channels];
+      for (int x = 0; x < s * channels; x++) {
+        int i = (x / channels) * 2 * channels + x % channels;
+        int j = srcSize > 1 ? i + channels : i;
+        out[x] = (unsigned char)((a[i] + a[j] + b[i] + b[j] + 2) >> 2);
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef DDS_H
+#define DDS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bc_codec.h"
+
+using namespace std;
+
+// Block-compressed cubemap with a full mip chain, stored as a DDS file:
+// BC1 with the classic DXT1 header, BC7 with the DX10 extension header.
+// Data is face-major (every mip of +X, then -X, ...), as D3D and most tools
+// expect.
+struct DdsCubemap {
+  BcFormat format;
+  int size;
+  int mipCount;
+  vector<unsigned char> data;
+
+  DdsCubemap() : format(BC_FORMAT_BC1), size(0), mipCount(0) {}
+
+  int MipSize(int level) const {
+    int s = size >> level;
+    return s > 0 ? s : 1;
+  }
+
+  size_t MipBytes(int level) const {
+    return BcImageBytes(format, MipSize(level));
+  }
+
+  size_t FaceBytes() const {
+    size_t bytes = 0;
+    for (int level = 0; level < mipCount; level++)
+      bytes += MipBytes(level);
+    return bytes;
+  }
+
+  // start of one face/level in data
+  size_t Offset(int face, int level) const {
+    size_t offset = face * FaceBytes();
+    for (int l = 0; l < level; l++)
+      offset += MipBytes(l);
+    return offset;
+  }
+
+  bool Write(const string &path) const {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+      cout << "ERROR::DDS::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+
+    uint32_t header[31];
+    memset(header, 0, sizeof(header));
+    header[0] = 124; // dwSize
+    // caps, height, width, pixel format, mip count, linear size
+    header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+    header[2] = size;
+    header[3] = size;
+    header[4] = (uint32_t)MipBytes(0);
+    header[6] = mipCount;
+    header[18] = 32;  // pixel format size
+    header[19] = 0x4; // DDPF_FOURCC
+    header[20] = format == BC_FORMAT_BC1 ? fourCC("DXT1") : fourCC("DX10");
+    header[26] = 0x8 | 0x1000 | 0x400000; // complex, texture, mipmap
+    header[27] = 0x200 | 0xFC00;          // cubemap with all six faces
+
+    fwrite("DDS ", 4, 1, f);
+    fwrite(header, sizeof(header), 1, f);
+    if (format == BC_FORMAT_BC7) {
+      // DXGI_FORMAT_BC7_UNORM, TEXTURE2D, TEXTURECUBE, array size 1
+      uint32_t dx10[5] = {98, 3, 0x4, 1, 0};
+      fwrite(dx10, sizeof(dx10), 1, f);
+    }
+    bool ok = fwrite(&data[0], data.size(), 1, f) == 1;
+    fclose(f);
+    return ok;
+  }
+
+  bool Read(const string &path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+
+    char magic[4];
+    uint32_t header[31];
+    bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, "DDS ", 4) == 0 &&
+              fread(header, sizeof(header), 1, f) == 1 && header[0] == 124 &&
+              (header[27] & 0xFE00) == 0xFE00 && header[2] == header[3];
+    if (ok && header[20] == fourCC("DXT1")) {
+      format = BC_FORMAT_BC1;
+    } else if (ok && header[20] == fourCC("DX10")) {
+      uint32_t dx10[5];
+      ok = fread(dx10, sizeof(dx10), 1, f) == 1 &&
+           (dx10[0] == 98 || dx10[0] == 97); // BC7 UNORM or TYPELESS
+      format = BC_FORMAT_BC7;
+    } else {
+      ok = false;
+    }
+
+    // a corrupt header must not size the allocation: the mip chain has to
+    // fit the texture, and the data has to fit in what is left of the file
+    uint32_t mips = header[6] ? header[6] : 1;
+    uint32_t maxMips = 1;
+    while (ok && (header[3] >> maxMips) != 0)
+      maxMips++;
+    ok = ok && header[3] > 0 && header[3] <= 16384 && mips <= maxMips;
+    long start = ok ? ftell(f) : -1, end = -1;
+    if (start >= 0 && fseek(f, 0, SEEK_END) == 0) {
+      end = ftell(f);
+      ok = fseek(f, start, SEEK_SET) == 0;
+    }
+    if (ok) {
+      size = (int)header[3];
+      mipCount = (int)mips;
+      ok = start >= 0 && end >= start &&
+           6 * FaceBytes() <= (size_t)(end - start);
+    }
+    if (ok) {
+      data.resize(6 * FaceBytes());
+      ok = fread(&data[0], data.size(), 1, f) == 1;
+    }
+    fclose(f);
+    if (!ok)
+      cout << "ERROR::DDS::UNSUPPORTED_OR_TRUNCATED " << path << endl;
+    return ok;
+  }
+
+private:
+  static uint32_t fourCC(const char *code) {
+    return (uint32_t)code[0] | ((uint32_t)code[1] << 8) |
+           ((uint32_t)code[2] << 16) | ((uint32_t)code[3] << 24);
+  }
+};
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef ENV_PREFILTER_H
+#define ENV_PREFILTER_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bc_codec.h"
+#include "hdr_environment.h"
+#include "image_decode.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "render_stats.h"
+#include "sh_irradiance.h"
+
+using namespace std;
+
+// 8-bit sRGB image (any channel count) to linear RGB floats
+inline void SrgbImageToLinear(const DecodedImage &image, vector<float> &rgb) {
+  const float *toLinear = SrgbToLinearTable();
+  size_t texels = (size_t)image.width * image.height;
+  rgb.resize(texels * 3);
+  for (size_t i = 0; i < texels; i++)
+    for (int c = 0; c < 3; c++) {
+      int src = image.channels >= 3 ? c : 0; // grey expands to RGB
+      rgb[i * 3 + c] = toLinear[image.pixels[i * image.channels + src]];
+    }
+}
+
+// Specular environment prefiltered for GGX: mip level i holds the radiance
+// convolved for roughness i / (LEVELS - 1), so shaders pick the blur with
+// textureLod(env, R, roughness * MaxLod()) instead of taking many taps per
+// pixel. Uses the split-sum approximation with N = V = R and importance
+// sampling with pdf-based source mip selection, which keeps 128 samples per
+// texel free of fireflies. Results are stored as RGB9E5 and cached on disk,
+// together with the SH irradiance of the same source for diffuse ambient.
+class EnvironmentPrefilter {
+public:
+  static const int SIZE = 128;
+  static const int LEVELS = 6; // 128 down to 4
+  static const int SAMPLES = 128;
+  static const int SOURCE_SIZE = 256;
+
+  // texels per level and face, GL_RGB9_E5
+  vector<uint32_t> levels[LEVELS][6];
+  SHIrradiance irradiance; // projected from the full-resolution source
+  double buildMs;
+  bool fromCache;
+
+  EnvironmentPrefilter() : buildMs(0.0), fromCache(false) {}
+
+  static float MaxLod() { return (float)(LEVELS - 1); }
+  static int LevelSize(int level) { return SIZE >> level; }
+
+  // Convolves linear RGB float faces of any power-of-two size. With
+  // encodeSrgb the output is converted back to sRGB-encoded values, to match
+  // an LDR skybox that is displayed without conversion.
+  void Build(const vector<float> faces[6], int faceSize, bool encodeSrgb,
+             int threads = 0) {
+    PROFILE_SCOPE("EnvironmentPrefilter::Build");
+    irradiance.Project(faces, faceSize, threads);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // source mip chain, starting at no more than SOURCE_SIZE
+    vector<SourceMip> source(1);
+    source[0].size = faceSize;
+    for (int f = 0; f < 6; f++)
+      source[0].faces[f] = faces[f];
+    while (source.back().size > SOURCE_SIZE)
+      source.back() = downsample(source.back());
+    while (source.back().size > 1)
+      source.push_back(downsample(source.back()));
+
+    for (int level = 0; level < LEVELS; level++) {
+      float roughness = level / MaxLod();
+      vector<Sample> samples;
+      buildSamples(roughness, source[0].size, (int)source.size(), samples);
+
+      int size = LevelSize(level);
+      for (int f = 0; f < 6; f++)
+        levels[level][f].resize((size_t)size * size);
+      ParallelFor(
+          6 * size,
+          [&](int job) {
+            int f = job / size, y = job % size;
+            filterRow(source, samples, f, y, size, encodeSrgb,
+                      &levels[level][f][(size_t)y * size]);
+          },
+          threads, "prefilter");
+    }
+
+    fromCache = false;
+    buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                              start)
+                  .count();
+  }
+
+  // texel-samples per second of the last Build, for reporting
+  double SamplesPerSecond() const {
+    double texels = 0.0;
+    for (int level = 1; level < LEVELS; level++)
+      texels += 6.0 * LevelSize(level) * LevelSize(level);
+    return buildMs > 0.0 ? texels * SAMPLES / (buildMs / 1000.0) : 0.0;
+  }
+
+  bool ReadCache(const string &path, uint64_t key) {
+    PROFILE_SCOPE("EnvironmentPrefilter::ReadCache");
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f)
+      return false;
+    char magic[4];
+    uint64_t fileKey = 0;
+    bool ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, "RTPF", 4) == 0 &&
+              fread(&fileKey, sizeof(fileKey), 1, f) == 1 &&
+              fileKey == cacheKey(key);
+    for (int level = 0; ok && level < LEVELS; level++)
+      for (int face = 0; ok && face < 6; face++) {
+        vector<uint32_t> &texels = levels[level][face];
+        texels.resize((size_t)LevelSize(level) * LevelSize(level));
+        ok = fread(&texels[0], texels.size() * 4, 1, f) == 1;
+      }
+    ok = ok && fread(irradiance.coeffs, sizeof(irradiance.coeffs), 1, f) == 1;
+    fclose(f);
+    fromCache = ok;
+    return ok;
+  }
+
+  bool WriteCache(const string &path, uint64_t key) const {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+      cout << "ERROR::PREFILTER::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+    uint64_t fileKey = cacheKey(key);
+    fwrite("RTPF", 4, 1, f);
+    fwrite(&fileKey, sizeof(fileKey), 1, f);
+    for (int level = 0; level < LEVELS; level++)
+      for (int face = 0; face < 6; face++)
+        fwrite(&levels[level][face][0], levels[level][face].size() * 4, 1, f);
+    fwrite(irradiance.coeffs, sizeof(irradiance.coeffs), 1, f);
+    fclose(f);
+    return true;
+  }
+
+  // needs a current GL context
+  GLuint Upload() const {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    RenderStats::Frame().textureBinds++;
+    for (int level = 0; level < LEVELS; level++)
+      for (int face = 0; face < 6; face++) {
+        int size = LevelSize(level);
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB9_E5,
+                     size, size, 0, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV,
+                     &levels[level][face][0]);
+        RenderStats::Frame().bufferBytes += (unsigned long)size * size * 4;
+      }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, LEVELS - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return texture;
+  }
+
+  // identity of the source files (path, size, mtime) mixed with extra
+  // settings, for cache invalidation
+  static uint64_t SourceKey(const char *const *paths, int count,
+                            uint64_t settings = 0) {
+    uint64_t hash = 1469598103934665603ULL; // FNV-1a
+    auto mix = [&hash](const void *data, size_t bytes) {
+      const unsigned char *p = (const unsigned char *)data;
+      for (size_t i = 0; i < bytes; i++)
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    };
+    for (int i = 0; i < count; i++) {
+      struct stat st;
+      if (stat(paths[i], &st) != 0)
+        memset(&st, 0, sizeof(st));
+      int64_t stamp[2] = {(int64_t)st.st_mtime, (int64_t)st.st_size};
+      mix(paths[i], strlen(paths[i]));
+      mix(stamp, sizeof(stamp));
+    }
+    mix(&settings, sizeof(settings));
+    return hash;
+  }
+
+private:
+  struct SourceMip {
+    int size;
+    vector<float> faces[6]; // linear RGB
+  };
+
+  // one importance sample in tangent space (N = +Z)
+  struct Sample {
+    float l[3];
+    float weight; // N.L
+    float mip;    // source level to read
+  };
+
+  static uint64_t cacheKey(uint64_t key) {
+    // settings that change the output are part of the key
+    return key ^ ((uint64_t)SIZE << 40) ^ ((uint64_t)LEVELS << 32) ^
+           ((uint64_t)SAMPLES << 16) ^ (uint64_t)SOURCE_SIZE;
+  }
+
+  static SourceMip downsample(const SourceMip &src) {
+    SourceMip dst;
+    dst.size = src.size / 2;
+    for (int f = 0; f < 6; f++) {
+      dst.faces[f].resize((size_t)dst.size * dst.size * 3);
+      for (int y = 0; y < dst.size; y++)
+        for (int x = 0; x < dst.size; x++)
+          for (int c = 0; c < 3; c++) {
+            const float *s = &src.faces[f][0];
+            size_t row = (size_t)src.size * 3;
+            size_t i = (size_t)(y * 2) * row + (x * 2) * 3 + c;
+            dst.faces[f][((size_t)y * dst.size + x) * 3 + c] =
+                0.25f * (s[i] + s[i + 3] + s[i + row] + s[i + row + 3]);
+          }
+    }
+    return dst;
+  }
+
+  static float radicalInverse(uint32_t bits) {
+    bits = (bits << 16) | (bits >> 16);
+    bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+    bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+    bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+    bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+    return bits * 2.3283064365386963e-10f;
+  }
+
+  // GGX samples for one roughness; they do not depend on the texel, because
+  // N = V, so they are built once per level and rotated per texel
+  static void buildSamples(float roughness, int sourceSize, int sourceLevels,
+                           vector<Sample> &samples) {
+    const float pi = 3.14159265358979f;
+    samples.clear();
+    if (roughness == 0.0f) {
+      Sample s = {{0.0f, 0.0f, 1.0f}, 1.0f, 0.0f};
+      samples.push_back(s);
+      return;
+    }
+
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float texelSolidAngle = 4.0f * pi / (6.0f * sourceSize * sourceSize);
+    for (int i = 0; i < SAMPLES; i++) {
+      float xi0 = (float)i / SAMPLES, xi1 = radicalInverse(i);
+      float phi = 2.0f * pi * xi0;
+      float cosTheta = sqrtf((1.0f - xi1) / (1.0f + (a2 - 1.0f) * xi1));
+      float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+      float h[3] = {sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta};
+
+      // L = reflect(-V, H) with V = N = +Z
+      Sample s;
+      s.l[0] = 2.0f * cosTheta * h[0];
+      s.l[1] = 2.0f * cosTheta * h[1];
+      s.l[2] = 2.0f * cosTheta * h[2] - 1.0f;
+      s.weight = s.l[2];
+      if (s.weight <= 0.0f)
+        continue;
+
+      // read from the source mip whose texels cover the sample's solid angle
+      float d = cosTheta * cosTheta * (a2 - 1.0f) + 1.0f;
+      float pdf = a2 / (pi * d * d) / 4.0f; // D * NdotH / (4 VdotH), N = V
+      float sampleSolidAngle = 1.0f / (SAMPLES * pdf);
+      float mip = 0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.0f;
+      float maxMip = (float)(sourceLevels - 1);
+      s.mip = mip < 0.0f ? 0.0f : (mip > maxMip ? maxMip : mip);
+      samples.push_back(s);
+    }
+  }
+
+  // direction to face and [0, 1] face coordinates; inverse of
+  // CubeFaceDirection
+  static void directionToFace(const float d[3], int &face, float &s,
+                              float &t) {
+    float ax = fabsf(d[0]), ay = fabsf(d[1]), az = fabsf(d[2]);
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az) {
+      face = d[0] > 0.0f ? 0 : 1;
+      sc = d[0] > 0.0f ? -d[2] : d[2];
+      tc = -d[1];
+      ma = ax;
+    } else if (ay >= az) {
+      face = d[1] > 0.0f ? 2 : 3;
+      sc = d[0];
+      tc = d[1] > 0.0f ? d[2] : -d[2];
+      ma = ay;
+    } else {
+      face = d[2] > 0.0f ? 4 : 5;
+      sc = d[2] > 0.0f ? d[0] : -d[0];
+      tc = -d[1];
+      ma = az;
+    }
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+  }
+
+  static void sampleFace(const SourceMip &mip, int face, float s, float t,
+                         float out[3]) {
+    float x = s * mip.size - 0.5f, y = t * mip.size - 0.5f;
+    int x0 = (int)floorf(x), y0 = (int)floorf(y);
+    float fx = x - x0, fy = y - y0;
+    int x1 = x0 + 1 < mip.size ? x0 + 1 : mip.size - 1;
+    int y1 = y0 + 1 < mip.size ? y0 + 1 : mip.size - 1;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    const float *p = &mip.faces[face][0];
+    for (int c = 0; c < 3; c++) {
+      float top = p[((size_t)y0 * mip.size + x0) * 3 + c] * (1 - fx) +
+                  p[((size_t)y0 * mip.size + x1) * 3 + c] * fx;
+      float bottom = p[((size_t)y1 * mip.size + x0) * 3 + c] * (1 - fx) +
+                     p[((size_t)y1 * mip.size + x1) * 3 + c] * fx;
+      out[c] = top * (1 - fy) + bottom * fy;
+    }
+  }
+
+  // trilinear lookup in the source chain
+  static void sampleSource(const vector<SourceMip> &source, const float d[3],
+                           float mip, float out[3]) {
+    int face;
+    float s, t;
+    directionToFace(d, face, s, t);
+    int m0 = (int)mip;
+    int m1 = m0 + 1 < (int)source.size() ? m0 + 1 : m0;
+    float f = mip - m0;
+    float a[3], b[3];
+    sampleFace(source[m0], face, s, t, a);
+    if (f > 0.0f && m1 != m0) {
+      sampleFace(source[m1], face, s, t, b);
+      for (int c = 0; c < 3; c++)
+        a[c] = a[c] * (1 - f) + b[c] * f;
+    }
+    for (int c = 0; c < 3; c++)
+      out[c] = a[c];
+  }
+
+  static void filterRow(const vector<SourceMip> &source,
+                        const vector<Sample> &samples, int face, int y,
+                        int size, bool encodeSrgb, uint32_t *out) {
+    float v = 2.0f * (y + 0.5f) / size - 1.0f;
+    for (int x = 0; x < size; x++) {
+      float u = 2.0f * (x + 0.5f) / size - 1.0f;
+      float n[3];
+      CubeFaceDirection(face, u, v, n);
+      float len = 1.0f / sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int c = 0; c < 3; c++)
+        n[c] *= len;
+
+      // tangent frame around N
+      float up[3] = {0.0f, 0.0f, 0.0f};
+      up[fabsf(n[2]) < 0.999f ? 2 : 0] = 1.0f;
+      float tx[3] = {up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2],
+                     up[0] * n[1] - up[1] * n[0]};
+      len = 1.0f / sqrtf(tx[0] * tx[0] + tx[1] * tx[1] + tx[2] * tx[2]);
+      for (int c = 0; c < 3; c++)
+        tx[c] *= len;
+      float ty[3] = {n[1] * tx[2] - n[2] * tx[1], n[2] * tx[0] - n[0] * tx[2],
+                     n[0] * tx[1] - n[1] * tx[0]};
+
+      float sum[3] = {0.0f, 0.0f, 0.0f}, weight = 0.0f;
+      for (size_t i = 0; i < samples.size(); i++) {
+        const Sample &smp = samples[i];
+        float l[3];
+        for (int c = 0; c < 3; c++)
+          l[c] = tx[c] * smp.l[0] + ty[c] * smp.l[1] + n[c] * smp.l[2];
+        float radiance[3];
+        sampleSource(source, l, smp.mip, radiance);
+        for (int c = 0; c < 3; c++)
+          sum[c] += radiance[c] * smp.weight;
+        weight += smp.weight;
+      }
+
+      float rgb[3];
+      for (int c = 0; c < 3; c++) {
+        rgb[c] = sum[c] / weight;
+        if (encodeSrgb)
+          rgb[c] = rgb[c] <= 0.0031308f
+                       ? rgb[c] * 12.92f
+                       : 1.055f * powf(rgb[c], 1.0f / 2.4f) - 0.055f;
+      }
+      out[x] = PackRGB9E5(rgb);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <set>
+#include <string>
+
+using namespace std;
+
+// glad is generated for core 3.3 without extensions, so the enums of the
+// extensions used by this project are defined here.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// context version at least major.minor; needs a current context
+inline bool HasGLVersion(int major, int minor) {
+  GLint ctxMajor = 0, ctxMinor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+  glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+  return ctxMajor > major || (ctxMajor == major && ctxMinor >= minor);
+}
+
+// true if the current context advertises the extension; the list is read
+// once, on the first call
+inline bool HasGLExtension(const char *name) {
+  static set<string> extensions;
+  static bool loaded = false;
+  if (!loaded) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+      extensions.insert((const char *)glGetStringi(GL_EXTENSIONS, i));
+    loaded = true;
+  }
+  return extensions.count(name) != 0;
+}
+
+// KHR_parallel_shader_compile, or its ARB twin: programs can be polled with
+// GL_COMPLETION_STATUS_KHR, and the driver may build them on its own threads
+inline bool HasParallelShaderCompile() {
+  static bool supported =
+      HasGLExtension("GL_KHR_parallel_shader_compile") ||
+      HasGLExtension("GL_ARB_parallel_shader_compile");
+  return supported;
+}
+
+typedef void(APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+inline MaxShaderCompilerThreadsProc &MaxShaderCompilerThreads() {
+  static MaxShaderCompilerThreadsProc proc = NULL;
+  return proc;
+}
+
+// glad has no extension entry points, so the one function of the extension
+// is looked up through the window system's loader (glfwGetProcAddress)
+inline bool LoadParallelShaderCompile(GLADloadproc load) {
+  if (!HasParallelShaderCompile())
+    return false;
+  MaxShaderCompilerThreads() = (MaxShaderCompilerThreadsProc)load(
+      HasGLExtension("GL_KHR_parallel_shader_compile")
+          ? "glMaxShaderCompilerThreadsKHR"
+          : "glMaxShaderCompilerThreadsARB");
+  return MaxShaderCompilerThreads() != NULL;
+}
+
+// 0 makes the driver compile on the calling thread, 0xFFFFFFFF lets it use
+// as many threads as it likes
+inline void SetShaderCompilerThreads(GLuint count) {
+  if (MaxShaderCompilerThreads())
+    MaxShaderCompilerThreads()(count);
+}
+
+// f = the entry point called name, through the window system's loader
+template <typename F>
+inline bool LoadGLProc(GLADloadproc load, const char *name, F &f) {
+  f = (F)load(name);
+  return f != NULL;
+}
+
+// Direct state access with immutable storage: core in 4.5, and
+// ARB_direct_state_access on older contexts that also have the buffer
+// storage, texture storage and vertex attrib binding extensions its
+// functions build on. Buffers, vertex arrays and textures are created and
+// filled by name, so making one leaves every binding as it was, and their
+// size and format are fixed up front, which lets the driver place them once.
+struct DirectStateGL {
+  void(APIENTRYP CreateBuffers)(GLsizei n, GLuint *buffers);
+  void(APIENTRYP NamedBufferStorage)(GLuint buffer, GLsizeiptr size,
+                                     const void *data, GLbitfield flags);
+  void(APIENTRYP CreateVertexArrays)(GLsizei n, GLuint *arrays);
+  void(APIENTRYP VertexArrayVertexBuffer)(GLuint vaobj, GLuint bindingindex,
+                                          GLuint buffer, GLintptr offset,
+                                          GLsizei stride);
+  void(APIENTRYP VertexArrayElementBuffer)(GLuint vaobj, GLuint buffer);
+  void(APIENTRYP EnableVertexArrayAttrib)(GLuint vaobj, GLuint index);
+  void(APIENTRYP VertexArrayAttribFormat)(GLuint vaobj, GLuint attribindex,
+                                          GLint size, GLenum type,
+                                          GLboolean normalized,
+                                          GLuint relativeoffset);
+  void(APIENTRYP VertexArrayAttribBinding)(GLuint vaobj, GLuint attribindex,
+                                           GLuint bindingindex);
+  void(APIENTRYP CreateTextures)(GLenum target, GLsizei n, GLuint *textures);
+  void(APIENTRYP TextureStorage2D)(GLuint texture, GLsizei levels,
+                                   GLenum internalformat, GLsizei width,
+                                   GLsizei height);
+  void(APIENTRYP TextureSubImage3D)(GLuint texture, GLint level,
+                                    GLint xoffset, GLint yoffset,
+                                    GLint zoffset, GLsizei width,
+                                    GLsizei height, GLsizei depth,
+                                    GLenum format, GLenum type,
+                                    const void *pixels);
+  void(APIENTRYP TextureParameteri)(GLuint texture, GLenum pname, GLint param);
+  void(APIENTRYP BindTextureUnit)(GLuint unit, GLuint texture);
+  bool loaded;
+
+  static DirectStateGL &Get() {
+    static DirectStateGL gl = DirectStateGL();
+    return gl;
+  }
+
+  // after gladLoadGLLoader; false when the context has neither 4.5 nor the
+  // extensions, or an entry point is missing
+  static bool Load(GLADloadproc load) {
+    DirectStateGL &gl = Get();
+    gl.loaded = false;
+    if (!HasGLVersion(4, 5) &&
+        !(HasGLExtension("GL_ARB_direct_state_access") &&
+          HasGLExtension("GL_ARB_buffer_storage") &&
+          HasGLExtension("GL_ARB_texture_storage") &&
+          HasGLExtension("GL_ARB_vertex_attrib_binding")))
+      return false;
+    bool ok = true;
+    ok &= LoadGLProc(load, "glCreateBuffers", gl.CreateBuffers);
+    ok &= LoadGLProc(load, "glNamedBufferStorage", gl.NamedBufferStorage);
+    ok &= LoadGLProc(load, "glCreateVertexArrays", gl.CreateVertexArrays);
+    ok &= LoadGLProc(load, "glVertexArrayVertexBuffer",
+                     gl.VertexArrayVertexBuffer);
+    ok &= LoadGLProc(load, "glVertexArrayElementBuffer",
+                     gl.VertexArrayElementBuffer);
+    ok &= LoadGLProc(load, "glEnableVertexArrayAttrib",
+                     gl.EnableVertexArrayAttrib);
+    ok &= LoadGLProc(load, "glVertexArrayAttribFormat",
+                     gl.VertexArrayAttribFormat);
+    ok &= LoadGLProc(load, "glVertexArrayAttribBinding",
+                     gl.VertexArrayAttribBinding);
+    ok &= LoadGLProc(load, "glCreateTextures", gl.CreateTextures);
+    ok &= LoadGLProc(load, "glTextureStorage2D", gl.TextureStorage2D);
+    ok &= LoadGLProc(load, "glTextureSubImage3D", gl.TextureSubImage3D);
+    ok &= LoadGLProc(load, "glTextureParameteri", gl.TextureParameteri);
+    ok &= LoadGLProc(load, "glBindTextureUnit", gl.BindTextureUnit);
+    gl.loaded = ok;
+    return ok;
+  }
+};
+
+// Whether meshes, cubemaps and per-frame texture binds go through
+// DirectStateGL. main.cpp turns it on once DirectStateGL::Load() succeeds,
+// unless --bind-to-edit asks for the 3.3 calls.
+inline bool &DirectStateAccess() {
+  static bool use = false;
+  return use;
+}
+
+// binds texture to a texture unit; with direct state access, without
+// touching the active texture unit
+inline void BindTextureUnit(GLuint unit, GLenum target, GLuint texture) {
+  if (DirectStateAccess()) {
+    DirectStateGL::Get().BindTextureUnit(unit, texture);
+    return;
+  }
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(target, texture);
+}
+
+#endif
@@ -0,0 +1,470 @@
+#ifndef GLTF_LOADER_H
+#define GLTF_LOADER_H
+
+#include <glad/glad.h>
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async_io.h"
+#include "json.h"
+#include "pipeline_warmup.h"
+#include "profiler.h"
+#include "render_stats.h"
+
+using namespace std;
+
+// glTF 2.0 (.gltf with .bin or data: buffers, and binary .glb) straight to
+// GL. Vertex and index data in glTF is already laid out for the GPU, so
+// every buffer view a primitive uses is uploaded once from the mapped file,
+// and the VAOs point into it with the accessor's own offset, stride,
+// component type and normalized flag. That covers quantized attributes
+// (KHR_mesh_quantization). Nothing is copied per vertex on the CPU.
+//
+// Like Model's Assimp path, only POSITION (location 0) and NORMAL
+// (location 1) are used and node transforms are ignored. A file this
+// cannot draw as is (sparse accessors, missing normals, extensions it
+// does not know are required) is rejected before any GL call, so Model can
+// fall back to Assimp.
+
+inline bool &NativeGltfLoader() {
+  static bool enabled = true;
+  return enabled;
+}
+
+inline bool HasGltfExtension(const string &path) {
+  size_t dot = path.find_last_of('.');
+  if (dot == string::npos)
+    return false;
+  string ext = path.substr(dot);
+  for (size_t i = 0; i < ext.size(); i++)
+    ext[i] = (char)tolower(ext[i]);
+  return ext == ".gltf" || ext == ".glb";
+}
+
+// one glTF primitive: a VAO over uploaded buffer views
+struct GltfPrimitive {
+  GLuint VAO;
+  GLenum mode;      // glTF modes are GL draw modes
+  GLsizei count;    // indices, or vertices when not indexed
+  GLenum indexType; // 0 when not indexed
+  size_t indexOffset;
+
+  void Draw() const {
+    glBindVertexArray(VAO);
+    PipelineWarmup::Default().Draw(VAO);
+    if (indexType)
+      glDrawElements(mode, count, indexType, (void *)indexOffset);
+    else
+      glDrawArrays(mode, 0, count);
+    glBindVertexArray(0);
+
+    RenderStats &stats = RenderStats::Frame();
+    stats.vaoBinds++;
+    stats.CountDraw(count);
+  }
+};
+
+class GltfLoader {
+public:
+  struct Stats {
+    size_t fileBytes;     // .gltf/.glb plus external buffers
+    size_t uploadedBytes; // buffer views sent to GL
+    int primitives;
+  };
+
+  // Uploads every primitive of path. GL buffers created are appended to
+  // buffers. Needs a current GL context.
+  static bool Load(const string &path, vector<GltfPrimitive> &primitives,
+                   vector<GLuint> &buffers, Stats *stats = NULL) {
+    PROFILE_SCOPE("GltfLoader::Load");
+    GltfLoader loader;
+    if (!loader.open(path) || !loader.plan())
+      return false;
+    loader.upload(primitives, buffers);
+    if (stats) {
+      stats->fileBytes = loader.fileBytes;
+      stats->uploadedBytes = loader.uploadedBytes;
+      stats->primitives = (int)loader.draws.size();
+    }
+    return true;
+  }
+
+private:
+  static const uint32_t GLB_MAGIC = 0x46546C67; // "glTF"
+  static const uint32_t GLB_JSON = 0x4E4F534A;
+  static const uint32_t GLB_BIN = 0x004E4942;
+
+  struct Buffer {
+    const unsigned char *data;
+    size_t size;
+  };
+  struct View {
+    size_t buffer, offset, length, stride;
+  };
+  struct Attribute {
+    size_t view;
+    size_t offset; // within the view
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride; // 0 for tightly packed
+  };
+  struct Draw {
+    Attribute position, normal;
+    GLenum mode;
+    GLsizei count;
+    bool indexed;
+    size_t indexView, indexOffset;
+    GLenum indexType;
+  };
+
+  string path, directory;
+  JsonValue document;
+  AssetBytes file;
+  vector<shared_ptr<AssetBytes>> external; // .bin files
+  vector<vector<unsigned char>> decoded;   // data: URIs
+  vector<Buffer> buffers;
+  vector<View> views;
+  vector<Draw> draws;
+  size_t fileBytes, uploadedBytes;
+
+  GltfLoader() : fileBytes(0), uploadedBytes(0) {}
+
+  bool error(const string &what) {
+    cout << "ERROR::GLTF::" << what << " " << path << endl;
+    return false;
+  }
+
+  bool open(const string &filePath) {
+    path = filePath;
+    size_t slash = path.find_last_of('/');
+    directory = slash == string::npos ? "" : path.substr(0, slash + 1);
+    if (!file.Open(path))
+      return error("CANNOT_OPEN");
+    fileBytes = file.Size();
+
+    const unsigned char *json = file.Data();
+    size_t jsonSize = file.Size();
+    Buffer bin = {NULL, 0};
+    if (file.Size() >= 12 && read32(file.Data()) == GLB_MAGIC) {
+      // header, then a JSON chunk and an optional BIN chunk
+      if (read32(file.Data() + 4) != 2)
+        return error("UNSUPPORTED_VERSION");
+      size_t length = read32(file.Data() + 8), at = 12;
+      if (length > file.Size())
+        return error("TRUNCATED");
+      json = NULL;
+      while (at + 8 <= length) {
+        size_t chunkSize = read32(file.Data() + at);
+        uint32_t chunkType = read32(file.Data() + at + 4);
+        at += 8;
+        if (chunkSize > length - at)
+          return error("TRUNCATED");
+        if (chunkType == GLB_JSON && !json) {
+          json = file.Data() + at;
+          jsonSize = chunkSize;
+        } else if (chunkType == GLB_BIN && !bin.data) {
+          bin.data = file.Data() + at;
+          bin.size = chunkSize;
+        }
+        at += (chunkSize + 3) & ~(size_t)3;
+      }
+      if (!json)
+        return error("NO_JSON_CHUNK");
+    }
+
+    string message;
+    if (!JsonParser::Parse((const char *)json, jsonSize, document, &message))
+      return error("INVALID_JSON (" + message + ")");
+    if (document["asset"]["version"].String().compare(0, 2, "2.") != 0)
+      return error("UNSUPPORTED_VERSION");
+    const JsonValue &required = document["extensionsRequired"];
+    for (size_t i = 0; i < required.Size(); i++)
+      if (required[i].String() != "KHR_mesh_quantization")
+        return error("UNSUPPORTED_EXTENSION " + required[i].String());
+
+    const JsonValue &list = document["buffers"];
+    for (size_t i = 0; i < list.Size(); i++) {
+      Buffer buffer = {NULL, 0};
+      const string &uri = list[i]["uri"].String();
+      if (uri.empty()) {
+        if (i != 0 || !bin.data)
+          return error("MISSING_BUFFER");
+        buffer = bin; // the GLB's own chunk
+      } else if (uri.compare(0, 5, "data:") == 0) {
+        size_t comma = uri.find(',');
+        if (comma == string::npos || comma < 7 ||
+            uri.compare(comma - 7, 7, ";base64") != 0)
+          return error("UNSUPPORTED_URI");
+        decoded.push_back(vector<unsigned char>());
+        if (!decodeBase64(uri.c_str() + comma + 1, decoded.back()))
+          return error("INVALID_BASE64");
+        buffer.data = decoded.back().empty() ? NULL : &decoded.back()[0];
+        buffer.size = decoded.back().size();
+      } else {
+        shared_ptr<AssetBytes> bytes(new AssetBytes());
+        if (!bytes->Open(directory + decodeUri(uri)))
+          return error("CANNOT_OPEN_BUFFER " + uri);
+        external.push_back(bytes);
+        buffer.data = bytes->Data();
+        buffer.size = bytes->Size();
+        fileBytes += buffer.size;
+      }
+      if ((double)buffer.size < list[i]["byteLength"].Number())
+        return error("BUFFER_TOO_SHORT");
+      buffers.push_back(buffer);
+    }
+
+    const JsonValue &viewList = document["bufferViews"];
+    for (size_t i = 0; i < viewList.Size(); i++) {
+      const JsonValue &v = viewList[i];
+      View view;
+      view.buffer = (size_t)v["buffer"].Int(-1);
+      view.offset = (size_t)v["byteOffset"].Int(0);
+      view.length = (size_t)v["byteLength"].Int(0);
+      // the spec allows 4 to 252 in steps of 4; 0 means tightly packed
+      long long stride = v["byteStride"].Int(0);
+      if (v.Has("byteStride") && (stride < 4 || stride > 252 || stride % 4))
+        return error("INVALID_BYTE_STRIDE");
+      view.stride = (size_t)stride;
+      if (view.buffer >= buffers.size() ||
+          view.offset > buffers[view.buffer].size ||
+          view.length > buffers[view.buffer].size - view.offset)
+        return error("INVALID_BUFFER_VIEW");
+      views.push_back(view);
+    }
+    return true;
+  }
+
+  // Validates every primitive and works out its GL formats, before any GL
+  // call is made.
+  bool plan() {
+    const JsonValue &meshes = document["meshes"];
+    for (size_t m = 0; m < meshes.Size(); m++) {
+      const JsonValue &list = meshes[m]["primitives"];
+      for (size_t p = 0; p < list.Size(); p++) {
+        const JsonValue &primitive = list[p];
+        Draw draw;
+        draw.mode = (GLenum)primitive["mode"].Int(4); // TRIANGLES
+        if (draw.mode > 6)
+          return error("INVALID_MODE");
+        const JsonValue &attributes = primitive["attributes"];
+        if (!attributes.Has("POSITION") || !attributes.Has("NORMAL"))
+          return error("NEEDS_POSITION_AND_NORMAL");
+        size_t vertexCount;
+        if (!attribute(attributes["POSITION"], draw.position, vertexCount))
+          return false;
+        size_t normalCount;
+        if (!attribute(attributes["NORMAL"], draw.normal, normalCount) ||
+            normalCount != vertexCount)
+          return error("INVALID_NORMAL");
+
+        draw.indexed = primitive.Has("indices");
+        draw.count = (GLsizei)vertexCount;
+        if (draw.indexed && !indices(primitive["indices"], draw, vertexCount))
+          return false;
+        draws.push_back(draw);
+      }
+    }
+    if (draws.empty())
+      return error("NO_MESHES");
+    return true;
+  }
+
+  static GLenum componentType(long long type) {
+    switch (type) {
+    case 5120: return GL_BYTE;
+    case 5121: return GL_UNSIGNED_BYTE;
+    case 5122: return GL_SHORT;
+    case 5123: return GL_UNSIGNED_SHORT;
+    case 5125: return GL_UNSIGNED_INT;
+    case 5126: return GL_FLOAT;
+    default: return 0;
+    }
+  }
+
+  static size_t componentSize(GLenum type) {
+    return type == GL_BYTE || type == GL_UNSIGNED_BYTE     ? 1
+           : type == GL_SHORT || type == GL_UNSIGNED_SHORT ? 2
+                                                           : 4;
+  }
+
+  // the accessor's bytes must lie inside its buffer view
+  bool accessorRange(const JsonValue &accessor, size_t elementSize,
+                     size_t &view, size_t &offset, size_t &count,
+                     size_t &stride) {
+    if (accessor.Has("sparse"))
+      return error("SPARSE_ACCESSOR");
+    view = (size_t)accessor["bufferView"].Int(-1);
+    offset = (size_t)accessor["byteOffset"].Int(0);
+    count = (size_t)accessor["count"].Int(0);
+    if (view >= views.size() || count == 0 || count > views[view].length)
+      return error("INVALID_ACCESSOR");
+    stride = views[view].stride ? views[view].stride : elementSize;
+    if (stride < elementSize)
+      return error("INVALID_BYTE_STRIDE");
+    // in this form nothing can overflow
+    size_t length = views[view].length;
+    if (offset > length || elementSize > length - offset ||
+        count - 1 > (length - offset - elementSize) / stride)
+      return error("ACCESSOR_OUT_OF_RANGE");
+    return true;
+  }
+
+  bool attribute(const JsonValue &index, Attribute &out, size_t &count) {
+    const JsonValue &accessor = document["accessors"][(size_t)index.Int(-1)];
+    GLenum type = componentType(accessor["componentType"].Int());
+    if (accessor["type"].String() != "VEC3" || type == 0 ||
+        type == GL_UNSIGNED_INT)
+      return error("UNSUPPORTED_ATTRIBUTE");
+    size_t stride;
+    if (!accessorRange(accessor, 3 * componentSize(type), out.view,
+                       out.offset, count, stride))
+      return false;
+    out.components = 3;
+    out.type = type;
+    out.normalized = accessor["normalized"].Bool() ? GL_TRUE : GL_FALSE;
+    out.stride = (GLsizei)views[out.view].stride;
+    return true;
+  }
+
+  bool indices(const JsonValue &index, Draw &draw, size_t vertexCount) {
+    const JsonValue &accessor = document["accessors"][(size_t)index.Int(-1)];
+    GLenum type = componentType(accessor["componentType"].Int());
+    if (accessor["type"].String() != "SCALAR" ||
+        (type != GL_UNSIGNED_BYTE && type != GL_UNSIGNED_SHORT &&
+         type != GL_UNSIGNED_INT))
+      return error("UNSUPPORTED_INDICES");
+    size_t count, stride;
+    if (!accessorRange(accessor, componentSize(type), draw.indexView,
+                       draw.indexOffset, count, stride))
+      return false;
+    if (stride != componentSize(type))
+      return error("STRIDED_INDICES"); // GL reads indices tightly packed
+
+    // an index past the vertices is undefined behaviour in GL, so check
+    // them all; this reads the mapping once and copies nothing
+    const View &view = views[draw.indexView];
+    const unsigned char *data =
+        buffers[view.buffer].data + view.offset + draw.indexOffset;
+    size_t largest = 0;
+    for (size_t i = 0; i < count; i++) {
+      size_t value = type == GL_UNSIGNED_BYTE ? data[i]
+                     : type == GL_UNSIGNED_SHORT
+                         ? (size_t)(data[i * 2] | data[i * 2 + 1] << 8)
+                         : (size_t)read32(data + i * 4);
+      largest = value > largest ? value : largest;
+    }
+    if (largest >= vertexCount)
+      return error("INDEX_OUT_OF_RANGE");
+    draw.count = (GLsizei)count;
+    draw.indexType = type;
+    return true;
+  }
+
+  void upload(vector<GltfPrimitive> &primitives, vector<GLuint> &created) {
+    PROFILE_SCOPE("upload");
+    // each buffer view used once, straight from the file mapping; buffer
+    // objects are untyped, so ARRAY_BUFFER works for index views too and
+    // keeps the element binding of any bound VAO untouched
+    map<size_t, GLuint> uploaded;
+    glBindVertexArray(0);
+    for (size_t d = 0; d < draws.size(); d++) {
+      const Draw &draw = draws[d];
+      size_t used[3] = {draw.position.view, draw.normal.view,
+                        draw.indexed ? draw.indexView : draw.position.view};
+      for (int i = 0; i < 3; i++) {
+        if (uploaded.count(used[i]))
+          continue;
+        const View &view = views[used[i]];
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, view.length,
+                     buffers[view.buffer].data + view.offset, GL_STATIC_DRAW);
+        uploaded[used[i]] = buffer;
+        created.push_back(buffer);
+        uploadedBytes += view.length;
+      }
+    }
+    RenderStats::Frame().bufferBytes += uploadedBytes;
+
+    for (size_t d = 0; d < draws.size(); d++) {
+      const Draw &draw = draws[d];
+      GltfPrimitive primitive;
+      glGenVertexArrays(1, &primitive.VAO);
+      glBindVertexArray(primitive.VAO);
+      pointer(0, draw.position, uploaded[draw.position.view]);
+      pointer(1, draw.normal, uploaded[draw.normal.view]);
+      primitive.mode = draw.mode;
+      primitive.count = draw.count;
+      primitive.indexType = draw.indexed ? draw.indexType : 0;
+      primitive.indexOffset = draw.indexed ? draw.indexOffset : 0;
+      if (draw.indexed)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, uploaded[draw.indexView]);
+      glBindVertexArray(0);
+      primitives.push_back(primitive);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  static void pointer(GLuint location, const Attribute &a, GLuint buffer) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(location);
+    glVertexAttribPointer(location, a.components, a.type, a.normalized,
+                          a.stride, (void *)a.offset);
+  }
+
+  static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v; // glTF is little-endian, like every platform this builds on
+  }
+
+  // "%20" and friends in relative URIs
+  static string decodeUri(const string &uri) {
+    string out;
+    for (size_t i = 0; i < uri.size(); i++) {
+      if (uri[i] == '%' && i + 2 < uri.size() && isxdigit(uri[i + 1]) &&
+          isxdigit(uri[i + 2])) {
+        out += (char)strtol(uri.substr(i + 1, 2).c_str(), NULL, 16);
+        i += 2;
+      } else {
+        out += uri[i];
+      }
+    }
+    return out;
+  }
+
+  static bool decodeBase64(const char *text, vector<unsigned char> &out) {
+    unsigned bits = 0;
+    int count = 0;
+    for (const char *p = text; *p && *p != '='; p++) {
+      char c = *p;
+      int value = c >= 'A' && c <= 'Z'   ? c - 'A'
+                  : c >= 'a' && c <= 'z' ? c - 'a' + 26
+                  : c >= '0' && c <= '9' ? c - '0' + 52
+                  : c == '+'             ? 62
+                  : c == '/'             ? 63
+                                         : -1;
+      if (value < 0)
+        return false;
+      bits = (bits << 6) | (unsigned)value;
+      count += 6;
+      if (count >= 8) {
+        count -= 8;
+        out.push_back((unsigned char)(bits >> count));
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// CPU and GPU time per render pass. GPU time comes from GL_TIMESTAMP
+// queries written at the start and end of each pass; query sets rotate over
+// FRAMES_IN_FLIGHT frames and are only read once the driver reports them
+// available, so reading results never stalls the pipeline. Each pass may be
+// timed once per frame.
+class GpuPassTimer {
+public:
+  static const int FRAMES_IN_FLIGHT = 3;
+  static const int MAX_PASSES = 8;
+  static const int HISTORY = 240;
+
+  struct Pass {
+    const char *name;
+    string series; // benchmark series name, "gpu_<name>_ms"
+    float cpuMs[HISTORY];
+    float gpuMs[HISTORY];
+  };
+
+  // receives every GPU result with the tag given to BeginFrame()
+  function<void(int tag, const string &series, double ms)> onResult;
+
+  GpuPassTimer()
+      : frameSeries("gpu_ms"), supported(false), frame(0), historyPos(0),
+        openPass(-1), droppedFrames(0) {
+    memset(frameCpuMs, 0, sizeof(frameCpuMs));
+    memset(frameGpuMs, 0, sizeof(frameGpuMs));
+    memset(slots, 0, sizeof(slots));
+  }
+
+  // needs a current GL context
+  void Init() {
+    GLint bits = 0;
+    glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+    supported = bits > 0;
+    if (!supported)
+      return;
+    for (int f = 0; f < FRAMES_IN_FLIGHT; f++)
+      glGenQueries(QUERIES_PER_FRAME, slots[f].queries);
+  }
+
+  bool Supported() const { return supported; }
+  int PassCount() const { return (int)passes.size(); }
+  const Pass &GetPass(int i) const { return passes[i]; }
+  int HistoryPos() const { return historyPos; }
+  int DroppedFrames() const { return droppedFrames; }
+  const float *FrameCpuMs() const { return frameCpuMs; }
+  const float *FrameGpuMs() const { return frameGpuMs; }
+
+  void BeginFrame(int tag = -1) {
+    historyPos = (historyPos + 1) % HISTORY;
+    frameCpuMs[historyPos] = 0.0f;
+    frameGpuMs[historyPos] = 0.0f;
+    for (size_t i = 0; i < passes.size(); i++) {
+      passes[i].cpuMs[historyPos] = 0.0f;
+      passes[i].gpuMs[historyPos] = 0.0f;
+    }
+
+    FrameSlot &slot = slots[frame % FRAMES_IN_FLIGHT];
+    if (slot.pending && !collect(slot, false)) {
+      // still not done after FRAMES_IN_FLIGHT frames: drop it rather than wait
+      slot.pending = false;
+      droppedFrames++;
+    }
+
+    slot.tag = tag;
+    slot.historyIndex = historyPos;
+    slot.passMask = 0;
+    frameStart = chrono::steady_clock::now();
+    if (supported)
+      glQueryCounter(slot.queries[0], GL_TIMESTAMP);
+  }
+
+  void Begin(const char *name) {
+    int index = passIndex(name);
+    if (index < 0)
+      return;
+    openPass = index;
+    passStart = chrono::steady_clock::now();
+    if (supported)
+      glQueryCounter(current().queries[2 + index * 2], GL_TIMESTAMP);
+  }
+
+  void End() {
+    if (openPass < 0)
+      return;
+    if (supported)
+      glQueryCounter(current().queries[3 + openPass * 2], GL_TIMESTAMP);
+    current().passMask |= 1u << openPass;
+    passes[openPass].cpuMs[historyPos] += elapsedMs(passStart);
+    openPass = -1;
+  }
+
+  void EndFrame() {
+    FrameSlot &slot = current();
+    if (supported) {
+      glQueryCounter(slot.queries[1], GL_TIMESTAMP);
+      slot.pending = true;
+    }
+    frameCpuMs[historyPos] = elapsedMs(frameStart);
+    frame++;
+
+    // pick up any older frame that has finished in the meantime
+    for (int i = 1; i < FRAMES_IN_FLIGHT; i++) {
+      FrameSlot &older = slots[(frame + i) % FRAMES_IN_FLIGHT];
+      if (older.pending)
+        collect(older, false);
+    }
+  }
+
+  // blocks until every outstanding query has been read
+  void Flush() {
+    for (int i = 0; i < FRAMES_IN_FLIGHT; i++)
+      if (slots[i].pending)
+        collect(slots[i], true);
+  }
+
+private:
+  static const int QUERIES_PER_FRAME = 2 + MAX_PASSES * 2;
+
+  struct FrameSlot {
+    GLuint queries[QUERIES_PER_FRAME]; // frame begin/end, then pass pairs
+    bool pending;
+    int tag;
+    int historyIndex;
+    unsigned int passMask;
+  };
+
+  const string frameSeries;
+  bool supported;
+  vector<Pass> passes;
+  FrameSlot slots[FRAMES_IN_FLIGHT];
+  unsigned int frame;
+  int historyPos;
+  int openPass;
+  int droppedFrames;
+  float frameCpuMs[HISTORY];
+  float frameGpuMs[HISTORY];
+  chrono::steady_clock::time_point frameStart;
+  chrono::steady_clock::time_point passStart;
+
+  FrameSlot &current() { return slots[frame % FRAMES_IN_FLIGHT]; }
+
+  int passIndex(const char *name) {
+    for (size_t i = 0; i < passes.size(); i++)
+      if (passes[i].name == name || strcmp(passes[i].name, name) == 0)
+        return (int)i;
+    if (passes.size() >= MAX_PASSES)
+      return -1;
+
+    passes.push_back(Pass());
+    Pass &p = passes.back();
+    p.name = name;
+    p.series = string("gpu_") + name + "_ms";
+    memset(p.cpuMs, 0, sizeof(p.cpuMs));
+    memset(p.gpuMs, 0, sizeof(p.gpuMs));
+    return (int)passes.size() - 1;
+  }
+
+  bool collect(FrameSlot &slot, bool wait) {
+    if (!wait) {
+      // queries complete in order, so the frame-end stamp covers the rest
+      GLint available = 0;
+      glGetQueryObjectiv(slot.queries[1], GL_QUERY_RESULT_AVAILABLE,
+                         &available);
+      if (!available)
+        return false;
+    }
+
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(slot.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(slot.queries[1], GL_QUERY_RESULT, &end);
+    double frameMs = (end - begin) / 1.0e6;
+    frameGpuMs[slot.historyIndex] = (float)frameMs;
+    if (onResult)
+      onResult(slot.tag, frameSeries, frameMs);
+
+    for (size_t i = 0; i < passes.size(); i++) {
+      if (!(slot.passMask & (1u << i)))
+        continue;
+      glGetQueryObjectui64v(slot.queries[2 + i * 2], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(slot.queries[3 + i * 2], GL_QUERY_RESULT, &end);
+      double ms = (end - begin) / 1.0e6;
+      passes[i].gpuMs[slot.historyIndex] = (float)ms;
+      if (onResult)
+        onResult(slot.tag, passes[i].series, ms);
+    }
+
+    slot.pending = false;
+    return true;
+  }
+
+  static float elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<float, milli>(chrono::steady_clock::now() - since)
+        .count();
+  }
+};
+
+#endif
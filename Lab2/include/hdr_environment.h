@@ -0,0 +1,230 @@
+#ifndef HDR_ENVIRONMENT_H
+#define HDR_ENVIRONMENT_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "parallel.h"
+#include "profiler.h"
+#include "stb_image.h"
+
+using namespace std;
+
+// HDR environment maps: load an equirectangular Radiance .hdr, resample it to
+// six cube faces on the CPU and pack the texels into 32-bit shared-exponent
+// (GL_RGB9_E5) or packed-float (GL_R11F_G11F_B10F) formats. Both need a third
+// of the memory of RGB32F and two thirds of RGBA16F.
+
+enum HdrFormat {
+  HDR_FORMAT_RGB9E5,
+  HDR_FORMAT_R11G11B10F,
+  HDR_FORMAT_RGB16F, // unpacked reference
+};
+
+// linear RGB float image, rows top to bottom
+struct HdrImage {
+  int width;
+  int height;
+  vector<float> rgb;
+
+  HdrImage() : width(0), height(0) {}
+};
+
+inline bool LoadHdrImage(const char *path, HdrImage &image) {
+  PROFILE_SCOPE("LoadHdrImage");
+  int channels = 0;
+  float *data = stbi_loadf(path, &image.width, &image.height, &channels, 3);
+  if (!data) {
+    cout << "ERROR::HDR::CANNOT_LOAD " << path << ": " << stbi_failure_reason()
+         << endl;
+    return false;
+  }
+  image.rgb.assign(data, data + (size_t)image.width * image.height * 3);
+  stbi_image_free(data);
+  return true;
+}
+
+// Direction through texel (x, y) of a cube face, following the face
+// orientation table of the GL spec (section 8.13).
+inline void CubeFaceDirection(int face, float u, float v, float dir[3]) {
+  switch (face) {
+  case 0: dir[0] = 1.0f; dir[1] = -v; dir[2] = -u; break;   // +X
+  case 1: dir[0] = -1.0f; dir[1] = -v; dir[2] = u; break;   // -X
+  case 2: dir[0] = u; dir[1] = 1.0f; dir[2] = v; break;     // +Y
+  case 3: dir[0] = u; dir[1] = -1.0f; dir[2] = -v; break;   // -Y
+  case 4: dir[0] = u; dir[1] = -v; dir[2] = 1.0f; break;    // +Z
+  default: dir[0] = -u; dir[1] = -v; dir[2] = -1.0f; break; // -Z
+  }
+}
+
+// bilinear lookup, wrapping horizontally and clamping at the poles
+inline void SampleEquirect(const HdrImage &image, float s, float t,
+                           float out[3]) {
+  float x = s * image.width - 0.5f, y = t * image.height - 0.5f;
+  int x0 = (int)floorf(x), y0 = (int)floorf(y);
+  float fx = x - x0, fy = y - y0;
+  int xs[2] = {(x0 % image.width + image.width) % image.width,
+               ((x0 + 1) % image.width + image.width) % image.width};
+  int ys[2] = {y0 < 0 ? 0 : (y0 >= image.height ? image.height - 1 : y0),
+               y0 + 1 >= image.height ? image.height - 1
+                                      : (y0 + 1 < 0 ? 0 : y0 + 1)};
+  const float w[4] = {(1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy,
+                      fx * fy};
+  out[0] = out[1] = out[2] = 0.0f;
+  for (int k = 0; k < 4; k++) {
+    const float *p =
+        &image.rgb[((size_t)ys[k >> 1] * image.width + xs[k & 1]) * 3];
+    for (int c = 0; c < 3; c++)
+      out[c] += w[k] * p[c];
+  }
+}
+
+// Resamples an equirectangular image into six faceSize^2 RGB float faces.
+// Rows of all faces are spread over worker threads.
+inline void EquirectToCube(const HdrImage &image, int faceSize,
+                           vector<float> faces[6], int threads = 0) {
+  PROFILE_SCOPE("EquirectToCube");
+  for (int face = 0; face < 6; face++)
+    faces[face].resize((size_t)faceSize * faceSize * 3);
+
+  const float invPi = 0.31830988618f;
+  ParallelFor(
+      6 * faceSize,
+      [&](int job) {
+        int face = job / faceSize, y = job % faceSize;
+        float v = 2.0f * (y + 0.5f) / faceSize - 1.0f;
+        float *row = &faces[face][(size_t)y * faceSize * 3];
+        for (int x = 0; x < faceSize; x++) {
+          float u = 2.0f * (x + 0.5f) / faceSize - 1.0f;
+          float dir[3];
+          CubeFaceDirection(face, u, v, dir);
+          float len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+          float s = 0.5f + atan2f(dir[2], dir[0]) * 0.5f * invPi;
+          float t = acosf(dir[1] / len) * invPi;
+          SampleEquirect(image, s, t, &row[x * 3]);
+        }
+      },
+      threads, "equirect");
+}
+
+// ---- packing ----------------------------------------------------------------
+
+// 2^e for -126 <= e <= 127, built directly from the float bits
+inline float Pow2(int e) {
+  uint32_t bits = (uint32_t)(e + 127) << 23;
+  float f;
+  memcpy(&f, &bits, 4);
+  return f;
+}
+
+// GL_RGB9_E5 texel, per EXT_texture_shared_exponent. The exponent comes from
+// the float bits rather than log2f, which keeps packing cheap.
+inline uint32_t PackRGB9E5(const float rgb[3]) {
+  const int N = 9, B = 15;
+  const float maxValue = 65408.0f; // (2^9 - 1) / 2^9 * 2^16
+  float c[3], maxc = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    c[i] = rgb[i] > 0.0f ? (rgb[i] < maxValue ? rgb[i] : maxValue) : 0.0f;
+    maxc = c[i] > maxc ? c[i] : maxc;
+  }
+  if (maxc == 0.0f)
+    return 0;
+
+  uint32_t bits;
+  memcpy(&bits, &maxc, 4);
+  int exp = (int)((bits >> 23) & 0xFF) - 127; // floor(log2(maxc))
+  exp = (exp < -B - 1 ? -B - 1 : exp) + 1 + B;
+  float scale = Pow2(B + N - exp);
+  if ((int)(maxc * scale + 0.5f) == (1 << N)) {
+    exp++;
+    scale *= 0.5f;
+  }
+
+  uint32_t m[3];
+  for (int i = 0; i < 3; i++) {
+    m[i] = (uint32_t)(c[i] * scale + 0.5f);
+    m[i] = m[i] > 511 ? 511 : m[i];
+  }
+  return m[0] | (m[1] << 9) | (m[2] << 18) | ((uint32_t)exp << 27);
+}
+
+inline void UnpackRGB9E5(uint32_t v, float rgb[3]) {
+  float scale = Pow2((int)(v >> 27) - 15 - 9);
+  rgb[0] = (v & 511) * scale;
+  rgb[1] = ((v >> 9) & 511) * scale;
+  rgb[2] = ((v >> 18) & 511) * scale;
+}
+
+// unsigned float with 5 exponent bits and mantissaBits (6 or 5) mantissa
+// bits, as used by GL_R11F_G11F_B10F; rounds to nearest and saturates
+inline uint32_t PackUnsignedFloat(float f, int mantissaBits) {
+  const uint32_t maxFinite = (30u << mantissaBits) | ((1u << mantissaBits) - 1);
+  if (!(f > 0.0f)) // negative, zero and NaN
+    return 0;
+
+  uint32_t bits;
+  memcpy(&bits, &f, 4);
+  int exp = (int)((bits >> 23) & 0xFF) - 127 + 15;
+  if (exp > 30) // includes infinity
+    return maxFinite;
+  uint32_t mant = (bits & 0x7FFFFF) | 0x800000; // with the implicit one
+  int shift = 23 - mantissaBits;
+  if (exp <= 0) {
+    // denormal: exponent fixed at -14, no implicit one
+    if (exp < -mantissaBits)
+      return 0;
+    shift += 1 - exp;
+    exp = 0;
+  }
+
+  // m still holds the implicit one for normals, so adding it to (exp - 1)
+  // also carries a rounded-up mantissa into the exponent
+  uint32_t m = (mant + (1u << (shift - 1))) >> shift;
+  uint32_t packed = exp == 0 ? m : ((uint32_t)(exp - 1) << mantissaBits) + m;
+  return packed < maxFinite ? packed : maxFinite;
+}
+
+inline float UnpackUnsignedFloat(uint32_t v, int mantissaBits) {
+  int exp = (int)(v >> mantissaBits);
+  float mant = (float)(v & ((1u << mantissaBits) - 1));
+  if (exp == 0)
+    return ldexpf(mant / (1 << mantissaBits), -14);
+  return ldexpf(1.0f + mant / (1 << mantissaBits), exp - 15);
+}
+
+// GL_R11F_G11F_B10F texel (GL_UNSIGNED_INT_10F_11F_11F_REV)
+inline uint32_t PackR11G11B10F(const float rgb[3]) {
+  return PackUnsignedFloat(rgb[0], 6) | (PackUnsignedFloat(rgb[1], 6) << 11) |
+         (PackUnsignedFloat(rgb[2], 5) << 22);
+}
+
+inline void UnpackR11G11B10F(uint32_t v, float rgb[3]) {
+  rgb[0] = UnpackUnsignedFloat(v & 0x7FF, 6);
+  rgb[1] = UnpackUnsignedFloat((v >> 11) & 0x7FF, 6);
+  rgb[2] = UnpackUnsignedFloat(v >> 22, 5);
+}
+
+// packs an RGB float face into 32-bit texels
+inline void PackHdrFace(const vector<float> &rgb, HdrFormat format,
+                        vector<uint32_t> &out, int threads = 0) {
+  size_t texels = rgb.size() / 3;
+  out.resize(texels);
+  const int chunk = 16384;
+  int chunks = (int)((texels + chunk - 1) / chunk);
+  ParallelFor(
+      chunks,
+      [&](int c) {
+        size_t end = (size_t)(c + 1) * chunk;
+        end = end < texels ? end : texels;
+        for (size_t i = (size_t)c * chunk; i < end; i++)
+          out[i] = format == HDR_FORMAT_RGB9E5 ? PackRGB9E5(&rgb[i * 3])
+                                               : PackR11G11B10F(&rgb[i * 3]);
+      },
+      threads, "pack");
+}
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef IMAGE_DECODE_H
+#define IMAGE_DECODE_H
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef USE_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+#endif
+
+#include "asset_pack.h"
+#include "async_io.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "stb_image.h"
+
+using namespace std;
+
+// 8-bit image decoded on the CPU, ready for glTexImage2D
+struct DecodedImage {
+  int width;
+  int height;
+  int channels;
+  vector<unsigned char> pixels;
+  bool ok;
+
+  DecodedImage() : width(0), height(0), channels(0), ok(false) {}
+};
+
+enum ImageDecoder {
+  DECODER_STB,
+  DECODER_LIBJPEG, // libjpeg(-turbo) for .jpg files, stb for everything else
+};
+
+inline ImageDecoder &DefaultImageDecoder() {
+#ifdef USE_LIBJPEG
+  static ImageDecoder decoder = DECODER_LIBJPEG;
+#else
+  static ImageDecoder decoder = DECODER_STB;
+#endif
+  return decoder;
+}
+
+inline bool HasJpegExtension(const char *path) {
+  const char *dot = strrchr(path, '.');
+  return dot && (strcmp(dot, ".jpg") == 0 || strcmp(dot, ".jpeg") == 0 ||
+                 strcmp(dot, ".JPG") == 0 || strcmp(dot, ".JPEG") == 0);
+}
+
+// Both decoders read a prefetched copy of the file when AsyncFileReader has
+// one, and the file itself otherwise.
+inline bool DecodeWithStb(const char *path, DecodedImage &image) {
+  AsyncFileReader::Buffer encoded = AsyncFileReader::Default().Find(path);
+  unsigned char *data =
+      encoded && !encoded->empty()
+          ? stbi_load_from_memory(&(*encoded)[0], (int)encoded->size(),
+                                  &image.width, &image.height,
+                                  &image.channels, 0)
+          : stbi_load(path, &image.width, &image.height, &image.channels, 0);
+  if (!data)
+    return false;
+  image.pixels.assign(data, data + (size_t)image.width * image.height *
+                                       image.channels);
+  stbi_image_free(data);
+  return true;
+}
+
+#ifdef USE_LIBJPEG
+struct JpegErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+};
+
+inline void JpegErrorExit(j_common_ptr info) {
+  JpegErrorManager *err = (JpegErrorManager *)info->err;
+  longjmp(err->jump, 1);
+}
+
+// libjpeg-turbo implements this API with SIMD IDCT and colour conversion.
+// scaleDenom 2, 4 or 8 decodes at reduced size straight from the DCT
+// coefficients, which is several times faster than a full decode.
+inline bool DecodeWithLibjpeg(const char *path, DecodedImage &image,
+                              int scaleDenom = 1) {
+  AsyncFileReader::Buffer encoded = AsyncFileReader::Default().Find(path);
+  FILE *file = NULL;
+  if (!encoded || encoded->empty()) {
+    file = fopen(path, "rb");
+    if (!file)
+      return false;
+  }
+
+  jpeg_decompress_struct info;
+  JpegErrorManager err;
+  info.err = jpeg_std_error(&err.base);
+  err.base.error_exit = JpegErrorExit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&info);
+    if (file)
+      fclose(file);
+    return false;
+  }
+
+  jpeg_create_decompress(&info);
+  if (file)
+    jpeg_stdio_src(&info, file);
+  else
+    jpeg_mem_src(&info, (unsigned char *)&(*encoded)[0],
+                 (unsigned long)encoded->size());
+  jpeg_read_header(&info, TRUE);
+  if (info.num_components != 1)
+    info.out_color_space = JCS_RGB;
+  info.scale_num = 1;
+  info.scale_denom = scaleDenom;
+  jpeg_start_decompress(&info);
+
+  image.width = info.output_width;
+  image.height = info.output_height;
+  image.channels = info.output_components;
+  size_t stride = (size_t)image.width * image.channels;
+  image.pixels.resize(stride * image.height);
+  while (info.output_scanline < info.output_height) {
+    JSAMPROW row = &image.pixels[info.output_scanline * stride];
+    jpeg_read_scanlines(&info, &row, 1);
+  }
+
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+  if (file)
+    fclose(file);
+  return true;
+}
+#endif
+
+// Image blob stored in asset packs: the pixels as DecodedImage holds them,
+// then u32 width, height and channels. With the header at the end, a blob
+// becomes the pixel buffer by dropping the last 12 bytes, without a copy.
+inline void EncodeImageBlob(const DecodedImage &image,
+                            vector<unsigned char> &blob) {
+  uint32_t trailer[3] = {(uint32_t)image.width, (uint32_t)image.height,
+                         (uint32_t)image.channels};
+  blob = image.pixels;
+  blob.insert(blob.end(), (const unsigned char *)trailer,
+              (const unsigned char *)trailer + sizeof(trailer));
+}
+
+// takes over the blob's storage
+inline bool DecodeImageBlob(vector<unsigned char> &blob, DecodedImage &image) {
+  uint32_t trailer[3];
+  if (blob.size() < sizeof(trailer))
+    return false;
+  size_t bytes = blob.size() - sizeof(trailer);
+  memcpy(trailer, &blob[bytes], sizeof(trailer));
+  if ((uint64_t)trailer[0] * trailer[1] * trailer[2] != bytes)
+    return false;
+  image.width = trailer[0];
+  image.height = trailer[1];
+  image.channels = trailer[2];
+  blob.resize(bytes);
+  image.pixels.swap(blob);
+  return true;
+}
+
+// Baked textures in the open asset pack are used as they are; anything else
+// is decoded from its prefetched copy or its file. A full decode releases
+// the prefetched copy.
+inline bool DecodeImage(const char *path, DecodedImage &image,
+                        ImageDecoder decoder = DefaultImageDecoder()) {
+  const AssetPack &pack = AssetPack::Default();
+  const AssetEntry *entry = pack.IsOpen() ? pack.Find(path) : NULL;
+  if (entry && entry->type == ASSET_TEXTURE) {
+    vector<unsigned char> blob;
+    image.ok = pack.Read(path, blob) && DecodeImageBlob(blob, image);
+    if (image.ok)
+      return true;
+  }
+#ifdef USE_LIBJPEG
+  if (decoder == DECODER_LIBJPEG && HasJpegExtension(path))
+    image.ok = DecodeWithLibjpeg(path, image);
+  else
+    image.ok = DecodeWithStb(path, image);
+#else
+  (void)decoder;
+  image.ok = DecodeWithStb(path, image);
+#endif
+  AsyncFileReader::Default().Release(path);
+  return image.ok;
+}
+
+// Decodes count files on up to maxThreads worker threads. Decoding touches
+// no GL state, so the caller uploads the results on the GL thread.
+inline void DecodeImagesParallel(const char *const *paths, int count,
+                                 vector<DecodedImage> &images,
+                                 int maxThreads = 6,
+                                 ImageDecoder decoder = DefaultImageDecoder()) {
+  images.clear();
+  images.resize(count);
+  ParallelFor(
+      count,
+      [&](int i) {
+        PROFILE_SCOPE("decode image");
+        DecodeImage(paths[i], images[i], decoder);
+      },
+      maxThreads, "decode");
+}
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef INPUT_REPLAY_H
+#define INPUT_REPLAY_H
+
+#include <GLFW/glfw3.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// record types in the log; every frame starts with INPUT_FRAME
+enum InputRecordType {
+  INPUT_FRAME = 1,     // f32 seconds since recording start
+  INPUT_KEY = 2,       // i16 key, u8 action, u8 mods
+  INPUT_CURSOR = 3,    // f64 x, f64 y
+  INPUT_SCROLL = 4,    // f32 x, f32 y
+  INPUT_KEY_STATE = 5, // i16 key, u8 down   (polled keys, on change only)
+  INPUT_UI_STATE = 6,  // u8 slot, u16 size, bytes   (on change only)
+};
+
+// Records GLFW input and tracked UI variables to a compact binary log and
+// plays them back frame-for-frame. Both modes run the simulation at the log's
+// fixed timestep, so a replay reproduces the recorded session exactly.
+//
+// Callbacks should start with the matching On*() call and return early when
+// it returns false: that records the event while recording and swallows live
+// input while replaying. Polled keys go through KeyDown(), and PollEvents()
+// replaces glfwPollEvents().
+class InputLog {
+public:
+  float fixedDelta;
+
+  InputLog()
+      : fixedDelta(1.0f / 60.0f), mode(MODE_OFF), dispatching(false),
+        readPos(0), segmentStart(0), frameCount(0), startTime(0.0) {
+    memset(keyDown, 0, sizeof(keyDown));
+  }
+
+  bool Recording() const { return mode == MODE_RECORD; }
+  bool Replaying() const { return mode == MODE_REPLAY; }
+  bool Finished() const { return mode == MODE_DONE; }
+  int FrameCount() const { return frameCount; }
+
+  // registers a variable edited through the UI, e.g. a slider target;
+  // register the same slots in the same order for recording and replay
+  void TrackState(void *data, size_t size) {
+    TrackedState s;
+    s.data = (unsigned char *)data;
+    s.last.assign(s.data, s.data + size);
+    tracked.push_back(s);
+  }
+
+  void StartRecording(const string &logPath) {
+    path = logPath;
+    buffer.clear();
+    const char *magic = "RTIL";
+    buffer.insert(buffer.end(), magic, magic + 4);
+    put<uint16_t>(VERSION);
+    put<float>(fixedDelta);
+    for (size_t i = 0; i < tracked.size(); i++)
+      tracked[i].last.assign(tracked[i].data,
+                             tracked[i].data + tracked[i].last.size());
+    startTime = glfwGetTime();
+    frameCount = 0;
+    mode = MODE_RECORD;
+  }
+
+  bool StartReplay(const string &logPath) {
+    ifstream file(logPath.c_str(), ios::binary);
+    if (!file) {
+      cout << "ERROR::INPUT_REPLAY::CANNOT_OPEN " << logPath << endl;
+      return false;
+    }
+    buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+
+    readPos = 0;
+    if (buffer.size() < 10 || memcmp(&buffer[0], "RTIL", 4) != 0) {
+      cout << "ERROR::INPUT_REPLAY::BAD_LOG " << logPath << endl;
+      return false;
+    }
+    readPos = 4;
+    if (get<uint16_t>() != VERSION) {
+      cout << "ERROR::INPUT_REPLAY::UNSUPPORTED_VERSION " << logPath << endl;
+      return false;
+    }
+    fixedDelta = get<float>();
+    frameCount = 0;
+    mode = MODE_REPLAY;
+    return true;
+  }
+
+  // Call at the top of every frame, before processInput(). While replaying
+  // this restores the frame's polled keys and tracked UI variables.
+  void BeginFrame() {
+    if (mode == MODE_RECORD) {
+      buffer.push_back(INPUT_FRAME);
+      put<float>((float)(glfwGetTime() - startTime));
+      frameCount++;
+      return;
+    }
+    if (mode != MODE_REPLAY)
+      return;
+
+    if (readPos >= buffer.size() || buffer[readPos] != INPUT_FRAME) {
+      cout << "Replay finished after " << frameCount << " frames" << endl;
+      mode = MODE_DONE;
+      return;
+    }
+    readPos++;
+    get<float>(); // original timestamp, informational only
+    frameCount++;
+    segmentStart = readPos;
+    replaySegment(false, NULL, NULL, NULL, NULL);
+  }
+
+  // Call where the frame would call glfwPollEvents(), which it calls. The
+  // events a recorded frame logged came from this call at its end, so a
+  // replay feeds them back through the given callbacks here too, and they
+  // take effect from the next frame exactly as they did live.
+  void PollEvents(GLFWwindow *window, GLFWkeyfun onKey,
+                  GLFWcursorposfun onCursor, GLFWscrollfun onScroll) {
+    glfwPollEvents();
+    if (mode == MODE_REPLAY)
+      replaySegment(true, window, onKey, onCursor, onScroll);
+  }
+
+  // Call once the UI has been built for the frame; records tracked variables
+  // that changed since the last frame.
+  void EndFrame() {
+    if (mode != MODE_RECORD)
+      return;
+    for (size_t i = 0; i < tracked.size(); i++) {
+      TrackedState &s = tracked[i];
+      if (memcmp(s.data, &s.last[0], s.last.size()) == 0)
+        continue;
+      s.last.assign(s.data, s.data + s.last.size());
+      buffer.push_back(INPUT_UI_STATE);
+      put<uint8_t>((uint8_t)i);
+      put<uint16_t>((uint16_t)s.last.size());
+      buffer.insert(buffer.end(), s.last.begin(), s.last.end());
+    }
+  }
+
+  bool Save() {
+    if (mode != MODE_RECORD)
+      return false;
+    ofstream file(path.c_str(), ios::binary);
+    if (!file) {
+      cout << "ERROR::INPUT_REPLAY::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+    file.write((const char *)&buffer[0], buffer.size());
+    cout << "Recorded " << frameCount << " frames (" << buffer.size()
+         << " bytes) to " << path << endl;
+    mode = MODE_OFF;
+    return true;
+  }
+
+  bool OnKey(int key, int action, int mods) {
+    if (mode == MODE_REPLAY)
+      return dispatching;
+    if (mode == MODE_RECORD) {
+      buffer.push_back(INPUT_KEY);
+      put<int16_t>((int16_t)key);
+      put<uint8_t>((uint8_t)action);
+      put<uint8_t>((uint8_t)mods);
+    }
+    return true;
+  }
+
+  bool OnCursor(double x, double y) {
+    if (mode == MODE_REPLAY)
+      return dispatching;
+    if (mode == MODE_RECORD) {
+      buffer.push_back(INPUT_CURSOR);
+      put<double>(x);
+      put<double>(y);
+    }
+    return true;
+  }
+
+  bool OnScroll(double x, double y) {
+    if (mode == MODE_REPLAY)
+      return dispatching;
+    if (mode == MODE_RECORD) {
+      buffer.push_back(INPUT_SCROLL);
+      put<float>((float)x);
+      put<float>((float)y);
+    }
+    return true;
+  }
+
+  // glfwGetKey() replacement for polled input
+  bool KeyDown(GLFWwindow *window, int key) {
+    if (key < 0 || key > GLFW_KEY_LAST)
+      return false;
+    if (mode == MODE_REPLAY || mode == MODE_DONE)
+      return keyDown[key];
+
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    if (mode == MODE_RECORD && down != keyDown[key]) {
+      buffer.push_back(INPUT_KEY_STATE);
+      put<int16_t>((int16_t)key);
+      put<uint8_t>(down ? 1 : 0);
+    }
+    keyDown[key] = down;
+    return down;
+  }
+
+private:
+  enum Mode { MODE_OFF, MODE_RECORD, MODE_REPLAY, MODE_DONE };
+  static const uint16_t VERSION = 1;
+
+  struct TrackedState {
+    unsigned char *data;
+    vector<unsigned char> last;
+  };
+
+  Mode mode;
+  bool dispatching;
+  string path;
+  vector<unsigned char> buffer;
+  size_t readPos;
+  size_t segmentStart; // first record of the frame being replayed
+  int frameCount;
+  double startTime;
+  bool keyDown[GLFW_KEY_LAST + 1];
+  vector<TrackedState> tracked;
+
+  // Walks the current frame's records, from segmentStart up to the next
+  // frame marker, applying either the input events (events) or the polled
+  // keys and UI variables (!events) and skipping the rest.
+  void replaySegment(bool events, GLFWwindow *window, GLFWkeyfun onKey,
+                     GLFWcursorposfun onCursor, GLFWscrollfun onScroll) {
+    readPos = segmentStart;
+    dispatching = true;
+    while (readPos < buffer.size() && buffer[readPos] != INPUT_FRAME) {
+      unsigned char type = buffer[readPos++];
+      if (type == INPUT_KEY) {
+        int key = get<int16_t>();
+        int action = get<uint8_t>();
+        int mods = get<uint8_t>();
+        if (events)
+          onKey(window, key, 0, action, mods);
+      } else if (type == INPUT_CURSOR) {
+        double x = get<double>();
+        double y = get<double>();
+        if (events)
+          onCursor(window, x, y);
+      } else if (type == INPUT_SCROLL) {
+        float x = get<float>();
+        float y = get<float>();
+        if (events)
+          onScroll(window, x, y);
+      } else if (type == INPUT_KEY_STATE) {
+        int key = get<int16_t>();
+        bool down = get<uint8_t>() != 0;
+        if (!events && key >= 0 && key <= GLFW_KEY_LAST)
+          keyDown[key] = down;
+      } else if (type == INPUT_UI_STATE) {
+        size_t slot = get<uint8_t>();
+        size_t size = get<uint16_t>();
+        if (readPos + size > buffer.size())
+          break;
+        if (!events && slot < tracked.size() &&
+            size == tracked[slot].last.size())
+          memcpy(tracked[slot].data, &buffer[readPos], size);
+        readPos += size;
+      } else {
+        cout << "ERROR::INPUT_REPLAY::CORRUPT_LOG at byte " << readPos << endl;
+        mode = MODE_DONE;
+        break;
+      }
+    }
+    dispatching = false;
+  }
+
+  // values are stored in host byte order
+  template <typename T> void put(T value) {
+    const unsigned char *p = (const unsigned char *)&value;
+    buffer.insert(buffer.end(), p, p + sizeof(T));
+  }
+
+  template <typename T> T get() {
+    T value = T();
+    if (readPos + sizeof(T) <= buffer.size())
+      memcpy(&value, &buffer[readPos], sizeof(T));
+    readPos += sizeof(T);
+    return value;
+  }
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Small read-only JSON document (RFC 8259) for glTF and similar manifests.
+// Lookups of missing members or out-of-range items return a shared null
+// value, so chained lookups need no checks in between.
+class JsonValue {
+public:
+  enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY,
+              JSON_OBJECT };
+
+  Type type;
+  bool boolean;
+  double number;
+  string text;
+  vector<JsonValue> items;                    // arrays
+  vector<pair<string, JsonValue>> members;    // objects, in document order
+
+  JsonValue() : type(JSON_NULL), boolean(false), number(0) {}
+
+  bool IsNull() const { return type == JSON_NULL; }
+  bool IsNumber() const { return type == JSON_NUMBER; }
+  bool IsString() const { return type == JSON_STRING; }
+  bool IsArray() const { return type == JSON_ARRAY; }
+  bool IsObject() const { return type == JSON_OBJECT; }
+
+  size_t Size() const {
+    return type == JSON_ARRAY ? items.size()
+           : type == JSON_OBJECT ? members.size()
+                                 : 0;
+  }
+
+  const JsonValue &operator[](size_t i) const {
+    return type == JSON_ARRAY && i < items.size() ? items[i] : Null();
+  }
+
+  const JsonValue &operator[](const char *key) const {
+    if (type == JSON_OBJECT)
+      for (size_t i = 0; i < members.size(); i++)
+        if (members[i].first == key)
+          return members[i].second;
+    return Null();
+  }
+
+  bool Has(const char *key) const { return !(*this)[key].IsNull(); }
+
+  double Number(double fallback = 0) const {
+    return type == JSON_NUMBER ? number : fallback;
+  }
+  long long Int(long long fallback = 0) const {
+    return type == JSON_NUMBER ? (long long)number : fallback;
+  }
+  bool Bool(bool fallback = false) const {
+    return type == JSON_BOOL ? boolean : fallback;
+  }
+  const string &String() const {
+    static const string empty;
+    return type == JSON_STRING ? text : empty;
+  }
+
+  static const JsonValue &Null() {
+    static const JsonValue null;
+    return null;
+  }
+};
+
+// Recursive descent over the whole text. Returns false with a message and
+// byte offset in error on malformed input.
+class JsonParser {
+public:
+  static bool Parse(const char *text, size_t size, JsonValue &out,
+                    string *error = NULL) {
+    JsonParser parser(text, size);
+    bool ok = parser.value(out, 0);
+    if (ok) {
+      parser.skipSpace();
+      ok = parser.p == parser.end || parser.fail("trailing characters");
+    }
+    if (!ok && error)
+      *error = parser.message + " at byte " + to_string(parser.p - text);
+    return ok;
+  }
+
+private:
+  static const int MAX_DEPTH = 256;
+
+  const char *p, *end;
+  string message;
+
+  JsonParser(const char *text, size_t size) : p(text), end(text + size) {}
+
+  bool fail(const char *what) {
+    message = what;
+    return false;
+  }
+
+  void skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      p++;
+  }
+
+  bool literal(const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n || memcmp(p, word, n) != 0)
+      return fail("invalid literal");
+    p += n;
+    return true;
+  }
+
+  bool value(JsonValue &out, int depth) {
+    if (depth > MAX_DEPTH)
+      return fail("nesting too deep");
+    skipSpace();
+    if (p >= end)
+      return fail("unexpected end");
+    switch (*p) {
+    case '{':
+      return object(out, depth);
+    case '[':
+      return array(out, depth);
+    case '"':
+      out.type = JsonValue::JSON_STRING;
+      return str(out.text);
+    case 't':
+      out.type = JsonValue::JSON_BOOL;
+      out.boolean = true;
+      return literal("true");
+    case 'f':
+      out.type = JsonValue::JSON_BOOL;
+      out.boolean = false;
+      return literal("false");
+    case 'n':
+      out.type = JsonValue::JSON_NULL;
+      return literal("null");
+    default:
+      return num(out);
+    }
+  }
+
+  bool object(JsonValue &out, int depth) {
+    out.type = JsonValue::JSON_OBJECT;
+    p++; // {
+    skipSpace();
+    if (p < end && *p == '}') {
+      p++;
+      return true;
+    }
+    for (;;) {
+      skipSpace();
+      out.members.push_back(pair<string, JsonValue>());
+      pair<string, JsonValue> &member = out.members.back();
+      if (p >= end || *p != '"')
+        return fail("expected member name");
+      if (!str(member.first))
+        return false;
+      skipSpace();
+      if (p >= end || *p++ != ':')
+        return fail("expected ':'");
+      if (!value(member.second, depth + 1))
+        return false;
+      skipSpace();
+      if (p < end && *p == ',') {
+        p++;
+        continue;
+      }
+      if (p < end && *p == '}') {
+        p++;
+        return true;
+      }
+      return fail("expected ',' or '}'");
+    }
+  }
+
+  bool array(JsonValue &out, int depth) {
+    out.type = JsonValue::JSON_ARRAY;
+    p++; // [
+    skipSpace();
+    if (p < end && *p == ']') {
+      p++;
+      return true;
+    }
+    for (;;) {
+      out.items.push_back(JsonValue());
+      if (!value(out.items.back(), depth + 1))
+        return false;
+      skipSpace();
+      if (p < end && *p == ',') {
+        p++;
+        continue;
+      }
+      if (p < end && *p == ']') {
+        p++;
+        return true;
+      }
+      return fail("expected ',' or ']'");
+    }
+  }
+
+  bool num(JsonValue &out) {
+    // validate the JSON grammar, then let strtod do the conversion
+    const char *start = p;
+    if (p < end && *p == '-')
+      p++;
+    if (p >= end || *p < '0' || *p > '9')
+      return fail("invalid value");
+    if (*p == '0')
+      p++;
+    else
+      while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    if (p < end && *p == '.') {
+      p++;
+      if (p >= end || *p < '0' || *p > '9')
+        return fail("invalid number");
+      while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      p++;
+      if (p < end && (*p == '+' || *p == '-'))
+        p++;
+      if (p >= end || *p < '0' || *p > '9')
+        return fail("invalid number");
+      while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    }
+    string digits(start, p); // strtod needs a terminator
+    out.type = JsonValue::JSON_NUMBER;
+    out.number = strtod(digits.c_str(), NULL);
+    return true;
+  }
+
+  bool hex4(unsigned &code) {
+    if (end - p < 4)
+      return fail("invalid escape");
+    code = 0;
+    for (int i = 0; i < 4; i++) {
+      char c = *p++;
+      code <<= 4;
+      if (c >= '0' && c <= '9')
+        code |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+        code |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+        code |= c - 'A' + 10;
+      else
+        return fail("invalid escape");
+    }
+    return true;
+  }
+
+  static void appendUtf8(string &out, unsigned code) {
+    if (code < 0x80) {
+      out += (char)code;
+    } else if (code < 0x800) {
+      out += (char)(0xC0 | (code >> 6));
+      out += (char)(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      out += (char)(0xE0 | (code >> 12));
+      out += (char)(0x80 | ((code >> 6) & 0x3F));
+      out += (char)(0x80 | (code & 0x3F));
+    } else {
+      out += (char)(0xF0 | (code >> 18));
+      out += (char)(0x80 | ((code >> 12) & 0x3F));
+      out += (char)(0x80 | ((code >> 6) & 0x3F));
+      out += (char)(0x80 | (code & 0x3F));
+    }
+  }
+
+  bool str(string &out) {
+    p++; // "
+    const char *run = p;
+    for (;;) {
+      // copy unescaped runs in one go
+      while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+      out.append(run, p);
+      if (p >= end)
+        return fail("unterminated string");
+      if (*p == '"') {
+        p++;
+        return true;
+      }
+      if (*p != '\\')
+        return fail("control character in string");
+      p++;
+      if (p >= end)
+        return fail("unterminated string");
+      char c = *p++;
+      switch (c) {
+      case '"': out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/': out += '/'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+        unsigned code;
+        if (!hex4(code))
+          return false;
+        if (code >= 0xD800 && code < 0xDC00) { // surrogate pair
+          unsigned low;
+          if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+            return fail("unpaired surrogate");
+          p += 2;
+          if (!hex4(low) || low < 0xDC00 || low >= 0xE000)
+            return fail("unpaired surrogate");
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        appendUtf8(out, code);
+        break;
+      }
+      default:
+        return fail("invalid escape");
+      }
+      run = p;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// LZ4 block format (lz4.org, "LZ4 Block Format Description"), without the
+// frame format around it. Blocks are compatible with LZ4_compress_default and
+// LZ4_decompress_safe, so packs can be inspected with the reference library,
+// but nothing here depends on it. The compressor is the greedy single-probe
+// matcher of LZ4's fast mode; decompression checks every length and offset
+// against both buffers, so a corrupt pack fails instead of overrunning.
+
+const int LZ4_MIN_MATCH = 4;
+const int LZ4_LAST_LITERALS = 5; // the block always ends with literals
+const int LZ4_MF_LIMIT = 12;     // no match may start in the last 12 bytes
+const int LZ4_MAX_OFFSET = 65535;
+const int LZ4_HASH_LOG = 16;
+
+inline int Lz4CompressBound(int size) { return size + size / 255 + 16; }
+
+inline uint32_t Lz4Read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline unsigned char *Lz4WriteLength(unsigned char *op, int length) {
+  for (; length >= 255; length -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+// Compresses srcSize bytes into dst, which must hold Lz4CompressBound(srcSize)
+// bytes. Returns the compressed size.
+inline int Lz4Compress(const unsigned char *src, int srcSize,
+                       unsigned char *dst) {
+  unsigned char *op = dst;
+  int anchor = 0;
+
+  if (srcSize > LZ4_MF_LIMIT) {
+    vector<int> table((size_t)1 << LZ4_HASH_LOG, -1);
+    const int mfLimit = srcSize - LZ4_MF_LIMIT;
+    const int matchLimit = srcSize - LZ4_LAST_LITERALS;
+    int ip = 0;
+    int misses = 1 << 6; // skip ahead faster through incompressible data
+
+    while (ip < mfLimit) {
+      uint32_t sequence = Lz4Read32(src + ip);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+      int ref = table[hash];
+      table[hash] = ip;
+      if (ref < 0 || ip - ref > LZ4_MAX_OFFSET ||
+          Lz4Read32(src + ref) != sequence) {
+        ip += misses++ >> 6;
+        continue;
+      }
+      misses = 1 << 6;
+
+      // extend backwards over literals, then forwards
+      while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+        ip--;
+        ref--;
+      }
+      int length = LZ4_MIN_MATCH;
+      while (ip + length < matchLimit && src[ref + length] == src[ip + length])
+        length++;
+
+      int literals = ip - anchor;
+      int matchCode = length - LZ4_MIN_MATCH;
+      unsigned char *token = op++;
+      *token = (unsigned char)(((literals < 15 ? literals : 15) << 4) |
+                               (matchCode < 15 ? matchCode : 15));
+      if (literals >= 15)
+        op = Lz4WriteLength(op, literals - 15);
+      memcpy(op, src + anchor, literals);
+      op += literals;
+      int offset = ip - ref;
+      *op++ = (unsigned char)(offset & 0xFF);
+      *op++ = (unsigned char)(offset >> 8);
+      if (matchCode >= 15)
+        op = Lz4WriteLength(op, matchCode - 15);
+
+      ip += length;
+      anchor = ip;
+      if (ip < mfLimit) // the position just before is cheap to remember
+        table[(Lz4Read32(src + ip - 2) * 2654435761u) >> (32 - LZ4_HASH_LOG)] =
+            ip - 2;
+    }
+  }
+
+  int literals = srcSize - anchor;
+  *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+  if (literals >= 15)
+    op = Lz4WriteLength(op, literals - 15);
+  memcpy(op, src + anchor, literals);
+  op += literals;
+  return (int)(op - dst);
+}
+
+// Decompresses a block into exactly dstSize bytes. Returns false on any
+// malformed input.
+inline bool Lz4Decompress(const unsigned char *src, int srcSize,
+                          unsigned char *dst, int dstSize) {
+  const unsigned char *ip = src, *srcEnd = src + srcSize;
+  unsigned char *op = dst, *dstEnd = dst + dstSize;
+
+  while (ip < srcEnd) {
+    unsigned token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15) {
+      unsigned char b;
+      do {
+        if (ip >= srcEnd)
+          return false;
+        b = *ip++;
+        literals += b;
+      } while (b == 255);
+    }
+    if (literals > (size_t)(srcEnd - ip) || literals > (size_t)(dstEnd - op))
+      return false;
+    if (literals <= 16 && srcEnd - ip >= 16 && dstEnd - op >= 16)
+      memcpy(op, ip, 16); // fixed size, so it compiles to two moves
+    else
+      memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+    if (ip == srcEnd) // the last sequence has no match
+      break;
+
+    if (srcEnd - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst))
+      return false;
+    size_t length = token & 15;
+    if (length == 15) {
+      unsigned char b;
+      do {
+        if (ip >= srcEnd)
+          return false;
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    length += LZ4_MIN_MATCH;
+    if (length > (size_t)(dstEnd - op))
+      return false;
+
+    const unsigned char *match = op - offset;
+    if (offset >= 16 && (size_t)(dstEnd - op) >= length + 16) {
+      // 16-byte steps may run past the match; the slack is overwritten next
+      for (size_t i = 0; i < length; i += 16)
+        memcpy(op + i, match + i, 16);
+      op += length;
+    } else if (offset >= length) {
+      memcpy(op, match, length);
+      op += length;
+    } else {
+      // overlapping copy repeats the last offset bytes
+      for (size_t i = 0; i < length; i++)
+        *op++ = *match++;
+    }
+  }
+  return op == dstEnd;
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file. Pages are read on first touch,
+// with no stdio buffer in between.
+class MappedFile {
+public:
+  MappedFile() : data(NULL), size(0) {}
+  ~MappedFile() { Close(); }
+
+  bool Open(const string &path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok && st.st_size > 0) {
+      void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      if (ok) {
+        data = (const unsigned char *)p;
+        size = (size_t)st.st_size;
+      }
+    }
+    close(fd);
+    return ok;
+  }
+
+  void Close() {
+    if (data)
+      munmap((void *)data, size);
+    data = NULL;
+    size = 0;
+  }
+
+  // for files read front to back: more read-ahead, pages dropped sooner
+  void AdviseSequential() {
+    if (data)
+      madvise((void *)data, size, MADV_SEQUENTIAL);
+  }
+
+  // empty files map to no data but still open successfully
+  const unsigned char *Data() const { return data; }
+  size_t Size() const { return size; }
+
+private:
+  const unsigned char *data;
+  size_t size;
+
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+};
+
+// Drops a file's clean pages from the OS page cache, for cold-cache
+// measurements. Returns false where the hint is not supported.
+inline bool EvictFromPageCache(const string &path) {
+#ifdef POSIX_FADV_DONTNEED
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  fdatasync(fd);
+  bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return ok;
+#else
+  (void)path;
+  return false;
+#endif
+}
+
+// same for every file directly inside a directory (a model and the
+// materials and textures next to it)
+inline int EvictDirectoryFromPageCache(const string &directory) {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir)
+    return 0;
+  int evicted = 0;
+  for (dirent *e = readdir(dir); e; e = readdir(dir))
+    if (e->d_name[0] != '.' && EvictFromPageCache(directory + "/" + e->d_name))
+      evicted++;
+  closedir(dir);
+  return evicted;
+}
+
+// appends every regular file below a directory, in directory order
+inline void ListFilesRecursive(const string &directory, vector<string> &paths) {
+  DIR *dir = opendir(directory.c_str());
+  if (!dir)
+    return;
+  for (dirent *e = readdir(dir); e; e = readdir(dir)) {
+    if (e->d_name[0] == '.')
+      continue;
+    string path = directory + "/" + e->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+      continue;
+    if (S_ISDIR(st.st_mode))
+      ListFilesRecursive(path, paths);
+    else if (S_ISREG(st.st_mode))
+      paths.push_back(path);
+  }
+  closedir(dir);
+}
+
+#endif
@@ -0,0 +1,617 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "asset_pack.h"
+#include "lz4_block.h"
+#include "parallel.h"
+
+using namespace std;
+
+// Lossless mesh compression for baked meshes. The codec only filters: its
+// output is smaller than the raw arrays and far more compressible, and the
+// asset pack's LZ4 chunks are the general-purpose stage on top.
+//
+// Vertex stream: u32 block count, u32 byte size per block, then blocks of up
+// to VERTEX_BLOCK vertices, each decodable on its own. Inside a block every
+// 32-bit component is delta coded against the previous vertex and zigzagged,
+// then split into four byte planes. A plane is sent in groups of 16 bytes,
+// each packed to 0, 2, 4 or 8 bits as its largest byte needs, after a
+// header of 2 bits per group. Slowly varying attributes leave the high
+// planes mostly at 0 bits.
+//
+// Index stream: u32 block count, per block u32 next and u32 byte size, then
+// blocks of up to INDEX_BLOCK indices. Each index is a 4-bit code: 0 for the
+// next vertex not seen yet, 1..INDEX_RING for a slot of a ring of recently
+// introduced vertices, or 15 for a zigzag varint delta to the previous index
+// that follows the codes. Meshes in first-use vertex order (what the loaders
+// produce) code most corners in 4 bits.
+class MeshCodec {
+public:
+  enum { VERTEX_BLOCK = 8192, INDEX_BLOCK = 3 * 16384, INDEX_RING = 14 };
+
+  // stride must be a multiple of 4
+  static void EncodeVertices(const void *vertices, size_t count, size_t stride,
+                             vector<unsigned char> &out) {
+    size_t blocks = (count + VERTEX_BLOCK - 1) / VERTEX_BLOCK;
+    vector<vector<unsigned char> > encoded(blocks);
+    ParallelFor(
+        (int)blocks,
+        [&](int b) {
+          size_t first = (size_t)b * VERTEX_BLOCK;
+          size_t n = count - first < VERTEX_BLOCK ? count - first
+                                                  : (size_t)VERTEX_BLOCK;
+          encodeVertexBlock((const unsigned char *)vertices + first * stride,
+                            n, stride, encoded[b]);
+        },
+        0, "mesh encode");
+    put32(out, (uint32_t)blocks);
+    for (size_t b = 0; b < blocks; b++)
+      put32(out, (uint32_t)encoded[b].size());
+    for (size_t b = 0; b < blocks; b++)
+      out.insert(out.end(), encoded[b].begin(), encoded[b].end());
+  }
+
+  // Decodes exactly count vertices, blocks spread over up to maxThreads
+  // threads. Returns false on malformed input.
+  static bool DecodeVertices(const unsigned char *data, size_t size,
+                             void *vertices, size_t count, size_t stride,
+                             int maxThreads = 0) {
+    size_t blocks = (count + VERTEX_BLOCK - 1) / VERTEX_BLOCK;
+    vector<size_t> starts;
+    size_t pos;
+    if (!blockTable(data, size, blocks, 4, starts, pos))
+      return false;
+    vector<char> ok(blocks, 0);
+    ParallelFor(
+        (int)blocks,
+        [&](int b) {
+          size_t first = (size_t)b * VERTEX_BLOCK;
+          size_t n = count - first < VERTEX_BLOCK ? count - first
+                                                  : (size_t)VERTEX_BLOCK;
+          ok[b] = decodeVertexBlock(data + starts[b], starts[b + 1] - starts[b],
+                                    (unsigned char *)vertices + first * stride,
+                                    n, stride);
+        },
+        maxThreads, "mesh decode");
+    for (size_t b = 0; b < blocks; b++)
+      if (!ok[b])
+        return false;
+    return true;
+  }
+
+  static void EncodeIndices(const unsigned int *indices, size_t count,
+                            vector<unsigned char> &out) {
+    size_t blocks = (count + INDEX_BLOCK - 1) / INDEX_BLOCK;
+    vector<vector<unsigned char> > encoded(blocks);
+    vector<uint32_t> nexts(blocks);
+    uint32_t next = 0; // carried across blocks, so it is encoded serially
+    for (size_t b = 0; b < blocks; b++) {
+      size_t first = b * INDEX_BLOCK;
+      size_t n = count - first < INDEX_BLOCK ? count - first
+                                             : (size_t)INDEX_BLOCK;
+      nexts[b] = next;
+      encodeIndexBlock(indices + first, n, next, encoded[b]);
+    }
+    put32(out, (uint32_t)blocks);
+    for (size_t b = 0; b < blocks; b++) {
+      put32(out, nexts[b]);
+      put32(out, (uint32_t)encoded[b].size());
+    }
+    for (size_t b = 0; b < blocks; b++)
+      out.insert(out.end(), encoded[b].begin(), encoded[b].end());
+  }
+
+  // Decodes exactly count indices and rejects any that is not below
+  // vertexCount.
+  static bool DecodeIndices(const unsigned char *data, size_t size,
+                            unsigned int *indices, size_t count,
+                            uint32_t vertexCount, int maxThreads = 0) {
+    size_t blocks = (count + INDEX_BLOCK - 1) / INDEX_BLOCK;
+    vector<size_t> starts;
+    size_t pos;
+    if (!blockTable(data, size, blocks, 8, starts, pos))
+      return false;
+    vector<char> ok(blocks, 0);
+    ParallelFor(
+        (int)blocks,
+        [&](int b) {
+          size_t first = (size_t)b * INDEX_BLOCK;
+          size_t n = count - first < INDEX_BLOCK ? count - first
+                                                 : (size_t)INDEX_BLOCK;
+          uint32_t next;
+          memcpy(&next, data + 4 + (size_t)b * 8, 4);
+          ok[b] = decodeIndexBlock(data + starts[b], starts[b + 1] - starts[b],
+                                   next, indices + first, n, vertexCount);
+        },
+        maxThreads, "mesh decode");
+    for (size_t b = 0; b < blocks; b++)
+      if (!ok[b])
+        return false;
+    return true;
+  }
+
+  // Compression ratio and decode throughput on one mesh, against the raw
+  // arrays as the pack stored them before. Sizes include the pack's LZ4
+  // stage (ASSET_PACK_CHUNK_SIZE chunks); throughput is decoded output per
+  // second, best of repeats.
+  static void Benchmark(const string &name, const void *vertices,
+                        size_t vertexCount, size_t stride,
+                        const unsigned int *indices, size_t indexCount,
+                        int threads = 1, int repeats = 5) {
+    size_t vertexBytes = vertexCount * stride, indexBytes = indexCount * 4;
+    vector<unsigned char> encodedVertices, encodedIndices;
+    EncodeVertices(vertices, vertexCount, stride, encodedVertices);
+    EncodeIndices(indices, indexCount, encodedIndices);
+
+    vector<unsigned char> raw(vertexBytes + indexBytes);
+    if (vertexBytes)
+      memcpy(&raw[0], vertices, vertexBytes);
+    if (indexBytes)
+      memcpy(&raw[vertexBytes], indices, indexBytes);
+    vector<unsigned char> packedVertices, packedIndices, packedRaw;
+    size_t lz4Raw = lz4Chunks(raw, packedRaw);
+    size_t lz4Vertices = lz4Chunks(encodedVertices, packedVertices);
+    size_t lz4Indices = lz4Chunks(encodedIndices, packedIndices);
+
+    vector<unsigned char> decodedVertices(vertexBytes + 16);
+    vector<unsigned int> decodedIndices(indexCount + 1);
+    vector<unsigned char> unpacked;
+    double vertexMs = 1e30, indexMs = 1e30, fullMs = 1e30;
+    bool ok = true;
+    for (int r = 0; r < repeats; r++) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      ok &= DecodeVertices(encodedVertices.data(), encodedVertices.size(),
+                           &decodedVertices[0], vertexCount, stride, threads);
+      double ms = since(start);
+      vertexMs = ms < vertexMs ? ms : vertexMs;
+
+      start = chrono::steady_clock::now();
+      ok &= DecodeIndices(encodedIndices.data(), encodedIndices.size(),
+                          &decodedIndices[0], indexCount,
+                          (uint32_t)vertexCount, threads);
+      ms = since(start);
+      indexMs = ms < indexMs ? ms : indexMs;
+
+      // what loadBaked pays: LZ4 chunks, then both decoders
+      start = chrono::steady_clock::now();
+      ok &= unlz4Chunks(packedVertices, encodedVertices.size(), unpacked,
+                        threads) &&
+            DecodeVertices(unpacked.data(), unpacked.size(),
+                           &decodedVertices[0], vertexCount, stride, threads);
+      ok &= unlz4Chunks(packedIndices, encodedIndices.size(), unpacked,
+                        threads) &&
+            DecodeIndices(unpacked.data(), unpacked.size(), &decodedIndices[0],
+                          indexCount, (uint32_t)vertexCount, threads);
+      ms = since(start);
+      fullMs = ms < fullMs ? ms : fullMs;
+    }
+    ok = ok && (!vertexBytes ||
+                memcmp(&decodedVertices[0], vertices, vertexBytes) == 0) &&
+         (!indexBytes || memcmp(&decodedIndices[0], indices, indexBytes) == 0);
+
+    size_t encoded = encodedVertices.size() + encodedIndices.size();
+    size_t packed = lz4Vertices + lz4Indices;
+    size_t total = vertexBytes + indexBytes;
+    cout << "MeshCodec " << name << ": " << vertexCount << " vertices, "
+         << indexCount / 3 << " triangles, " << (ok ? "lossless" : "MISMATCH")
+         << endl
+         << "  raw " << total / 1024.0 << " KB, raw+LZ4 " << lz4Raw / 1024.0
+         << " KB (" << ratio(total, lz4Raw) << "x), codec "
+         << encoded / 1024.0 << " KB (" << ratio(total, encoded)
+         << "x), codec+LZ4 " << packed / 1024.0 << " KB ("
+         << ratio(total, packed) << "x)" << endl
+         << "  vertices " << ratio(vertexBytes, lz4Vertices) << "x, "
+         << lz4Vertices * 8.0 / (vertexCount ? vertexCount : 1)
+         << " bits/vertex; indices " << ratio(indexBytes, lz4Indices)
+         << "x, " << lz4Indices * 8.0 / (indexCount / 3 ? indexCount / 3 : 1)
+         << " bits/triangle" << endl
+         << "  decode (" << (threads > 0 ? threads : HardwareThreads())
+         << " threads): vertices " << gbPerSecond(vertexBytes, vertexMs)
+         << " GB/s, indices " << gbPerSecond(indexBytes, indexMs)
+         << " GB/s, LZ4+codec " << gbPerSecond(total, fullMs) << " GB/s ("
+         << fullMs << " ms)" << endl;
+  }
+
+private:
+  static void put32(vector<unsigned char> &out, uint32_t value) {
+    out.insert(out.end(), (unsigned char *)&value, (unsigned char *)&value + 4);
+  }
+
+  // Block sizes follow a table of entryBytes per block, the size in its
+  // last 4 bytes; starts gets blocks + 1 offsets into data.
+  static bool blockTable(const unsigned char *data, size_t size,
+                         size_t blocks, size_t entryBytes,
+                         vector<size_t> &starts, size_t &pos) {
+    uint32_t stored;
+    if (size < 4)
+      return false;
+    memcpy(&stored, data, 4);
+    pos = 4 + blocks * entryBytes;
+    if (stored != blocks || size < pos)
+      return false;
+    starts.resize(blocks + 1);
+    for (size_t b = 0; b < blocks; b++) {
+      uint32_t bytes;
+      memcpy(&bytes, data + 4 + b * entryBytes + entryBytes - 4, 4);
+      starts[b] = pos;
+      if (size - pos < bytes)
+        return false;
+      pos += bytes;
+    }
+    starts[blocks] = pos;
+    return true;
+  }
+
+  static void encodeVertexBlock(const unsigned char *vertices, size_t n,
+                                size_t stride, vector<unsigned char> &out) {
+    size_t padded = (n + 15) & ~(size_t)15;
+    vector<uint32_t> zigzag(n);
+    vector<unsigned char> plane(padded, 0);
+    for (size_t c = 0; c < stride / 4; c++) {
+      uint32_t previous = 0;
+      for (size_t i = 0; i < n; i++) {
+        uint32_t value;
+        memcpy(&value, vertices + i * stride + c * 4, 4);
+        uint32_t delta = value - previous;
+        zigzag[i] = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+        previous = value;
+      }
+      for (int b = 0; b < 4; b++) {
+        for (size_t i = 0; i < n; i++)
+          plane[i] = (unsigned char)(zigzag[i] >> (8 * b));
+        encodePlane(&plane[0], padded / 16, out);
+      }
+    }
+  }
+
+  static void encodePlane(const unsigned char *plane, size_t groups,
+                          vector<unsigned char> &out) {
+    size_t header = out.size();
+    out.resize(header + (groups + 3) / 4, 0);
+    for (size_t g = 0; g < groups; g++) {
+      const unsigned char *v = plane + g * 16;
+      unsigned char bits = 0;
+      for (int i = 0; i < 16; i++)
+        bits |= v[i];
+      int code = bits == 0 ? 0 : bits < 4 ? 1 : bits < 16 ? 2 : 3;
+      out[header + g / 4] |= (unsigned char)(code << (2 * (g % 4)));
+      if (code == 1) {
+        for (int i = 0; i < 16; i += 4)
+          out.push_back((unsigned char)(v[i] | v[i + 1] << 2 | v[i + 2] << 4 |
+                                        v[i + 3] << 6));
+      } else if (code == 2) {
+        for (int i = 0; i < 16; i += 2)
+          out.push_back((unsigned char)(v[i] | v[i + 1] << 4));
+      } else if (code == 3) {
+        out.insert(out.end(), v, v + 16);
+      }
+    }
+  }
+
+  // bytes a group takes for each width code
+  static size_t groupBytes(int code) { return code ? (size_t)2 << code : 0; }
+
+#ifdef __SSE2__
+  static __m128i unpackGroup(int code, const unsigned char *in) {
+    if (code == 0)
+      return _mm_setzero_si128();
+    if (code == 1) {
+      int32_t packed;
+      memcpy(&packed, in, 4);
+      __m128i x = _mm_cvtsi32_si128(packed), mask = _mm_set1_epi8(3);
+      __m128i a0 = _mm_and_si128(x, mask);
+      __m128i a1 = _mm_and_si128(_mm_srli_epi16(x, 2), mask);
+      __m128i a2 = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+      __m128i a3 = _mm_and_si128(_mm_srli_epi16(x, 6), mask);
+      return _mm_unpacklo_epi16(_mm_unpacklo_epi8(a0, a1),
+                                _mm_unpacklo_epi8(a2, a3));
+    }
+    if (code == 2) {
+      __m128i x = _mm_loadl_epi64((const __m128i *)in),
+              mask = _mm_set1_epi8(15);
+      return _mm_unpacklo_epi8(_mm_and_si128(x, mask),
+                               _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+    }
+    return _mm_loadu_si128((const __m128i *)in);
+  }
+#else
+  static void unpackGroup(int code, const unsigned char *in,
+                          unsigned char *out) {
+    for (int i = 0; i < 16; i++)
+      out[i] = code == 0   ? 0
+               : code == 1 ? (in[i / 4] >> (2 * (i % 4))) & 3
+               : code == 2 ? (in[i / 2] >> (4 * (i % 2))) & 15
+                           : in[i];
+  }
+#endif
+
+  // Planes are decoded group by group alongside each other, so a block
+  // never goes through memory in byte-plane form: a first pass over the
+  // headers finds where each plane's groups start and checks the sizes.
+  static bool decodeVertexBlock(const unsigned char *data, size_t size,
+                                unsigned char *vertices, size_t n,
+                                size_t stride) {
+    size_t groups = (n + 15) / 16, components = stride / 4;
+    size_t headerBytes = (groups + 3) / 4, pos = 0;
+    static thread_local vector<const unsigned char *> headers, cursors;
+    headers.resize(components * 4);
+    cursors.resize(components * 4);
+    for (size_t p = 0; p < components * 4; p++) {
+      if (size - pos < headerBytes)
+        return false;
+      headers[p] = data + pos;
+      pos += headerBytes;
+      size_t bytes = 0;
+      for (size_t h = 0; h < headerBytes; h++)
+        for (int k = 0; k < 8; k += 2)
+          bytes += groupBytes((headers[p][h] >> k) & 3);
+      if (size - pos < bytes)
+        return false;
+      cursors[p] = data + pos;
+      pos += bytes;
+    }
+    if (pos != size)
+      return false;
+
+    static thread_local vector<uint32_t> carry, values;
+    carry.assign(components, 0);
+    values.resize(components * 16);
+    for (size_t g = 0; g < groups; g++) {
+      int shift = 2 * (g % 4);
+      for (size_t c = 0; c < components; c++) {
+        const unsigned char **cursor = &cursors[c * 4];
+        int codes[4];
+        for (int b = 0; b < 4; b++)
+          codes[b] = (headers[c * 4 + b][g / 4] >> shift) & 3;
+#ifdef __SSE2__
+        // interleave the planes into 32-bit lanes, undo the zigzag, then a
+        // running sum across the lanes
+        __m128i b0 = unpackGroup(codes[0], cursor[0]);
+        __m128i b1 = unpackGroup(codes[1], cursor[1]);
+        __m128i b2 = unpackGroup(codes[2], cursor[2]);
+        __m128i b3 = unpackGroup(codes[3], cursor[3]);
+        __m128i lo01 = _mm_unpacklo_epi8(b0, b1), hi01 = _mm_unpackhi_epi8(b0, b1);
+        __m128i lo23 = _mm_unpacklo_epi8(b2, b3), hi23 = _mm_unpackhi_epi8(b2, b3);
+        __m128i lanes[4] = {_mm_unpacklo_epi16(lo01, lo23),
+                            _mm_unpackhi_epi16(lo01, lo23),
+                            _mm_unpacklo_epi16(hi01, hi23),
+                            _mm_unpackhi_epi16(hi01, hi23)};
+        __m128i sum = _mm_set1_epi32((int)carry[c]), one = _mm_set1_epi32(1);
+        for (int k = 0; k < 4; k++) {
+          __m128i z = lanes[k];
+          __m128i d = _mm_xor_si128(
+              _mm_srli_epi32(z, 1),
+              _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, one)));
+          d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+          d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+          sum = _mm_add_epi32(d, sum);
+          _mm_storeu_si128((__m128i *)&values[c * 16 + 4 * k], sum);
+          sum = _mm_shuffle_epi32(sum, 0xFF);
+        }
+        carry[c] = (uint32_t)_mm_cvtsi128_si32(sum);
+#else
+        unsigned char b[4][16];
+        for (int p = 0; p < 4; p++)
+          unpackGroup(codes[p], cursor[p], b[p]);
+        uint32_t value = carry[c];
+        for (int i = 0; i < 16; i++) {
+          uint32_t z = b[0][i] | b[1][i] << 8 | b[2][i] << 16 |
+                       (uint32_t)b[3][i] << 24;
+          value += (z >> 1) ^ (0u - (z & 1));
+          values[c * 16 + i] = value;
+        }
+        carry[c] = value;
+#endif
+        for (int b = 0; b < 4; b++)
+          cursor[b] += groupBytes(codes[b]);
+      }
+      writeRows(&values[0], components, vertices + g * 16 * stride, stride,
+                n - g * 16 < 16 ? n - g * 16 : 16);
+    }
+    return true;
+  }
+
+  // Scatters 16 decoded values per component into rows vertices. Whole
+  // groups are transposed four (then two) components at a time, so rows
+  // are written in 16- and 8-byte pieces.
+  static void writeRows(const uint32_t *values, size_t components,
+                        unsigned char *rows, size_t stride, size_t count) {
+    size_t c = 0;
+#ifdef __SSE2__
+    if (count == 16) {
+      for (; c + 4 <= components; c += 4)
+        for (int k = 0; k < 16; k += 4) {
+          const uint32_t *v = values + c * 16 + k;
+          __m128i r0 = _mm_loadu_si128((const __m128i *)v);
+          __m128i r1 = _mm_loadu_si128((const __m128i *)(v + 16));
+          __m128i r2 = _mm_loadu_si128((const __m128i *)(v + 32));
+          __m128i r3 = _mm_loadu_si128((const __m128i *)(v + 48));
+          __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpackhi_epi32(r0, r1);
+          __m128i t2 = _mm_unpacklo_epi32(r2, r3), t3 = _mm_unpackhi_epi32(r2, r3);
+          unsigned char *out = rows + k * stride + c * 4;
+          _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi64(t0, t2));
+          _mm_storeu_si128((__m128i *)(out + stride), _mm_unpackhi_epi64(t0, t2));
+          _mm_storeu_si128((__m128i *)(out + 2 * stride), _mm_unpacklo_epi64(t1, t3));
+          _mm_storeu_si128((__m128i *)(out + 3 * stride), _mm_unpackhi_epi64(t1, t3));
+        }
+      for (; c + 2 <= components; c += 2)
+        for (int k = 0; k < 16; k += 4) {
+          const uint32_t *v = values + c * 16 + k;
+          __m128i r0 = _mm_loadu_si128((const __m128i *)v);
+          __m128i r1 = _mm_loadu_si128((const __m128i *)(v + 16));
+          __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpackhi_epi32(r0, r1);
+          unsigned char *out = rows + k * stride + c * 4;
+          _mm_storel_epi64((__m128i *)out, t0);
+          _mm_storel_epi64((__m128i *)(out + stride), _mm_unpackhi_epi64(t0, t0));
+          _mm_storel_epi64((__m128i *)(out + 2 * stride), t1);
+          _mm_storel_epi64((__m128i *)(out + 3 * stride), _mm_unpackhi_epi64(t1, t1));
+        }
+    }
+#endif
+    for (; c < components; c++)
+      for (size_t j = 0; j < count; j++)
+        memcpy(rows + j * stride + c * 4, &values[c * 16 + j], 4);
+  }
+
+  static void encodeIndexBlock(const unsigned int *indices, size_t n,
+                               uint32_t &next, vector<unsigned char> &out) {
+    uint32_t ring[INDEX_RING] = {0};
+    int slot = 0;
+    uint32_t last = 0;
+    vector<unsigned char> escapes;
+    out.assign((n + 1) / 2, 0);
+    for (size_t i = 0; i < n; i++) {
+      uint32_t v = indices[i];
+      int code = 15;
+      if (v == next) {
+        code = 0;
+        next++;
+      } else {
+        for (int j = 0; j < INDEX_RING; j++)
+          if (ring[j] == v) {
+            code = 1 + j;
+            break;
+          }
+      }
+      if (code == 15) {
+        uint32_t delta = v - last;
+        uint32_t z = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+        while (z >= 0x80) {
+          escapes.push_back((unsigned char)(z | 0x80));
+          z >>= 7;
+        }
+        escapes.push_back((unsigned char)z);
+        if (v >= next)
+          next = v + 1;
+      }
+      if (code == 0 || code == 15) {
+        ring[slot] = v;
+        slot = slot == INDEX_RING - 1 ? 0 : slot + 1;
+      }
+      out[i / 2] |= (unsigned char)(code << (4 * (i % 2)));
+      last = v;
+    }
+    out.insert(out.end(), escapes.begin(), escapes.end());
+  }
+
+  static bool decodeIndexBlock(const unsigned char *data, size_t size,
+                               uint32_t next, unsigned int *indices, size_t n,
+                               uint32_t vertexCount) {
+    size_t codeBytes = (n + 1) / 2;
+    if (size < codeBytes)
+      return false;
+    const unsigned char *escape = data + codeBytes, *end = data + size;
+    uint32_t ring[INDEX_RING] = {0};
+    int slot = 0;
+    uint32_t last = 0;
+    for (size_t i = 0; i < n; i++) {
+      int code = (data[i / 2] >> (4 * (i % 2))) & 15;
+      uint32_t v;
+      if (code == 0) {
+        v = next++;
+      } else if (code < 15) {
+        v = ring[code - 1];
+      } else {
+        uint32_t z = 0;
+        for (int shift = 0;; shift += 7) {
+          if (escape == end || shift > 28)
+            return false;
+          unsigned char byte = *escape++;
+          z |= (uint32_t)(byte & 0x7F) << shift;
+          if (byte < 0x80)
+            break;
+        }
+        v = last + ((z >> 1) ^ (0u - (z & 1)));
+        if (v >= next)
+          next = v + 1;
+      }
+      if (v >= vertexCount)
+        return false;
+      if (code == 0 || code == 15) {
+        ring[slot] = v;
+        slot = slot == INDEX_RING - 1 ? 0 : slot + 1;
+      }
+      indices[i] = v;
+      last = v;
+    }
+    return escape == end;
+  }
+
+  // LZ4 in pack-sized chunks, kept raw where they do not shrink; returns
+  // the stored size and keeps each chunk's stored size in front of it
+  static size_t lz4Chunks(const vector<unsigned char> &data,
+                          vector<unsigned char> &out) {
+    const size_t chunk = ASSET_PACK_CHUNK_SIZE;
+    out.clear();
+    size_t stored = 0;
+    for (size_t at = 0; at < data.size(); at += chunk) {
+      int size = (int)(data.size() - at < chunk ? data.size() - at : chunk);
+      vector<unsigned char> packed(Lz4CompressBound(size));
+      int packedSize = Lz4Compress(&data[at], size, &packed[0]);
+      if (packedSize >= size) {
+        packedSize = size;
+        memcpy(&packed[0], &data[at], size);
+      }
+      put32(out, (uint32_t)packedSize);
+      out.insert(out.end(), packed.begin(), packed.begin() + packedSize);
+      stored += packedSize;
+    }
+    return stored;
+  }
+
+  static bool unlz4Chunks(const vector<unsigned char> &packed, size_t size,
+                          vector<unsigned char> &out, int threads) {
+    const size_t chunk = ASSET_PACK_CHUNK_SIZE;
+    size_t chunks = (size + chunk - 1) / chunk;
+    vector<size_t> starts(chunks);
+    for (size_t c = 0, at = 0; c < chunks; c++) {
+      uint32_t stored;
+      memcpy(&stored, &packed[at], 4);
+      starts[c] = at + 4;
+      at += 4 + stored;
+    }
+    out.resize(size);
+    vector<char> ok(chunks, 1);
+    ParallelFor(
+        (int)chunks,
+        [&](int c) {
+          size_t at = (size_t)c * chunk;
+          int bytes = (int)(size - at < chunk ? size - at : chunk);
+          uint32_t stored;
+          memcpy(&stored, &packed[starts[c] - 4], 4);
+          if ((int)stored == bytes)
+            memcpy(&out[at], &packed[starts[c]], bytes);
+          else
+            ok[c] = Lz4Decompress(&packed[starts[c]], stored, &out[at], bytes);
+        },
+        threads, "unpack");
+    for (size_t c = 0; c < chunks; c++)
+      if (!ok[c])
+        return false;
+    return true;
+  }
+
+  static double since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+        .count();
+  }
+  static double ratio(size_t raw, size_t stored) {
+    return stored ? (double)raw / stored : 0.0;
+  }
+  static double gbPerSecond(size_t bytes, double ms) {
+    return ms > 0 ? bytes / (ms * 1e6) : 0.0;
+  }
+};
+
+#endif
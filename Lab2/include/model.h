@@ -7,19 +7,28 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "alloc_tracker.h"
+#include "asset_pack.h"
+#include "assimp_io.h"
+#include "gl_extensions.h"
+#include "gltf_loader.h"
+#include "mesh_codec.h"
+#include "obj_loader.h"
+#include "pipeline_warmup.h"
+#include "profiler.h"
+#include "render_stats.h"
 #include "shaders.h"
+#include "vertex.h"
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <string>
+#include <utility>
 #include <vector>
 #include <iostream>
 
 using namespace std;
 
-struct Vertex
-{
-  glm::vec3 Position;
-  glm::vec3 Normal;
-};
-
 class Mesh
 {
 public:
@@ -29,21 +38,123 @@ public:
 
   Mesh(vector<Vertex> vertices, vector<unsigned int> indices)
   {
-    this->vertices = vertices;
-    this->indices = indices;
+    this->vertices.swap(vertices);
+    this->indices.swap(indices);
     setupMesh();
   }
 
   void Draw(Shader &shader)
   {
     glBindVertexArray(VAO);
+    PipelineWarmup::Default().Draw(VAO);
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
+
+    RenderStats &stats = RenderStats::Frame();
+    stats.vaoBinds++;
+    stats.CountDraw(indices.size());
+  }
+
+  // Creation of count meshes (a 64x64 grid each) and count 256^2 cubemaps,
+  // through the 3.3 bind-to-edit calls and through direct state access,
+  // then the CPU cost of each path's per-frame binds over draws draws: two
+  // cubemap units and a vertex array per draw, glActiveTexture plus
+  // glBindTexture against glBindTextureUnit. Needs DirectStateGL::Load().
+  static void BenchmarkDirectState(int count, int draws)
+  {
+    const int grid = 64;
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    for (int y = 0; y <= grid; y++)
+      for (int x = 0; x <= grid; x++)
+      {
+        // a tiny patch, so the draws measure submission, not fill
+        Vertex v;
+        v.Position = glm::vec3(x * 0.0001f, y * 0.0001f, 0.0f);
+        v.Normal = glm::vec3(0.0f, 0.0f, 1.0f);
+        vertices.push_back(v);
+      }
+    for (int y = 0; y < grid; y++)
+      for (int x = 0; x < grid; x++)
+      {
+        unsigned int i = y * (grid + 1) + x;
+        unsigned int quad[6] = {i, i + 1, i + grid + 1, i + 1, i + grid + 2, i + grid + 1};
+        indices.insert(indices.end(), quad, quad + 6);
+      }
+    vector<DecodedImage> faces(6);
+    for (int i = 0; i < 6; i++)
+    {
+      faces[i].width = faces[i].height = 256;
+      faces[i].channels = 3;
+      faces[i].pixels.assign(256 * 256 * 3, (unsigned char)(40 * i));
+      faces[i].ok = true;
+    }
+    const char *faceNames[6] = {"benchmark", "benchmark", "benchmark", "benchmark", "benchmark", "benchmark"};
+
+    Shader shader("shaders/main.vert", "shaders/main.frag");
+    shader.use();
+    bool direct = DirectStateAccess();
+    const char *modes[2] = {"bind-to-edit", "direct state access"};
+    // an untimed first round pays for the driver's first draws and
+    // allocations, which would otherwise land on whichever path runs first
+    for (int round = 0; round < 3; round++)
+    {
+      int mode = round == 0 ? 0 : round - 1;
+      DirectStateAccess() = mode == 1;
+      glFinish();
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      vector<Mesh> meshes;
+      meshes.reserve(count);
+      for (int i = 0; i < count; i++)
+        meshes.push_back(Mesh(vertices, indices));
+      glFinish();
+      double meshMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      start = chrono::steady_clock::now();
+      vector<GLuint> cubemaps;
+      for (int i = 0; i < count; i++)
+        cubemaps.push_back(Shader::CreateCubemap(faces, faceNames));
+      glFinish();
+      double cubemapMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+      start = chrono::steady_clock::now();
+      for (int d = 0; d < draws; d++)
+      {
+        int i = d % count;
+        BindTextureUnit(1, GL_TEXTURE_CUBE_MAP, cubemaps[(i + 1) % count]);
+        BindTextureUnit(0, GL_TEXTURE_CUBE_MAP, cubemaps[i]);
+        glBindVertexArray(meshes[i].VAO);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+      }
+      glFinish();
+      double drawUs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() * 1000.0 / draws;
+
+      if (round > 0)
+        cout << "Resources (" << modes[mode] << "): " << count << " meshes " << meshMs << " ms, " << count
+             << " cubemaps " << cubemapMs << " ms; per draw with binds " << drawUs << " us (" << draws
+             << " draws)" << endl;
+
+      glBindVertexArray(0);
+      for (int i = 0; i < count; i++)
+      {
+        glDeleteVertexArrays(1, &meshes[i].VAO);
+        glDeleteBuffers(1, &meshes[i].VBO);
+        glDeleteBuffers(1, &meshes[i].EBO);
+      }
+      glDeleteTextures(count, &cubemaps[0]);
+    }
+    DirectStateAccess() = direct;
+    glDeleteProgram(shader.ID);
   }
 
 private:
   void setupMesh()
   {
+    if (DirectStateAccess())
+    {
+      setupMeshDirect();
+      return;
+    }
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
@@ -55,6 +166,8 @@ private:
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
 
+    RenderStats::Frame().bufferBytes += vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int);
+
     // Position attribute
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
@@ -65,6 +178,51 @@ private:
 
     glBindVertexArray(0);
   }
+
+  // the same mesh with direct state access: immutable buffers the CPU never
+  // writes again, and a vertex array set up without binding anything
+  void setupMeshDirect()
+  {
+    DirectStateGL &gl = DirectStateGL::Get();
+    gl.CreateBuffers(1, &VBO);
+    gl.CreateBuffers(1, &EBO);
+    // storage cannot be empty, and an empty mesh draws nothing anyway
+    if (!vertices.empty())
+      gl.NamedBufferStorage(VBO, vertices.size() * sizeof(Vertex), &vertices[0], 0);
+    if (!indices.empty())
+      gl.NamedBufferStorage(EBO, indices.size() * sizeof(unsigned int), &indices[0], 0);
+
+    RenderStats::Frame().bufferBytes += vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int);
+
+    gl.CreateVertexArrays(1, &VAO);
+    gl.VertexArrayVertexBuffer(VAO, 0, VBO, 0, sizeof(Vertex));
+    gl.VertexArrayElementBuffer(VAO, EBO);
+
+    // Position attribute
+    gl.EnableVertexArrayAttrib(VAO, 0);
+    gl.VertexArrayAttribFormat(VAO, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    gl.VertexArrayAttribBinding(VAO, 0, 0);
+
+    // Normal attribute
+    gl.EnableVertexArrayAttrib(VAO, 1);
+    gl.VertexArrayAttribFormat(VAO, 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+    gl.VertexArrayAttribBinding(VAO, 1, 0);
+  }
+};
+
+// vertices and indices of one mesh, not yet uploaded
+struct MeshData
+{
+  vector<Vertex> vertices;
+  vector<unsigned int> indices;
+};
+
+// what Model::Load() prepares for the GL thread
+struct ModelSource
+{
+  string path;
+  vector<MeshData> meshes;
+  bool loaded = false; // false: nothing loaded yet, or a glTF file
 };
 
 class Model
@@ -72,53 +230,339 @@ class Model
 public:
   Model(const char *path)
   {
-    loadModel(path);
+    PROFILE_SCOPE_DYNAMIC(string("Model ") + path);
+    ModelSource source;
+    Load(path, source);
+    upload(source);
+  }
+
+  // uploads what Load() prepared, taking its meshes; needs the GL context
+  explicit Model(ModelSource &source)
+  {
+    PROFILE_SCOPE_DYNAMIC("Model " + source.path);
+    upload(source);
+  }
+
+  // The CPU half of loading: meshes from a baked pack entry, the native OBJ
+  // loader or Assimp. Needs no GL context, so startup runs it on a worker
+  // while the window comes up. glTF files are left to the GL thread, as
+  // their direct path is nearly all upload.
+  static void Load(const string &path, ModelSource &source)
+  {
+    PROFILE_SCOPE_DYNAMIC("Model::Load " + path);
+    source.path = path;
+    source.meshes.clear();
+    source.loaded = false;
+    // a baked mesh in the open asset pack skips Assimp; model sources in
+    // the pack are imported from it
+    const AssetPack &pack = AssetPack::Default();
+    const AssetEntry *entry = pack.IsOpen() ? pack.Find(path) : NULL;
+    vector<unsigned char> blob;
+    if (entry && entry->type == ASSET_MESH && pack.Read(path, blob) &&
+        loadBaked(blob, source.meshes))
+      source.loaded = true;
+    else if (NativeObjLoader() && HasObjExtension(path) && loadObj(path, source.meshes))
+      source.loaded = true;
+    else if (!(NativeGltfLoader() && HasGltfExtension(path)))
+      source.loaded = importModel(path, source.meshes);
+  }
+
+  // Engine-ready mesh data for asset packs: "MSHZ", u32 mesh count, then
+  // per mesh u32 vertex and index counts, the byte sizes of its vertex and
+  // index streams and the streams themselves, compressed with MeshCodec.
+  // Needs no GL context.
+  static bool Bake(const string &path, vector<unsigned char> &blob)
+  {
+    uint32_t count = 0;
+    blob.assign(bakedMagic(), bakedMagic() + 4);
+    blob.resize(8);
+    bool ok = forEachSourceMesh(path, [&](const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+                                {
+                                  appendBakedMesh(vertices, indices, blob);
+                                  count++;
+                                });
+    memcpy(&blob[4], &count, 4);
+    return ok;
+  }
+
+  // Compression ratio and decode speed of the baked form of each mesh in
+  // a model file.
+  static void BenchmarkCodec(const string &path, int threads)
+  {
+    int m = 0;
+    if (!forEachSourceMesh(path, [&](const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+                           {
+                             if (vertices.empty())
+                               return;
+                             MeshCodec::Benchmark(path + " mesh " + to_string(m++), &vertices[0],
+                                                  vertices.size(), sizeof(Vertex), indices.data(),
+                                                  indices.size(), threads);
+                           }))
+      cout << "ERROR::MESH_CODEC::CANNOT_LOAD " << path << endl;
+  }
+
+  // Times the native OBJ loader against Assimp on the same file.
+  static void BenchmarkObj(const string &path, int threads)
+  {
+    ObjLoader::Benchmark(path, threads);
+
+    struct stat st;
+    double mb = stat(path.c_str(), &st) == 0 ? st.st_size / 1048576.0 : 0.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(path, IMPORT_FLAGS);
+    size_t vertexCount = 0, triangles = 0;
+    vector<aiMesh *> order;
+    if (scene && scene->mRootNode)
+      collectMeshes(scene->mRootNode, scene, order);
+    for (size_t m = 0; m < order.size(); m++)
+    {
+      vector<Vertex> vertices;
+      vector<unsigned int> indices;
+      extractMesh(order[m], vertices, indices);
+      vertexCount += vertices.size();
+      triangles += indices.size() / 3;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (!scene)
+      cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
+    else
+      cout << "Assimp " << path << ": " << vertexCount << " vertices, " << triangles
+           << " triangles, " << ms << " ms (" << mb / (ms / 1000.0) << " MB/s)" << endl;
   }
 
   void Draw(Shader &shader)
   {
     for (unsigned int i = 0; i < meshes.size(); i++)
       meshes[i].Draw(shader);
+    for (unsigned int i = 0; i < primitives.size(); i++)
+      primitives[i].Draw();
+  }
+
+  // registers the VAOs for the pipeline warm-up: meshes share the Vertex
+  // layout, glTF primitives are told apart by draw mode and indexing only
+  void AddVertexArrays(PipelineWarmup &warmup) const
+  {
+    for (size_t i = 0; i < meshes.size(); i++)
+      warmup.AddVertexArray("Vertex", meshes[i].VAO, (GLsizei)meshes[i].indices.size(),
+                            GL_TRIANGLES, GL_UNSIGNED_INT);
+    for (size_t i = 0; i < primitives.size(); i++)
+    {
+      const GltfPrimitive &p = primitives[i];
+      warmup.AddVertexArray("glTF mode " + to_string(p.mode) + (p.indexType ? " indexed" : ""),
+                            p.VAO, p.count, p.mode, p.indexType, p.indexOffset);
+    }
   }
 
 private:
+  static const unsigned int IMPORT_FLAGS =
+      aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_CalcTangentSpace;
+  static const char *bakedMagic() { return "MSHZ"; }
+
   vector<Mesh> meshes;
+  vector<GltfPrimitive> primitives; // glTF files, drawn from their buffers
+  vector<GLuint> buffers;           // owned by primitives
   string directory;
 
-  void loadModel(string path)
+  // GL half of loading; glTF files are loaded here, falling back to Assimp
+  void upload(ModelSource &source)
+  {
+    const string &path = source.path;
+    if (!source.loaded && NativeGltfLoader() && HasGltfExtension(path))
+    {
+      if (loadGltf(path))
+        return;
+      source.loaded = importModel(path, source.meshes);
+    }
+    if (!source.loaded)
+      return;
+
+    PROFILE_SCOPE("upload");
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    directory = path.substr(0, path.find_last_of('/'));
+    for (size_t m = 0; m < source.meshes.size(); m++)
+      meshes.push_back(Mesh(move(source.meshes[m].vertices), move(source.meshes[m].indices)));
+    source.meshes.clear();
+    cout << "Model " << path << " uploaded in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (" << meshes.size() << " meshes)" << endl;
+  }
+
+  static bool importModel(const string &path, vector<MeshData> &out)
   {
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path,
-                                             aiProcess_Triangulate | aiProcess_GenNormals | aiProcess_CalcTangentSpace);
+    AssimpIOStats io;
+    importer.SetIOHandler(new MappedIOSystem(AssetPack::Default(), &io));
+    const aiScene *scene;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long heapBefore = AllocTracker::Total().bytes;
+    {
+      PROFILE_SCOPE("Assimp::ReadFile");
+      scene = importer.ReadFile(path, IMPORT_FLAGS);
+    }
+    cout << "Model " << path << " imported in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (" << io.files << " files, " << io.bytes / 1024 << " KB, "
+         << io.fromPack << " from the asset pack, " << io.prefetched
+         << " prefetched)" << endl;
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
     {
       cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
-      return;
+      return false;
     }
+
+    PROFILE_SCOPE("extract meshes");
+    vector<aiMesh *> order;
+    collectMeshes(scene->mRootNode, scene, order);
+    out.resize(order.size());
+    for (size_t m = 0; m < order.size(); m++)
+      extractMesh(order[m], out[m].vertices, out[m].indices);
+    cout << "Model " << path << " ready in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (" << (AllocTracker::Total().bytes - heapBefore) / 1024
+         << " KB heap allocated, peak RSS " << AllocTracker::PeakResidentKB()
+         << " KB)" << endl;
+    return true;
+  }
+
+  // glTF buffer views go to GL as they are stored; see gltf_loader.h
+  bool loadGltf(const string &path)
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    unsigned long heapBefore = AllocTracker::Total().bytes;
+    GltfLoader::Stats stats;
+    if (!GltfLoader::Load(path, primitives, buffers, &stats))
+      return false;
+    cout << "Model " << path << " ready in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (native glTF, " << stats.primitives << " primitives, "
+         << stats.uploadedBytes / 1024 << " KB uploaded from "
+         << stats.fileBytes / 1024 << " KB mapped, "
+         << (AllocTracker::Total().bytes - heapBefore) / 1024
+         << " KB heap allocated, peak RSS " << AllocTracker::PeakResidentKB()
+         << " KB)" << endl;
     directory = path.substr(0, path.find_last_of('/'));
+    return true;
+  }
 
-    processNode(scene->mRootNode, scene);
+  static bool loadObj(const string &path, vector<MeshData> &out)
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    out.resize(1);
+    if (!ObjLoader::Load(path, out[0].vertices, out[0].indices))
+    {
+      out.clear();
+      return false;
+    }
+    cout << "Model " << path << " loaded in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (native OBJ, " << out[0].vertices.size() << " vertices, "
+         << out[0].indices.size() / 3 << " triangles)" << endl;
+    return true;
   }
 
-  void processNode(aiNode *node, const aiScene *scene)
+  // Calls fn with the vertices and indices of every mesh in a model file:
+  // the native OBJ loader's single mesh, or Assimp's in collectMeshes order.
+  static bool forEachSourceMesh(const string &path,
+                                const function<void(const vector<Vertex> &, const vector<unsigned int> &)> &fn)
   {
-    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    if (NativeObjLoader() && HasObjExtension(path) &&
+        ObjLoader::Load(path, vertices, indices))
     {
-      aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(processMesh(mesh, scene));
+      fn(vertices, indices);
+      return true;
     }
-    for (unsigned int i = 0; i < node->mNumChildren; i++)
+
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(path, IMPORT_FLAGS);
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
     {
-      processNode(node->mChildren[i], scene);
+      cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
+      return false;
     }
+
+    vector<aiMesh *> order;
+    collectMeshes(scene->mRootNode, scene, order);
+    for (size_t m = 0; m < order.size(); m++)
+    {
+      vertices.clear();
+      indices.clear();
+      extractMesh(order[m], vertices, indices);
+      fn(vertices, indices);
+    }
+    return true;
   }
 
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+  static void appendBakedMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+                              vector<unsigned char> &blob)
   {
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    uint32_t header[4] = {(uint32_t)vertices.size(), (uint32_t)indices.size(), 0, 0};
+    size_t at = blob.size();
+    blob.resize(at + sizeof(header));
+    MeshCodec::EncodeVertices(vertices.data(), vertices.size(), sizeof(Vertex), blob);
+    header[2] = (uint32_t)(blob.size() - at - sizeof(header));
+    MeshCodec::EncodeIndices(indices.data(), indices.size(), blob);
+    header[3] = (uint32_t)(blob.size() - at - sizeof(header) - header[2]);
+    memcpy(&blob[at], header, sizeof(header));
+  }
 
+  static bool loadBaked(const vector<unsigned char> &blob, vector<MeshData> &out)
+  {
+    PROFILE_SCOPE("loadBaked");
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    size_t at = 8, vertexTotal = 0, triangles = 0;
+    uint32_t count;
+    if (blob.size() < at || memcmp(&blob[0], bakedMagic(), 4) != 0)
+      return false;
+    memcpy(&count, &blob[4], 4);
+    if (count > (blob.size() - at) / 16) // each mesh has a 16-byte header
+      return false;
+    vector<MeshData> baked(count);
+    for (uint32_t m = 0; m < count; m++)
+    {
+      uint32_t header[4];
+      if (blob.size() - at < sizeof(header))
+        return false;
+      memcpy(header, &blob[at], sizeof(header));
+      at += sizeof(header);
+      if (blob.size() - at < (size_t)header[2] + header[3])
+        return false;
+      vector<Vertex> &vertices = baked[m].vertices;
+      vector<unsigned int> &indices = baked[m].indices;
+      vertices.resize(header[0]);
+      indices.resize(header[1]);
+      if (!MeshCodec::DecodeVertices(&blob[at], header[2], vertices.data(), header[0], sizeof(Vertex)) ||
+          !MeshCodec::DecodeIndices(&blob[at + header[2]], header[3], indices.data(), header[1], header[0]))
+      {
+        cout << "ERROR::MODEL::CORRUPT_BAKED_MESH " << m << endl;
+        return false;
+      }
+      at += (size_t)header[2] + header[3];
+      vertexTotal += vertices.size();
+      triangles += indices.size() / 3;
+    }
+    out.swap(baked);
+    cout << "Model loaded from the asset pack in "
+         << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+         << " ms (" << vertexTotal << " vertices, " << triangles << " triangles, "
+         << blob.size() / 1024 << " KB baked)" << endl;
+    return true;
+  }
+
+  // meshes in node order, depth first
+  static void collectMeshes(aiNode *node, const aiScene *scene, vector<aiMesh *> &order)
+  {
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+      order.push_back(scene->mMeshes[node->mMeshes[i]]);
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+      collectMeshes(node->mChildren[i], scene, order);
+  }
+
+  static void extractMesh(aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices)
+  {
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
       Vertex vertex;
@@ -138,8 +582,6 @@ private:
       for (unsigned int j = 0; j < face.mNumIndices; j++)
         indices.push_back(face.mIndices[j]);
     }
-
-    return Mesh(vertices, indices);
   }
 };
 
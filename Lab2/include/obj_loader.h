@@ -0,0 +1,562 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "async_io.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "profiler.h"
+#include "vertex.h"
+
+using namespace std;
+
+// Wavefront OBJ reader for Model, for the large scanned meshes Assimp's
+// general-purpose importer is slow on. The file is split into line-aligned
+// chunks that are parsed in parallel; faces are fan-triangulated and every
+// chunk deduplicates its own position/normal pairs, so only the (much
+// shorter) lists of unique pairs are merged serially. The result matches
+// Model's Assimp flags: triangles, and flat normals where the file has none.
+// Only geometry is read: Model draws without materials or texture
+// coordinates, so mtllib/usemtl, groups and vt are skipped.
+
+inline bool &NativeObjLoader() {
+  static bool enabled = true;
+  return enabled;
+}
+
+inline bool HasObjExtension(const string &path) {
+  size_t dot = path.find_last_of('.');
+  if (dot == string::npos || path.size() - dot != 4)
+    return false;
+  return tolower(path[dot + 1]) == 'o' && tolower(path[dot + 2]) == 'b' &&
+         tolower(path[dot + 3]) == 'j';
+}
+
+inline bool ObjIsDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Eight ASCII digits to their value in a few multiplies (SWAR), when all
+// eight bytes are digits. Little-endian only; elsewhere digits go one by one.
+inline bool ObjParse8Digits(const char *p, uint64_t &value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v;
+  memcpy(&v, p, 8);
+  if ((((v & 0xF0F0F0F0F0F0F0F0ull) |
+        (((v + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) !=
+       0x3333333333333333ull))
+    return false;
+  v -= 0x3030303030303030ull;
+  v = (v * 10) + (v >> 8);
+  value = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+           (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >>
+          32;
+  return true;
+#else
+  (void)p;
+  (void)value;
+  return false;
+#endif
+}
+
+// Up to 19 significant digits into a u64; the rest only move the exponent.
+inline const char *ObjParseDigits(const char *p, const char *end,
+                                  uint64_t &mantissa, int &digits,
+                                  int &dropped) {
+  while (end - p >= 8 && digits <= 11) {
+    uint64_t eight;
+    if (!ObjParse8Digits(p, eight))
+      break;
+    mantissa = mantissa * 100000000ull + eight;
+    digits += mantissa ? 8 : 0;
+    p += 8;
+  }
+  for (; p < end && ObjIsDigit(*p); p++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+      digits += mantissa ? 1 : 0;
+    } else {
+      dropped++;
+    }
+  }
+  return p;
+}
+
+// Parses a float like strtof for the forms OBJ exporters write (no hex,
+// inf or nan). Exact for up to 15 significant digits and exponents within
+// +-22, and within one float ulp beyond. Returns NULL when there is no
+// number.
+inline const char *ObjParseFloat(const char *p, const char *end, float &out) {
+  static const double POW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  const char *start = p;
+  uint64_t mantissa = 0;
+  int digits = 0, dropped = 0;
+  p = ObjParseDigits(p, end, mantissa, digits, dropped);
+  int exponent = dropped;
+  if (p < end && *p == '.') {
+    const char *fraction = ++p;
+    int fractionDropped = 0;
+    p = ObjParseDigits(p, end, mantissa, digits, fractionDropped);
+    exponent -= (int)(p - fraction) - fractionDropped;
+  }
+  if (p == start || (p == start + 1 && *start == '.'))
+    return NULL;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    bool negativeExp = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      negativeExp = *e++ == '-';
+    if (e < end && ObjIsDigit(*e)) {
+      int value = 0;
+      for (; e < end && ObjIsDigit(*e); e++)
+        value = value < 10000 ? value * 10 + (*e - '0') : value;
+      exponent += negativeExp ? -value : value;
+      p = e;
+    }
+  }
+  double value = (double)mantissa;
+  if (exponent >= -22 && exponent <= 22)
+    value = exponent < 0 ? value / POW10[-exponent] : value * POW10[exponent];
+  else
+    value *= pow(10.0, exponent);
+  out = (float)(negative ? -value : value);
+  return p;
+}
+
+inline const char *ObjParseInt(const char *p, const char *end, int &out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  const char *start = p;
+  long long value = 0;
+  for (; p < end && ObjIsDigit(*p); p++)
+    value = value < INT_MAX ? value * 10 + (*p - '0') : value;
+  if (p == start)
+    return NULL;
+  if (value > INT_MAX)
+    value = INT_MAX;
+  out = (int)(negative ? -value : value);
+  return p;
+}
+
+class ObjLoader {
+public:
+  // no normal on this corner: the triangle's face normal is used
+  enum { NO_NORMAL = INT_MIN };
+
+  // Loads path into one deduplicated triangle mesh. The bytes come from the
+  // prefetched files, a raw asset pack entry or a memory mapping, in that
+  // order. threads 0 uses every core.
+  static bool Load(const string &path, vector<Vertex> &vertices,
+                   vector<unsigned int> &indices, int threads = 0) {
+    PROFILE_SCOPE("ObjLoader::Load");
+    AssetBytes bytes;
+    if (!bytes.Open(path)) {
+      cout << "ERROR::OBJ::CANNOT_OPEN " << path << endl;
+      return false;
+    }
+    const char *data = (const char *)bytes.Data();
+    size_t size = bytes.Size();
+    bool ok = Parse(data, size, vertices, indices, threads);
+    if (!ok)
+      cout << "ERROR::OBJ::NO_VALID_MESH " << path << endl;
+    return ok;
+  }
+
+  // Parses OBJ text. False when a face refers to a missing position or
+  // normal, or nothing but an empty mesh is found.
+  static bool Parse(const char *data, size_t size, vector<Vertex> &vertices,
+                    vector<unsigned int> &indices, int threads = 0) {
+    if (threads <= 0)
+      threads = HardwareThreads();
+    vector<Chunk> chunks;
+    split(data, size, threads, chunks);
+    int count = (int)chunks.size();
+
+    {
+      PROFILE_SCOPE("parse");
+      ParallelFor(count, [&](int c) { parseChunk(chunks[c]); }, threads,
+                  "obj parse");
+    }
+
+    // global numbering of positions and normals, then relative indices
+    size_t positionCount = 0, normalCount = 0;
+    for (int c = 0; c < count; c++) {
+      chunks[c].firstPosition = positionCount;
+      chunks[c].firstNormal = normalCount;
+      positionCount += chunks[c].positions.size() / 3;
+      normalCount += chunks[c].normals.size() / 3;
+    }
+    if (positionCount > (size_t)INT_MAX || normalCount > (size_t)INT_MAX)
+      return false;
+    vector<float> positions(positionCount * 3), normals(normalCount * 3);
+    ParallelFor(
+        count,
+        [&](int c) {
+          Chunk &chunk = chunks[c];
+          if (!chunk.positions.empty())
+            memcpy(&positions[chunk.firstPosition * 3], &chunk.positions[0],
+                   chunk.positions.size() * sizeof(float));
+          if (!chunk.normals.empty())
+            memcpy(&normals[chunk.firstNormal * 3], &chunk.normals[0],
+                   chunk.normals.size() * sizeof(float));
+          vector<float>().swap(chunk.positions);
+          vector<float>().swap(chunk.normals);
+          for (size_t i = 0; i < chunk.relative.size(); i++) {
+            size_t at = chunk.relative[i];
+            chunk.corners[at] += at % 2 ? (int)chunk.firstNormal
+                                        : (int)chunk.firstPosition;
+          }
+        },
+        threads, "obj gather");
+
+    // faces may use positions of any chunk, so this waits for the gather
+    bool valid = true;
+    {
+      PROFILE_SCOPE("dedup");
+      vector<char> chunkValid(count, 1);
+      ParallelFor(
+          count,
+          [&](int c) {
+            chunkValid[c] = dedupChunk(chunks[c], positions,
+                                       (int)positionCount, (int)normalCount);
+          },
+          threads, "obj dedup");
+      for (int c = 0; c < count; c++)
+        valid = valid && chunkValid[c];
+    }
+    if (!valid)
+      return false;
+
+    // serial merge of each chunk's unique pairs
+    size_t uniqueCount = 0, cornerCount = 0;
+    for (int c = 0; c < count; c++) {
+      uniqueCount += chunks[c].keys.size() / 2;
+      cornerCount += chunks[c].local.size();
+    }
+    if (uniqueCount > UINT_MAX)
+      return false;
+    {
+      PROFILE_SCOPE("merge");
+      vertices.clear();
+      vertices.reserve(uniqueCount);
+      KeyTable table(uniqueCount);
+      for (int c = 0; c < count; c++) {
+        Chunk &chunk = chunks[c];
+        size_t unique = chunk.keys.size() / 2;
+        chunk.remap.resize(unique);
+        for (size_t u = 0; u < unique; u++) {
+          int v = chunk.keys[u * 2], n = chunk.keys[u * 2 + 1];
+          unsigned int id = (unsigned int)vertices.size();
+          if (n >= 0) { // flat corners are unique by construction
+            unsigned int *slot = table.Insert(key(v, n), id);
+            if (*slot != id) {
+              chunk.remap[u] = *slot;
+              continue;
+            }
+          }
+          const float *p = &positions[(size_t)v * 3];
+          const float *nrm = n >= 0 ? &normals[(size_t)n * 3]
+                                    : &chunk.flatNormals[(size_t)(-n - 1) * 3];
+          Vertex vertex;
+          vertex.Position = glm::vec3(p[0], p[1], p[2]);
+          vertex.Normal = glm::vec3(nrm[0], nrm[1], nrm[2]);
+          vertices.push_back(vertex);
+          chunk.remap[u] = id;
+        }
+      }
+    }
+
+    {
+      PROFILE_SCOPE("indices");
+      indices.resize(cornerCount);
+      size_t at = 0;
+      for (int c = 0; c < count; c++) {
+        chunks[c].firstIndex = at;
+        at += chunks[c].local.size();
+      }
+      ParallelFor(
+          count,
+          [&](int c) {
+            const Chunk &chunk = chunks[c];
+            for (size_t i = 0; i < chunk.local.size(); i++)
+              indices[chunk.firstIndex + i] = chunk.remap[chunk.local[i]];
+          },
+          threads, "obj indices");
+    }
+    return !indices.empty();
+  }
+
+  // Times Parse on the mapped file, best of repeats; the first run warms
+  // the page cache, so MB/s excludes disk reads.
+  static void Benchmark(const string &path, int threads = 0,
+                        int repeats = 3) {
+    MappedFile file;
+    if (!file.Open(path) || !file.Size()) {
+      cout << "ERROR::OBJ::CANNOT_OPEN " << path << endl;
+      return;
+    }
+    double best = 1e30;
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    for (int r = 0; r < repeats; r++) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      Parse((const char *)file.Data(), file.Size(), vertices, indices,
+            threads);
+      double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                  start)
+                      .count();
+      best = ms < best ? ms : best;
+    }
+    double mb = file.Size() / 1048576.0;
+    cout << "ObjLoader " << path << ": " << mb << " MB, "
+         << vertices.size() << " vertices, " << indices.size() / 3
+         << " triangles, " << best << " ms (" << mb / (best / 1000.0)
+         << " MB/s, " << (threads > 0 ? threads : HardwareThreads())
+         << " threads)" << endl;
+  }
+
+private:
+  struct Chunk {
+    const char *begin, *end;
+    vector<float> positions, normals;
+    vector<int> corners;     // position and normal index per corner
+    vector<size_t> relative; // corners entries still relative to the chunk
+    size_t firstPosition, firstNormal, firstIndex;
+    // filled by dedupChunk
+    vector<int> keys; // unique (position, normal) pairs; normal < 0 is flat
+    vector<float> flatNormals;
+    vector<unsigned int> local; // per corner, into keys
+    vector<unsigned int> remap; // keys to global vertices
+  };
+
+  // open addressing over (position, normal) keys, stored plus one so that
+  // 0 marks an empty slot
+  struct KeyTable {
+    vector<uint64_t> keys;
+    vector<unsigned int> values;
+    size_t mask;
+
+    explicit KeyTable(size_t expected) {
+      size_t size = 16;
+      while (size < expected * 2)
+        size *= 2;
+      keys.assign(size, 0);
+      values.resize(size);
+      mask = size - 1;
+    }
+
+    // the value stored for k, after storing value if k was new
+    unsigned int *Insert(uint64_t k, unsigned int value) {
+      k++;
+      size_t i = (size_t)((k * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+      while (keys[i] != 0 && keys[i] != k)
+        i = (i + 1) & mask;
+      if (keys[i] == 0) {
+        keys[i] = k;
+        values[i] = value;
+      }
+      return &values[i];
+    }
+  };
+
+  static uint64_t key(int v, int n) {
+    return ((uint64_t)(uint32_t)v << 32) | (uint32_t)n;
+  }
+
+  // line-aligned chunks of at least 1 MB, several per thread so uneven
+  // chunks balance out
+  static void split(const char *data, size_t size, int threads,
+                    vector<Chunk> &chunks) {
+    size_t count = size / (1 << 20);
+    size_t most = (size_t)threads * 8;
+    count = count < 1 ? 1 : count > most ? most : count;
+    const char *end = data + size;
+    const char *begin = data;
+    for (size_t c = 1; c <= count && begin < end; c++) {
+      const char *cut = c == count ? end : data + size * c / count;
+      if (cut < begin)
+        continue;
+      if (cut < end) {
+        const char *newline = (const char *)memchr(cut, '\n', end - cut);
+        cut = newline ? newline + 1 : end;
+      }
+      chunks.push_back(Chunk());
+      chunks.back().begin = begin;
+      chunks.back().end = cut;
+      begin = cut;
+    }
+  }
+
+  static const char *skipSpaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    return p;
+  }
+
+  static void parseChunk(Chunk &chunk) {
+    const char *p = chunk.begin, *end = chunk.end;
+    size_t bytes = end - p;
+    chunk.positions.reserve(bytes / 12);
+    chunk.corners.reserve(bytes / 4);
+    vector<int> face;
+    while (p < end) {
+      const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+      if (!lineEnd)
+        lineEnd = end;
+      p = skipSpaces(p, lineEnd);
+      if (lineEnd - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        parseFloats(p + 2, lineEnd, chunk.positions);
+      else if (lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' &&
+               (p[2] == ' ' || p[2] == '\t'))
+        parseFloats(p + 3, lineEnd, chunk.normals);
+      else if (lineEnd - p >= 2 && p[0] == 'f' &&
+               (p[1] == ' ' || p[1] == '\t'))
+        parseFace(p + 2, lineEnd, chunk, face);
+      p = lineEnd + 1;
+    }
+  }
+
+  // three floats; a missing one reads as 0, and "v x y z w" drops w
+  static void parseFloats(const char *p, const char *end,
+                          vector<float> &out) {
+    for (int i = 0; i < 3; i++) {
+      float value = 0.0f;
+      p = skipSpaces(p, end);
+      const char *next = ObjParseFloat(p, end, value);
+      if (next)
+        p = next;
+      out.push_back(value);
+    }
+  }
+
+  // "v", "v/t", "v//n" or "v/t/n" corners, fan-triangulated
+  static void parseFace(const char *p, const char *end, Chunk &chunk,
+                        vector<int> &face) {
+    face.clear();
+    int positions = (int)(chunk.positions.size() / 3);
+    int normals = (int)(chunk.normals.size() / 3);
+    for (;;) {
+      p = skipSpaces(p, end);
+      if (p >= end || *p == '\r' || *p == '#')
+        break;
+      int v = 0, t = 0, n = 0;
+      const char *next = ObjParseInt(p, end, v);
+      if (!next)
+        break;
+      p = next;
+      if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/' && (next = ObjParseInt(p, end, t)))
+          p = next;
+        if (p < end && *p == '/') {
+          p++;
+          if ((next = ObjParseInt(p, end, n)))
+            p = next;
+        }
+      }
+      while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        p++; // anything malformed after the corner
+      // 1-based, or negative from the end of the list so far
+      face.push_back(v > 0 ? v - 1 : v < 0 ? positions + v : INT_MAX);
+      face.push_back(n > 0 ? n - 1 : n < 0 ? normals + n : NO_NORMAL);
+      face.push_back((v < 0 ? 1 : 0) | (n < 0 ? 2 : 0));
+    }
+    int corners = (int)face.size() / 3;
+    for (int k = 1; k + 1 < corners; k++) {
+      const int fan[3] = {0, k, k + 1};
+      for (int i = 0; i < 3; i++) {
+        const int *corner = &face[fan[i] * 3];
+        size_t at = chunk.corners.size();
+        if (corner[2] & 1)
+          chunk.relative.push_back(at);
+        if (corner[2] & 2)
+          chunk.relative.push_back(at + 1);
+        chunk.corners.push_back(corner[0]);
+        chunk.corners.push_back(corner[1]);
+      }
+    }
+  }
+
+  // Numbers the chunk's unique (position, normal) pairs in first-use order.
+  // Corners without a normal get their triangle's face normal and a vertex
+  // of their own, as aiProcess_GenNormals does.
+  static bool dedupChunk(Chunk &chunk, const vector<float> &positions,
+                         int positionCount, int normalCount) {
+    size_t cornerCount = chunk.corners.size() / 2;
+    chunk.local.resize(cornerCount);
+    chunk.keys.reserve(cornerCount);
+    KeyTable table(cornerCount / 2 + 1);
+    for (size_t tri = 0; tri < cornerCount / 3; tri++) {
+      const int *c = &chunk.corners[tri * 6];
+      bool flat = false;
+      for (int i = 0; i < 3; i++) {
+        int v = c[i * 2], n = c[i * 2 + 1];
+        if (v < 0 || v >= positionCount ||
+            (n != NO_NORMAL && (n < 0 || n >= normalCount)))
+          return false;
+        flat = flat || n == NO_NORMAL;
+      }
+      int flatIndex = 0;
+      if (flat) {
+        flatIndex = (int)(chunk.flatNormals.size() / 3);
+        faceNormal(&positions[(size_t)c[0] * 3], &positions[(size_t)c[2] * 3],
+                   &positions[(size_t)c[4] * 3], chunk.flatNormals);
+      }
+      for (int i = 0; i < 3; i++) {
+        int v = c[i * 2], n = c[i * 2 + 1];
+        unsigned int id = (unsigned int)(chunk.keys.size() / 2);
+        if (n != NO_NORMAL) {
+          unsigned int *slot = table.Insert(key(v, n), id);
+          if (*slot != id) {
+            chunk.local[tri * 3 + i] = *slot;
+            continue;
+          }
+        } else {
+          n = -flatIndex - 1;
+        }
+        chunk.keys.push_back(v);
+        chunk.keys.push_back(n);
+        chunk.local[tri * 3 + i] = id;
+      }
+    }
+    vector<int>().swap(chunk.corners);
+    vector<size_t>().swap(chunk.relative);
+    return true;
+  }
+
+  static void faceNormal(const float *a, const float *b, const float *c,
+                         vector<float> &out) {
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0]};
+    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0.0f) {
+      out.push_back(n[0] / length);
+      out.push_back(n[1] / length);
+      out.push_back(n[2] / length);
+    } else { // degenerate triangle
+      out.push_back(0.0f);
+      out.push_back(1.0f);
+      out.push_back(0.0f);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PERF_OVERLAY_H
+#define PERF_OVERLAY_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+
+#include "alloc_tracker.h"
+#include "gpu_timer.h"
+#include "imgui.h"
+#include "render_stats.h"
+
+// mean and max over a GpuPassTimer history, skipping frames with no data
+inline void HistoryStats(const float *values, float &mean, float &max) {
+  float sum = 0.0f;
+  int count = 0;
+  max = 0.0f;
+  for (int i = 0; i < GpuPassTimer::HISTORY; i++) {
+    if (values[i] <= 0.0f)
+      continue;
+    sum += values[i];
+    max = std::max(max, values[i]);
+    count++;
+  }
+  mean = count ? sum / count : 0.0f;
+}
+
+// frame-time plot with a red marker on every frame slower than
+// spikeFactor times the median
+inline void PlotFrameTimes(const char *label, const float *values, int offset,
+                           float spikeFactor) {
+  float sorted[GpuPassTimer::HISTORY];
+  std::copy(values, values + GpuPassTimer::HISTORY, sorted);
+  std::nth_element(sorted, sorted + GpuPassTimer::HISTORY / 2,
+                   sorted + GpuPassTimer::HISTORY);
+  float median = sorted[GpuPassTimer::HISTORY / 2];
+
+  float mean, max;
+  HistoryStats(values, mean, max);
+  char overlay[64];
+  snprintf(overlay, sizeof(overlay), "%s  avg %.2f ms  max %.2f ms", label,
+           mean, max);
+
+  float top = std::max(max * 1.1f, 1.0f);
+  ImGui::PlotLines(label, values, GpuPassTimer::HISTORY, offset, overlay, 0.0f,
+                   top, ImVec2(0, 60));
+
+  if (median <= 0.0f)
+    return;
+
+  // samples are drawn oldest first, starting at offset
+  ImVec2 min = ImGui::GetItemRectMin();
+  ImVec2 rectMax = ImGui::GetItemRectMax();
+  float plotWidth = ImGui::CalcItemWidth();
+  ImDrawList *draw = ImGui::GetWindowDrawList();
+  for (int i = 0; i < GpuPassTimer::HISTORY; i++) {
+    float v = values[(offset + i) % GpuPassTimer::HISTORY];
+    if (v < median * spikeFactor)
+      continue;
+    float x = min.x + plotWidth * (i + 0.5f) / GpuPassTimer::HISTORY;
+    draw->AddLine(ImVec2(x, min.y), ImVec2(x, rectMax.y),
+                  IM_COL32(255, 80, 80, 160));
+  }
+}
+
+// counters of the last completed frame, drawn into the current window
+inline void DrawRenderStats() {
+  if (!ImGui::CollapsingHeader("Render Stats", ImGuiTreeNodeFlags_DefaultOpen))
+    return;
+  const RenderStats &s = RenderStats::Last();
+  ImGui::Text("Draw calls: %lu   Culled: %lu", s.drawCalls, s.culledObjects);
+  ImGui::Text("Triangles: %lu   Vertices: %lu", s.triangles, s.vertices);
+  ImGui::Text("Binds: program %lu  VAO %lu  texture %lu", s.programBinds,
+              s.vaoBinds, s.textureBinds);
+  ImGui::Text("Uniform uploads: %lu", s.uniformUploads);
+  ImGui::Text("Uploaded: %.1f KB this frame, %.1f MB total",
+              s.bufferBytes / 1024.0, RenderStats::Total().bufferBytes / 1048576.0);
+
+  AllocTracker::Counts allocs = AllocTracker::Last();
+  ImGui::Text("Heap allocations: %lu (%lu bytes) last frame",
+              allocs.allocations, allocs.bytes);
+}
+
+// rolling CPU/GPU timings per pass, frame-time graph and histogram
+inline void DrawPerfOverlay(const GpuPassTimer &timer,
+                            float spikeFactor = 2.0f) {
+  ImGui::Begin("Performance");
+
+  // oldest sample sits just after the newest one
+  int offset = (timer.HistoryPos() + 1) % GpuPassTimer::HISTORY;
+
+  PlotFrameTimes("CPU", timer.FrameCpuMs(), offset, spikeFactor);
+  if (timer.Supported())
+    PlotFrameTimes("GPU", timer.FrameGpuMs(), offset, spikeFactor);
+  else
+    ImGui::TextDisabled("GPU timestamps not supported by this driver");
+
+  // histogram of CPU frame times in 0.5 ms buckets
+  const int BINS = 40;
+  float bins[BINS] = {0};
+  const float *cpu = timer.FrameCpuMs();
+  for (int i = 0; i < GpuPassTimer::HISTORY; i++) {
+    if (cpu[i] <= 0.0f)
+      continue;
+    int b = std::min((int)(cpu[i] / 0.5f), BINS - 1);
+    bins[b] += 1.0f;
+  }
+  ImGui::PlotHistogram("Histogram", bins, BINS, 0, "CPU frame time, 0.5 ms bins",
+                       0.0f, FLT_MAX, ImVec2(0, 60));
+
+  if (ImGui::BeginTable("passes", 5, ImGuiTableFlags_Borders)) {
+    ImGui::TableSetupColumn("Pass");
+    ImGui::TableSetupColumn("CPU avg");
+    ImGui::TableSetupColumn("CPU max");
+    ImGui::TableSetupColumn("GPU avg");
+    ImGui::TableSetupColumn("GPU max");
+    ImGui::TableHeadersRow();
+    for (int i = 0; i < timer.PassCount(); i++) {
+      const GpuPassTimer::Pass &p = timer.GetPass(i);
+      float cpuMean, cpuMax, gpuMean, gpuMax;
+      HistoryStats(p.cpuMs, cpuMean, cpuMax);
+      HistoryStats(p.gpuMs, gpuMean, gpuMax);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(p.name);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", cpuMean);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", cpuMax);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", gpuMean);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", gpuMax);
+    }
+    ImGui::EndTable();
+  }
+
+  if (timer.DroppedFrames() > 0)
+    ImGui::Text("Dropped GPU samples: %d", timer.DroppedFrames());
+
+  ImGui::End();
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef PIPELINE_WARMUP_H
+#define PIPELINE_WARMUP_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Drivers finish compiling a program only when it is first drawn with a
+// given vertex layout and render state, so the first frame to use a new
+// combination stalls. Programs, vertex formats and render states are
+// registered here once loaded. Run() draws every combination once into a
+// tiny offscreen target during loading, so the stalls happen there.
+//
+// Shader::use(), Mesh::Draw() and the other draw calls report what they
+// use. After Arm(), EndFrame() logs every frame over budgetMs along with
+// the combinations first drawn in it. A hitch with nothing new comes from
+// something the warm-up does not cover, such as ImGui or texture uploads.
+class PipelineWarmup {
+public:
+  struct State {
+    bool depthTest;
+    GLenum depthFunc;
+    bool depthWrite;
+    bool blend; // straight alpha
+    bool cullBack;
+  };
+
+  float budgetMs = 33.3f; // two frames at 60 Hz
+
+  static PipelineWarmup &Default() {
+    static PipelineWarmup warmup;
+    return warmup;
+  }
+
+  void AddProgram(const string &name, GLuint program) {
+    programs.push_back(make_pair(name, program));
+  }
+
+  // count vertices (or indices) of vao drawn as mode; VAOs with the same
+  // format name share a layout, and only the first one is drawn by Run()
+  void AddVertexArray(const string &format, GLuint vao, GLsizei count,
+                      GLenum mode = GL_TRIANGLES, GLenum indexType = 0,
+                      size_t indexOffset = 0) {
+    int index = -1;
+    for (size_t i = 0; i < formats.size() && index < 0; i++)
+      if (formats[i].name == format)
+        index = (int)i;
+    if (index < 0) {
+      Format f;
+      f.name = format;
+      f.vao = vao;
+      f.count = count < 3 ? count : 3;
+      f.mode = mode;
+      f.indexType = indexType;
+      f.indexOffset = indexOffset;
+      formats.push_back(f);
+      index = (int)formats.size() - 1;
+    }
+    vertexArrays.push_back(make_pair(vao, index));
+  }
+
+  // returns the index to pass to ApplyState()
+  int AddState(const string &name, const State &state) {
+    states.push_back(make_pair(name, state));
+    return (int)states.size() - 1;
+  }
+
+  void ApplyState(int index) {
+    const State &s = states[index].second;
+    if (s.depthTest)
+      glEnable(GL_DEPTH_TEST);
+    else
+      glDisable(GL_DEPTH_TEST);
+    glDepthFunc(s.depthFunc);
+    glDepthMask(s.depthWrite ? GL_TRUE : GL_FALSE);
+    if (s.blend) {
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    } else {
+      glDisable(GL_BLEND);
+    }
+    if (s.cullBack)
+      glEnable(GL_CULL_FACE);
+    else
+      glDisable(GL_CULL_FACE);
+    state = index;
+  }
+
+  void UseProgram(GLuint program) { this->program = program; }
+
+  // called by every draw with the VAO it binds
+  void Draw(GLuint vao) {
+    int format = formatOf(vao);
+    uint64_t key =
+        comboKey(program, format >= 0 ? format : 0x8000 | vao, state);
+    if (seen.insert(key).second && armed)
+      firstUses.push_back(programName(program) + " x " +
+                          (format >= 0 ? formats[format].name
+                                       : "VAO " + to_string(vao)) +
+                          " x " + stateName(state));
+  }
+
+  // Draws every program x vertex format x state into a 4x4 target and waits
+  // for the GPU. Needs a current context; leaves the first state applied.
+  double Run() {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    GLint viewport[4], target;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+    GLuint fbo, color, depth;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 4, 4);
+    // the default framebuffer's formats, which the driver's variants key on
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 4, 4);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    glViewport(0, 0, 4, 4);
+
+    int draws = 0;
+    for (size_t p = 0; p < programs.size(); p++) {
+      glUseProgram(programs[p].second);
+      for (size_t f = 0; f < formats.size(); f++)
+        for (size_t s = 0; s < states.size(); s++) {
+          ApplyState((int)s);
+          const Format &format = formats[f];
+          glBindVertexArray(format.vao);
+          if (format.indexType)
+            glDrawElements(format.mode, format.count, format.indexType,
+                           (void *)format.indexOffset);
+          else
+            glDrawArrays(format.mode, 0, format.count);
+          seen.insert(comboKey(programs[p].second, (int)f, (int)s));
+          draws++;
+        }
+    }
+    glFinish();
+
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+    if (!states.empty())
+      ApplyState(0);
+
+    double ms = elapsedMs(start);
+    cout << "Pipeline warm-up: " << programs.size() << " programs x "
+         << formats.size() << " vertex formats x " << states.size()
+         << " states (" << draws << " draws) in " << ms << " ms" << endl;
+    return ms;
+  }
+
+  // starts hitch detection; frames are timed from here
+  void Arm() {
+    armed = true;
+    firstUses.clear();
+    frameStart = chrono::steady_clock::now();
+    frame = 0;
+  }
+
+  // call once per frame after the buffer swap
+  void EndFrame() {
+    if (!armed)
+      return;
+    double ms = elapsedMs(frameStart);
+    frameStart = chrono::steady_clock::now();
+    frame++;
+    if (ms > budgetMs) {
+      hitches++;
+      cout << "Hitch: frame " << frame << " took " << ms << " ms (budget "
+           << budgetMs << " ms); ";
+      if (firstUses.empty())
+        cout << "nothing drawn for the first time";
+      else
+        cout << "first drawn:";
+      for (size_t i = 0; i < firstUses.size(); i++)
+        cout << (i ? ", " : " ") << firstUses[i];
+      cout << endl;
+    }
+    firstUses.clear();
+  }
+
+  int Hitches() const { return hitches; }
+
+private:
+  struct Format {
+    string name;
+    GLuint vao;
+    GLsizei count;
+    GLenum mode, indexType;
+    size_t indexOffset;
+  };
+
+  vector<pair<string, GLuint>> programs;
+  vector<Format> formats;
+  vector<pair<GLuint, int>> vertexArrays; // VAO, format
+  vector<pair<string, State>> states;
+
+  GLuint program = 0;
+  int state = -1;
+  set<uint64_t> seen; // program, format and state combinations drawn
+  vector<string> firstUses; // this frame's new combinations, once armed
+  bool armed = false;
+  chrono::steady_clock::time_point frameStart;
+  int frame = 0, hitches = 0;
+
+  static uint64_t comboKey(GLuint program, int format, int state) {
+    return ((uint64_t)program << 32) | ((uint64_t)(uint16_t)format << 16) |
+           (uint16_t)(state + 1);
+  }
+
+  static double elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                           since)
+        .count();
+  }
+
+  int formatOf(GLuint vao) const {
+    for (size_t i = 0; i < vertexArrays.size(); i++)
+      if (vertexArrays[i].first == vao)
+        return vertexArrays[i].second;
+    return -1;
+  }
+
+  string programName(GLuint id) const {
+    for (size_t i = 0; i < programs.size(); i++)
+      if (programs[i].second == id)
+        return programs[i].first;
+    return "program " + to_string(id);
+  }
+
+  string stateName(int index) const {
+    return index >= 0 ? states[index].first : "unregistered state";
+  }
+};
+
+#endif
@@ -6,24 +6,86 @@
 
 #include <glad/glad.h>
 
+#include <sys/stat.h>
+
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <sstream>
+#include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "asset_pack.h"
+#include "async_io.h"
+#include "dds.h"
+#include "env_prefilter.h"
+#include "gl_extensions.h"
+#include "hdr_environment.h"
+#include "image_decode.h"
+#include "pipeline_warmup.h"
+#include "profiler.h"
+#include "render_stats.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 using namespace std;
 
+// --sync-shaders: finish every program right after linking it, as the
+// constructor did before compiles were batched
+inline bool &SynchronousShaders() {
+  static bool synchronous = false;
+  return synchronous;
+}
+
+// --original-shaders: load the hand-written GLSL even where the
+// optimize_shaders target has written an optimized copy
+inline bool &UseOptimizedShaders() {
+  static bool use = true;
+  return use;
+}
+
+// dir/optimized/name for dir/name when tools/shader_opt has written it and
+// it is newer than the source, so an edited shader is never shadowed by a
+// stale copy; otherwise path itself
+inline string ShaderSourcePath(const char *path) {
+  string source = path;
+  if (!UseOptimizedShaders())
+    return source;
+  size_t slash = source.find_last_of('/');
+  string optimized = slash == string::npos
+                         ? "optimized/" + source
+                         : source.substr(0, slash + 1) + "optimized/" +
+                               source.substr(slash + 1);
+  struct stat sourceInfo, optimizedInfo;
+  if (stat(optimized.c_str(), &optimizedInfo) != 0 ||
+      stat(path, &sourceInfo) != 0 ||
+      optimizedInfo.st_mtime < sourceInfo.st_mtime)
+    return source;
+  return optimized;
+}
+
 class Shader {
 public:
   // the program ID
   unsigned int ID;
   GLuint cubeMapTexture;
 
-  // constructor reads and builds the shader
+  // Constructor reads the shaders and issues their compile and link without
+  // reading back any status, so creating several programs in a row keeps
+  // them all in flight in the driver (on its own threads with
+  // KHR_parallel_shader_compile). A program is finished, and its errors
+  // printed, when it is first used.
   Shader(const char *vertexPath, const char *fragmentPath) {
+    PROFILE_SCOPE_DYNAMIC(string("Shader ") + vertexPath);
+    string vertexSourcePath = ShaderSourcePath(vertexPath);
+    string fragmentSourcePath = ShaderSourcePath(fragmentPath);
+    vertexPath = vertexSourcePath.c_str();
+    fragmentPath = fragmentSourcePath.c_str();
     string vertexCode;
     string fragmentCode;
     ifstream vShaderFile;
@@ -32,58 +94,74 @@ public:
     vShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
     fShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
 
-    // read shader file
-    try {
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      stringstream vShaderStream, fShaderStream;
+    // read shader files, unless the asset pack or the prefetched files have
+    // both
+    const AssetPack &pack = AssetPack::Default();
+    bool packed = pack.IsOpen() && pack.ReadString(vertexPath, vertexCode) &&
+                  pack.ReadString(fragmentPath, fragmentCode);
+    AsyncFileReader &reader = AsyncFileReader::Default();
+    AsyncFileReader::Buffer vertexFile = reader.Find(vertexPath);
+    AsyncFileReader::Buffer fragmentFile = reader.Find(fragmentPath);
+    if (!packed && vertexFile && fragmentFile) {
+      vertexCode.assign(vertexFile->begin(), vertexFile->end());
+      fragmentCode.assign(fragmentFile->begin(), fragmentFile->end());
+      packed = true;
+    }
+    reader.Release(vertexPath);
+    reader.Release(fragmentPath);
+    if (!packed) {
+      try {
+        vShaderFile.open(vertexPath);
+        fShaderFile.open(fragmentPath);
+        stringstream vShaderStream, fShaderStream;
 
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
+        vShaderStream << vShaderFile.rdbuf();
+        fShaderStream << fShaderFile.rdbuf();
 
-      vShaderFile.close();
-      fShaderFile.close();
+        vShaderFile.close();
+        fShaderFile.close();
 
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (ifstream::failure &e) {
-      cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+        vertexCode = vShaderStream.str();
+        fragmentCode = fShaderStream.str();
+      } catch (ifstream::failure &e) {
+        cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+      }
     }
+    build(vertexCode, fragmentCode);
+  };
 
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
+  // true once the driver has finished compiling and linking; never blocks.
+  // Without KHR_parallel_shader_compile there is no way to ask, so this is
+  // always true and the first use waits instead.
+  bool Ready() const {
+    if (!pending || !HasParallelShaderCompile())
+      return true;
+    GLint done = 0;
+    glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+    return done != 0;
+  }
 
-    // compile shaders
-    unsigned int vertex, fragment;
+  // waits for the program and prints any compile or link errors
+  void Finish() const {
+    if (!pending)
+      return;
+    PROFILE_SCOPE("shader wait");
     int success;
     char infoLog[512];
 
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, nullptr);
-    glCompileShader(vertex);
-
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(vertexStage, GL_COMPILE_STATUS, &success);
     if (!success) {
-      glGetShaderInfoLog(vertex, 512, nullptr, infoLog);
+      glGetShaderInfoLog(vertexStage, 512, nullptr, infoLog);
       cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << endl;
     }
 
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, nullptr);
-    glCompileShader(fragment);
-
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(fragmentStage, GL_COMPILE_STATUS, &success);
     if (!success) {
-      glGetShaderInfoLog(fragment, 512, nullptr, infoLog);
+      glGetShaderInfoLog(fragmentStage, 512, nullptr, infoLog);
       cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n"
            << infoLog << endl;
     }
 
-    ID = glCreateProgram();
-    glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
-    glLinkProgram(ID);
-
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
     if (!success) {
       glGetProgramInfoLog(ID, 512, NULL, infoLog);
@@ -91,75 +169,513 @@ public:
                 << infoLog << std::endl;
     }
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
-  };
+    glDeleteShader(vertexStage);
+    glDeleteShader(fragmentStage);
+    pending = false;
+  }
+
+  // Compile time of the lab's programs plus variants of main.frag, built one
+  // at a time with status checks (the old constructor), all issued before
+  // any is finished, and polled through GL_COMPLETION_STATUS_KHR with the
+  // driver's compiler threads. Needs a current context.
+  static void BenchmarkCompile(int variants) {
+    const char *lab[2][2] = {{"shaders/main.vert", "shaders/main.frag"},
+                             {"shaders/skybox.vert", "shaders/skybox.frag"}};
+    vector<pair<string, string>> sources;
+    for (int p = 0; p < 2; p++)
+      sources.push_back(make_pair(readText(lab[p][0]), readText(lab[p][1])));
+    for (int v = 0; v < variants; v++)
+      sources.push_back(sources[0]);
+
+    // the first program of a process also pays for starting the compiler
+    Shader warmup(withDefine(sources[0].first, 9, 0),
+                  withDefine(sources[0].second, 9, 0));
+    warmup.Finish();
+    glDeleteProgram(warmup.ID);
+
+    const char *modes[3] = {"synchronous", "batched", "batched, polled"};
+    for (int mode = 0; mode < 3; mode++) {
+      if (mode == 2 && !HasParallelShaderCompile()) {
+        cout << "Shader compile: no KHR_parallel_shader_compile to poll"
+             << endl;
+        break;
+      }
+      // the driver's threads only for the polled run
+      SetShaderCompilerThreads(mode == 2 ? 0xFFFFFFFFu : 0);
+      SynchronousShaders() = mode == 0;
+
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      vector<Shader *> programs;
+      for (size_t i = 0; i < sources.size(); i++)
+        // a distinct define per program and run keeps the driver's shader
+        // cache from answering
+        programs.push_back(new Shader(
+            withDefine(sources[i].first, mode, (int)i),
+            withDefine(sources[i].second, mode, (int)i)));
+      double issueMs = elapsedMs(start);
+
+      size_t polls = 0, left = programs.size();
+      vector<bool> finished(programs.size(), false);
+      while (mode == 2 && left > 0)
+        for (size_t i = 0; i < programs.size(); i++, polls++)
+          if (!finished[i] && programs[i]->Ready()) {
+            programs[i]->Finish();
+            finished[i] = true;
+            left--;
+          }
+      for (size_t i = 0; i < programs.size(); i++)
+        programs[i]->Finish();
+      double totalMs = elapsedMs(start);
+
+      cout << "Shader compile (" << modes[mode] << "): " << programs.size()
+           << " programs (" << variants << " variants) in " << totalMs
+           << " ms, " << issueMs << " ms issuing";
+      if (mode == 2)
+        cout << ", " << polls << " status polls";
+      cout << endl;
+      for (size_t i = 0; i < programs.size(); i++) {
+        glDeleteProgram(programs[i]->ID);
+        delete programs[i];
+      }
+    }
+    SynchronousShaders() = false;
+    SetShaderCompilerThreads(0xFFFFFFFFu);
+  }
 
   // use/activate the shader
-  void use() { glUseProgram(ID); };
+  void use() {
+    Finish();
+    glUseProgram(ID);
+    PipelineWarmup::Default().UseProgram(ID);
+    RenderStats::Frame().programBinds++;
+  };
+
+  // Faces are decoded on up to decodeThreads worker threads, then uploaded
+  // here on the GL thread. The texture is cached by face paths, so loading
+  // the same skybox again returns the existing texture.
+  GLuint loadCubemap(const char *faces[6], int decodeThreads = 6) {
+    PROFILE_SCOPE("loadCubemap");
+    string key;
+    for (int i = 0; i < 6; i++)
+      key += string(faces[i]) + "\n";
+    map<string, GLuint> &cache = cubemapCache();
+    map<string, GLuint>::iterator cached = cache.find(key);
+    if (cached != cache.end())
+      return cached->second;
+
+    vector<DecodedImage> images;
+    stbi_set_flip_vertically_on_load(false);
+    DecodeImagesParallel(faces, 6, images, decodeThreads);
+
+    GLuint textureID = CreateCubemap(images, faces);
+    cache[key] = textureID;
+    return textureID;
+  };
+
+  // The texture for six decoded faces, in GL_TEXTURE_CUBE_MAP_POSITIVE_X
+  // order. With DirectStateAccess() it gets immutable storage, when the
+  // faces are all there and share one size and channel count; otherwise
+  // each face is specified on its own as in GL 3.3. faces names them in
+  // errors.
+  static GLuint CreateCubemap(const vector<DecodedImage> &images,
+                              const char *const *faces) {
+    GLuint direct = DirectStateAccess() ? createCubemapDirect(images) : 0;
+    if (direct)
+      return direct;
 
-  GLuint loadCubemap(const char *faces[6]) {
     GLuint textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    RenderStats::Frame().textureBinds++;
 
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(false);
+    PROFILE_SCOPE("upload faces");
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     for (GLuint i = 0; i < 6; i++) {
-      unsigned char *data =
-          stbi_load(faces[i], &width, &height, &nrChannels, 0);
-      if (data) {
+      const DecodedImage &image = images[i];
+      if (image.ok) {
         GLenum format = GL_RGB;
         GLenum internalFormat = GL_RGB;
 
-        if (nrChannels == 4) {
+        if (image.channels == 4) {
           format = GL_RGBA;
           internalFormat = GL_RGBA; // simplest fix (no sRGB yet)
-        } else if (nrChannels == 3) {
+        } else if (image.channels == 3) {
           format = GL_RGB;
           internalFormat = GL_RGB;
-        } else if (nrChannels == 1) {
+        } else if (image.channels == 1) {
           format = GL_RED;
           internalFormat = GL_RED;
         }
 
         glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internalFormat,
-                     width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
+                     image.width, image.height, 0, format, GL_UNSIGNED_BYTE,
+                     &image.pixels[0]);
+        RenderStats::Frame().bufferBytes += image.pixels.size();
       } else {
         std::cout << "Cubemap texture failed to load at path: " << faces[i]
                   << std::endl;
-        stbi_image_free(data);
       }
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    return textureID;
+  }
+
+  // Loads a block-compressed cubemap with mips, as written by
+  // tools/texcompress. Returns 0 if the file is missing or the GPU cannot
+  // sample its format, so the caller can fall back to the JPEG faces.
+  GLuint loadCubemapDDS(const char *path) {
+    PROFILE_SCOPE("loadCubemapDDS");
+    DdsCubemap cube;
+    if (!cube.Read(path))
+      return 0;
+    return loadCubemapDDS(cube);
+  };
+
+  // upload half of the above, for a file already read on another thread
+  GLuint loadCubemapDDS(const DdsCubemap &cube) {
+    GLenum internalFormat;
+    if (cube.format == BC_FORMAT_BC1) {
+      if (!HasGLExtension("GL_EXT_texture_compression_s3tc"))
+        return 0;
+      internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    } else {
+      if (!HasGLVersion(4, 2) &&
+          !HasGLExtension("GL_ARB_texture_compression_bptc"))
+        return 0;
+      internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    RenderStats::Frame().textureBinds++;
+
+    for (int face = 0; face < 6; face++)
+      for (int level = 0; level < cube.mipCount; level++) {
+        int size = cube.MipSize(level);
+        glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level,
+                               internalFormat, size, size, 0,
+                               (GLsizei)cube.MipBytes(level),
+                               &cube.data[cube.Offset(face, level)]);
+        RenderStats::Frame().bufferBytes += cube.MipBytes(level);
+      }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL,
+                    cube.mipCount - 1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    return textureID;
+  };
+
+  // Loads an equirectangular .hdr as a cubemap with faceSize^2 faces. The
+  // packed formats store 4 bytes per texel; HDR_FORMAT_RGB16F is the
+  // unpacked reference. Prints conversion times and the memory footprint.
+  GLuint loadCubemapHDR(const char *path, int faceSize = 1024,
+                        HdrFormat format = HDR_FORMAT_RGB9E5) {
+    PROFILE_SCOPE("loadCubemapHDR");
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    HdrImage image;
+    if (!LoadHdrImage(path, image))
+      return 0;
+    double loadMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    vector<float> faces[6];
+    EquirectToCube(image, faceSize, faces);
+    double resampleMs = elapsedMs(start);
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    RenderStats::Frame().textureBinds++;
+
+    double packMs = 0.0;
+    size_t texels = (size_t)faceSize * faceSize;
+    vector<uint32_t> packed;
+    for (GLuint i = 0; i < 6; i++) {
+      if (format == HDR_FORMAT_RGB16F) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                     faceSize, faceSize, 0, GL_RGB, GL_FLOAT, &faces[i][0]);
+        RenderStats::Frame().bufferBytes += texels * 3 * sizeof(float);
+        continue;
+      }
+      start = chrono::steady_clock::now();
+      PackHdrFace(faces[i], format, packed);
+      packMs += elapsedMs(start);
+      bool e5 = format == HDR_FORMAT_RGB9E5;
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
+                   e5 ? GL_RGB9_E5 : GL_R11F_G11F_B10F, faceSize, faceSize, 0,
+                   GL_RGB,
+                   e5 ? GL_UNSIGNED_INT_5_9_9_9_REV
+                      : GL_UNSIGNED_INT_10F_11F_11F_REV,
+                   &packed[0]);
+      RenderStats::Frame().bufferBytes += texels * 4;
+    }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+    // RGB16F is padded to 8 bytes per texel by most drivers
+    double mb = 6.0 * texels / 1048576.0;
+    cout << "HDR cubemap " << path << " (" << image.width << "x"
+         << image.height << " -> 6x" << faceSize << "^2): load " << loadMs
+         << " ms, resample " << resampleMs << " ms, pack " << packMs
+         << " ms; " << mb * (format == HDR_FORMAT_RGB16F ? 8 : 4)
+         << " MB (RGBA16F " << mb * 8 << " MB, RGB32F " << mb * 12 << " MB)"
+         << endl;
     return textureID;
   };
 
+  // GGX-prefiltered specular environment for the skybox faces: mip i is
+  // blurred for roughness i / maxLod. Read from cachePath when it matches the
+  // faces, otherwise built from a 256^2 copy of them and written there.
+  // irradiance, if given, receives the SH diffuse lighting of the faces.
+  GLuint loadPrefilteredCubemap(const char *faces[6], const string &cachePath,
+                                SHIrradiance *irradiance = NULL,
+                                int decodeThreads = 6) {
+    EnvironmentPrefilter prefilter;
+    if (!PreparePrefilteredCubemap(faces, cachePath, prefilter, decodeThreads))
+      return 0;
+    if (irradiance)
+      *irradiance = prefilter.irradiance;
+    return prefilter.Upload();
+  };
+
+  // same for an equirectangular .hdr, which stays linear
+  GLuint loadPrefilteredHDR(const char *path, const string &cachePath,
+                            SHIrradiance *irradiance = NULL) {
+    EnvironmentPrefilter prefilter;
+    if (!PreparePrefilteredHDR(path, cachePath, prefilter))
+      return 0;
+    if (irradiance)
+      *irradiance = prefilter.irradiance;
+    return prefilter.Upload();
+  };
+
+  // The CPU halves of the two loaders above: fill prefilter (cache read or
+  // full build) without touching GL, so they can run on a worker thread;
+  // prefilter.Upload() then makes the texture on the GL thread.
+  static bool PreparePrefilteredCubemap(const char *faces[6],
+                                        const string &cachePath,
+                                        EnvironmentPrefilter &prefilter,
+                                        int decodeThreads = 6) {
+    PROFILE_SCOPE("loadPrefilteredCubemap");
+    uint64_t key = EnvironmentPrefilter::SourceKey(faces, 6);
+    return preparePrefiltered(key, cachePath, [&](vector<float> rgb[6]) {
+      vector<DecodedImage> images;
+      DecodeImagesParallel(faces, 6, images, decodeThreads);
+      for (int i = 0; i < 6; i++) {
+        if (!images[i].ok || images[i].width != images[0].width)
+          return 0;
+        SrgbImageToLinear(images[i], rgb[i]);
+      }
+      return images[0].width;
+    }, true, prefilter);
+  };
+
+  static bool PreparePrefilteredHDR(const char *path, const string &cachePath,
+                                    EnvironmentPrefilter &prefilter) {
+    PROFILE_SCOPE("loadPrefilteredHDR");
+    uint64_t key = EnvironmentPrefilter::SourceKey(&path, 1, 1);
+    return preparePrefiltered(key, cachePath, [&](vector<float> rgb[6]) {
+      HdrImage image;
+      if (!LoadHdrImage(path, image))
+        return 0;
+      EquirectToCube(image, EnvironmentPrefilter::SOURCE_SIZE, rgb);
+      return EnvironmentPrefilter::SOURCE_SIZE;
+    }, false, prefilter);
+  };
+
+  // attaches a uniform block of this program to a buffer binding point
+  void bindUniformBlock(const char *name, GLuint binding) const {
+    Finish();
+    GLuint index = glGetUniformBlockIndex(ID, name);
+    if (index != GL_INVALID_INDEX)
+      glUniformBlockBinding(ID, index, binding);
+  };
+
   // utility uniform functions
-  void setBool(const string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+  void setBool(const char *name, bool value) const {
+    RenderStats::Frame().uniformUploads++;
+    glUniform1i(location(name), (int)value);
   };
 
-  void setInt(const string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+  void setInt(const char *name, int value) const {
+    RenderStats::Frame().uniformUploads++;
+    glUniform1i(location(name), value);
   };
-  void setFloat(const string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+  void setFloat(const char *name, float value) const {
+    RenderStats::Frame().uniformUploads++;
+    glUniform1f(location(name), value);
   };
-  void setVec3(const string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1,
-                 glm::value_ptr(value));
+  void setVec3(const char *name, const glm::vec3 &value) const {
+    RenderStats::Frame().uniformUploads++;
+    glUniform3fv(location(name), 1, glm::value_ptr(value));
   };
-  void setMat4(const string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       glm::value_ptr(mat));
+  void setMat4(const char *name, const glm::mat4 &mat) const {
+    RenderStats::Frame().uniformUploads++;
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(mat));
   };
+
+private:
+  // compile and link in flight, not yet checked by Finish()
+  mutable bool pending = false;
+  GLuint vertexStage = 0, fragmentStage = 0;
+
+  // benchmark variants: sources that are not files
+  Shader(const string &vertexCode, const string &fragmentCode) {
+    build(vertexCode, fragmentCode);
+  }
+
+  void build(const string &vertexCode, const string &fragmentCode) {
+    const char *vShaderCode = vertexCode.c_str();
+    const char *fShaderCode = fragmentCode.c_str();
+
+    // compile shaders
+    PROFILE_SCOPE("compile+link");
+    vertexStage = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexStage, 1, &vShaderCode, nullptr);
+    glCompileShader(vertexStage);
+
+    fragmentStage = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentStage, 1, &fShaderCode, nullptr);
+    glCompileShader(fragmentStage);
+
+    ID = glCreateProgram();
+    glAttachShader(ID, vertexStage);
+    glAttachShader(ID, fragmentStage);
+    glLinkProgram(ID);
+    pending = true;
+    if (SynchronousShaders())
+      Finish();
+  }
+
+  // CreateCubemap() through DirectStateGL; 0 if the faces do not fit one
+  // immutable texture
+  static GLuint createCubemapDirect(const vector<DecodedImage> &images) {
+    const DecodedImage &first = images[0];
+    GLenum format, internalFormat;
+    if (first.channels == 4) {
+      format = GL_RGBA;
+      internalFormat = GL_RGBA8;
+    } else if (first.channels == 3) {
+      format = GL_RGB;
+      internalFormat = GL_RGB8;
+    } else if (first.channels == 1) {
+      format = GL_RED;
+      internalFormat = GL_R8;
+    } else {
+      return 0;
+    }
+    for (int i = 0; i < 6; i++)
+      if (!images[i].ok || images[i].width != first.width ||
+          images[i].height != first.height ||
+          images[i].channels != first.channels)
+        return 0;
+
+    DirectStateGL &gl = DirectStateGL::Get();
+    GLuint textureID;
+    gl.CreateTextures(GL_TEXTURE_CUBE_MAP, 1, &textureID);
+    gl.TextureStorage2D(textureID, 1, internalFormat, first.width,
+                        first.height);
+
+    PROFILE_SCOPE("upload faces");
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // the faces of a cubemap are the layers 0-5 of its storage
+    for (int i = 0; i < 6; i++) {
+      gl.TextureSubImage3D(textureID, 0, 0, 0, i, first.width, first.height,
+                           1, format, GL_UNSIGNED_BYTE, &images[i].pixels[0]);
+      RenderStats::Frame().bufferBytes += images[i].pixels.size();
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    gl.TextureParameteri(textureID, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl.TextureParameteri(textureID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl.TextureParameteri(textureID, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    gl.TextureParameteri(textureID, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    gl.TextureParameteri(textureID, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return textureID;
+  }
+
+  static string readText(const char *path) {
+    ifstream file(path);
+    stringstream text;
+    text << file.rdbuf();
+    return text.str();
+  }
+
+  // adds "#define SHADER_VARIANT n" after the #version line
+  static string withDefine(const string &code, int run, int variant) {
+    size_t line = code.find('\n');
+    line = line == string::npos ? code.size() : line + 1;
+    return code.substr(0, line) + "#define SHADER_VARIANT " +
+           to_string(run * 100000 + variant) + "\n" + code.substr(line);
+  }
+
+  static double elapsedMs(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since)
+        .count();
+  }
+
+  // source(rgb) fills six linear faces and returns their size, 0 on failure
+  static bool preparePrefiltered(uint64_t key, const string &cachePath,
+                                 const function<int(vector<float> *)> &source,
+                                 bool encodeSrgb,
+                                 EnvironmentPrefilter &prefilter) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (prefilter.ReadCache(cachePath, key)) {
+      cout << "Prefiltered environment read from " << cachePath << " in "
+           << elapsedMs(start) << " ms" << endl;
+      return true;
+    }
+
+    vector<float> rgb[6];
+    int size = source(rgb);
+    if (size == 0) {
+      cout << "ERROR::PREFILTER::SOURCE_NOT_LOADED" << endl;
+      return false;
+    }
+    double sourceMs = elapsedMs(start);
+    prefilter.Build(rgb, size, encodeSrgb);
+    prefilter.WriteCache(cachePath, key);
+    cout << "Prefiltered environment built in " << prefilter.buildMs
+         << " ms (" << prefilter.SamplesPerSecond() / 1e6
+         << " M samples/s, " << HardwareThreads() << " threads) after "
+         << sourceMs << " ms loading the source; SH projection of 6x" << size
+         << "^2 took " << prefilter.irradiance.projectMs << " ms" << endl;
+    return true;
+  }
+
+  // cubemaps by face paths, shared by every Shader
+  static map<string, GLuint> &cubemapCache() {
+    static map<string, GLuint> cache;
+    return cache;
+  }
+
+  // uniform locations, looked up once per name so the per-frame setters
+  // neither query the driver nor allocate
+  mutable vector<pair<string, GLint>> locations;
+
+  GLint location(const char *name) const {
+    Finish();
+    for (size_t i = 0; i < locations.size(); i++)
+      if (strcmp(locations[i].first.c_str(), name) == 0)
+        return locations[i].second;
+    GLint loc = glGetUniformLocation(ID, name);
+    locations.push_back(make_pair(string(name), loc));
+    return loc;
+  }
 };
 
 #endif
@@ -0,0 +1,256 @@
+#ifndef STARTUP_TASKS_H
+#define STARTUP_TASKS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.h"
+
+using namespace std;
+
+// Startup task graph. Work that needs no GL context (file reads, image
+// decoding, model import, environment prefiltering) is added as tasks at
+// process start and runs on worker threads while GLFW, the GL context and
+// ImGui come up. A task can wait for earlier tasks and can have an upload
+// step. RunUploads() runs those steps on the GL thread in the order the work
+// finishes, so the context thread only uploads.
+//
+// Serial mode runs each task's work and then its upload inside RunUploads(),
+// on the GL thread, in the order they were added. That is the old,
+// sequential startup, kept for comparison.
+//
+// The main thread marks its own phases with Phase(). Report() prints the
+// startup critical path: the main thread's timeline, with any wait charged
+// to the task it waited for, and when each task ran on its worker.
+class StartupTasks {
+public:
+  typedef chrono::steady_clock Clock;
+
+  explicit StartupTasks(Clock::time_point origin, bool serial = false)
+      : origin(origin), serial(serial), phaseStart(origin) {}
+  ~StartupTasks() { join(); }
+
+  bool Serial() const { return serial; }
+
+  // after lists tasks that must finish first; only earlier tasks count
+  int Add(const string &name, const function<void()> &work,
+          const function<void()> &upload = function<void()>(),
+          const vector<int> &after = vector<int>()) {
+    Task task;
+    task.name = name;
+    task.work = work;
+    task.upload = upload;
+    for (size_t i = 0; i < after.size(); i++)
+      if (after[i] >= 0 && after[i] < (int)tasks.size())
+        task.after.push_back(after[i]);
+    tasks.push_back(task);
+    return (int)tasks.size() - 1;
+  }
+
+  // One worker per task by default: most of them wait on I/O or spread
+  // their own work over cores.
+  void Start(int threads = 0) {
+    if (serial || tasks.empty() || !workers.empty())
+      return;
+    if (threads <= 0 || threads > (int)tasks.size())
+      threads = (int)tasks.size();
+    for (int t = 0; t < threads; t++)
+      workers.push_back(thread(&StartupTasks::workerLoop, this, t));
+  }
+
+  // ends the main thread's current phase and starts the next
+  void Phase(const string &name) {
+    closePhase();
+    phaseName = name;
+  }
+
+  // GL thread: runs every upload as its task's work finishes and returns
+  // when all tasks are done
+  void RunUploads() {
+    closePhase();
+    if (serial) {
+      for (size_t i = 0; i < tasks.size(); i++) {
+        Task &task = tasks[i];
+        task.worker = -1;
+        task.start = Clock::now();
+        runWork(task);
+        task.end = Clock::now();
+        segment("work: " + task.name, task.start, task.end);
+        runUpload((int)i);
+      }
+    } else {
+      for (size_t uploaded = 0; uploaded < tasks.size(); uploaded++) {
+        Clock::time_point waitStart = Clock::now();
+        int next;
+        {
+          unique_lock<mutex> lock(mutex_);
+          while (completed.size() <= uploaded)
+            changed.wait(lock);
+          next = completed[uploaded];
+        }
+        Clock::time_point waitEnd = Clock::now();
+        if (ms(waitStart, waitEnd) >= 0.05)
+          segment("wait: " + tasks[next].name, waitStart, waitEnd);
+        runUpload(next);
+      }
+      join();
+    }
+    phaseName.clear();
+    phaseStart = Clock::now();
+  }
+
+  // critical path up to now, normally the end of the first frame
+  void Report() {
+    closePhase();
+    double total = ms(origin, Clock::now()), own = 0, waiting = 0;
+    printf("Startup critical path (%s): %.1f ms\n",
+           serial ? "serial" : "parallel", total);
+    printf("  main thread           start      time\n");
+    for (size_t i = 0; i < timeline.size(); i++) {
+      const Segment &s = timeline[i];
+      printf("    %-24s %7.1f %7.1f ms\n", s.name.c_str(), s.start,
+             s.end - s.start);
+      if (s.name.compare(0, 6, "wait: ") == 0)
+        waiting += s.end - s.start;
+      else
+        own += s.end - s.start;
+    }
+    printf("  tasks                 start     end      time\n");
+    for (size_t i = 0; i < tasks.size(); i++) {
+      const Task &task = tasks[i];
+      char where[24];
+      if (task.worker < 0)
+        snprintf(where, sizeof(where), "main");
+      else
+        snprintf(where, sizeof(where), "worker %d", task.worker);
+      printf("    %-16s %7.1f %7.1f %7.1f ms  %s\n", task.name.c_str(),
+             ms(origin, task.start), ms(origin, task.end),
+             ms(task.start, task.end), where);
+    }
+    printf("  main thread busy %.1f ms, waiting on tasks %.1f ms, idle "
+           "between phases %.1f ms\n",
+           own, waiting, total - own - waiting);
+  }
+
+private:
+  struct Task {
+    string name;
+    function<void()> work, upload;
+    vector<int> after;
+    bool started = false, done = false;
+    int worker = -1;
+    Clock::time_point start, end;
+  };
+
+  struct Segment {
+    string name;
+    double start, end; // ms since origin
+  };
+
+  Clock::time_point origin;
+  bool serial;
+  vector<Task> tasks;
+  vector<thread> workers;
+  mutex mutex_;
+  condition_variable changed;
+  vector<int> completed; // task indices in the order their work finished
+
+  string phaseName;
+  Clock::time_point phaseStart;
+  vector<Segment> timeline;
+
+  static double ms(Clock::time_point from, Clock::time_point to) {
+    return chrono::duration<double, milli>(to - from).count();
+  }
+
+  void segment(const string &name, Clock::time_point start,
+               Clock::time_point end) {
+    Segment s;
+    s.name = name;
+    s.start = ms(origin, start);
+    s.end = ms(origin, end);
+    timeline.push_back(s);
+  }
+
+  void closePhase() {
+    Clock::time_point now = Clock::now();
+    if (!phaseName.empty())
+      segment(phaseName, phaseStart, now);
+    phaseName.clear();
+    phaseStart = now;
+  }
+
+  void runWork(Task &task) {
+    if (!task.work)
+      return;
+    PROFILE_SCOPE_DYNAMIC(task.name);
+    task.work();
+  }
+
+  void runUpload(int index) {
+    Task &task = tasks[index];
+    if (!task.upload)
+      return;
+    Clock::time_point start = Clock::now();
+    {
+      PROFILE_SCOPE_DYNAMIC("upload " + task.name);
+      task.upload();
+    }
+    segment("upload: " + task.name, start, Clock::now());
+  }
+
+  bool ready(const Task &task) const {
+    for (size_t i = 0; i < task.after.size(); i++)
+      if (!tasks[task.after[i]].done)
+        return false;
+    return true;
+  }
+
+  void workerLoop(int worker) {
+    if (Profiler::Enabled())
+      Profiler::SetThreadName("startup " + to_string(worker));
+    unique_lock<mutex> lock(mutex_);
+    for (;;) {
+      int pick = -1;
+      bool pending = false;
+      for (size_t i = 0; i < tasks.size() && pick < 0; i++)
+        if (!tasks[i].started) {
+          pending = true;
+          if (ready(tasks[i]))
+            pick = (int)i;
+        }
+      if (pick < 0) {
+        if (!pending)
+          return;
+        changed.wait(lock);
+        continue;
+      }
+
+      Task &task = tasks[pick];
+      task.started = true;
+      task.worker = worker;
+      lock.unlock();
+      task.start = Clock::now();
+      runWork(task);
+      task.end = Clock::now();
+      lock.lock();
+      task.done = true;
+      completed.push_back(pick);
+      changed.notify_all();
+    }
+  }
+
+  void join() {
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+    workers.clear();
+  }
+};
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+#include <glm/glm.hpp>
+
+struct Vertex
+{
+  glm::vec3 Position;
+  glm::vec3 Normal;
+};
+
+#endif
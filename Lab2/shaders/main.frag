@@ -6,10 +6,47 @@ in vec3 Position;
 
 uniform vec3 cameraPos;
 uniform samplerCube skybox;
+uniform samplerCube prefiltered; // GGX-blurred skybox, roughness per mip
+uniform float roughness;
+uniform float maxLod;
+uniform float diffuse; // mix of SH irradiance into the reflection
+uniform float exposure;
+uniform bool tonemap; // HDR environments: Reinhard
+
+layout(std140) uniform SHIrradiance {
+    vec4 sh[9]; // irradiance / pi, see include/sh_irradiance.h
+};
+
+vec3 shIrradiance(vec3 n)
+{
+    return sh[0].rgb * 0.282095
+        + sh[1].rgb * 0.488603 * n.y
+        + sh[2].rgb * 0.488603 * n.z
+        + sh[3].rgb * 0.488603 * n.x
+        + sh[4].rgb * 1.092548 * n.x * n.y
+        + sh[5].rgb * 1.092548 * n.y * n.z
+        + sh[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + sh[7].rgb * 1.092548 * n.x * n.z
+        + sh[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+}
 
 void main()
 {
     vec3 I = normalize(Position - cameraPos);
-    vec3 R = reflect(I, normalize(Normal));
-    FragColor = vec4(texture(skybox, R).rgb, 1.0);
+    vec3 N = normalize(Normal);
+    vec3 R = reflect(I, N);
+    vec3 color = roughness > 0.0
+        ? textureLod(prefiltered, R, roughness * maxLod).rgb
+        : texture(skybox, R).rgb;
+    if (diffuse > 0.0) {
+        vec3 irradiance = max(shIrradiance(N), vec3(0.0));
+        // LDR skyboxes are sampled sRGB-encoded, the SH is linear
+        if (!tonemap)
+            irradiance = pow(irradiance, vec3(1.0 / 2.2));
+        color = mix(color, irradiance, diffuse);
+    }
+    color *= exposure;
+    if (tonemap)
+        color = color / (1.0 + color);
+    FragColor = vec4(color, 1.0);
 }
@@ -3,9 +3,14 @@ in vec3 textureDir;
 out vec4 FragColor;
 
 uniform samplerCube skybox;
+uniform float exposure;
+uniform bool tonemap; // HDR environments: Reinhard
 
 void main()
 {
-    FragColor = texture(skybox, textureDir);
+    vec3 color = texture(skybox, textureDir).rgb * exposure;
+    if (tonemap)
+        color = color / (1.0 + color);
+    FragColor = vec4(color, 1.0);
 }
 
@@ -14,14 +14,30 @@
 
 #include <string>
 
+#define ALLOC_TRACKER_IMPLEMENTATION
+#include "alloc_tracker.h"
+#include "async_io.h"
+#include "benchmark.h"
 #include "camera.h"
+#include "cubemap_stream.h"
+#include "gpu_timer.h"
+#include "input_replay.h"
 #include "model.h"
+#include "perf_overlay.h"
+#include "pipeline_warmup.h"
+#include "profiler.h"
+#include "render_stats.h"
 #include "shaders.h"
+#include "startup_tasks.h"
 
 using namespace std;
 
 int width = 1920, height = 1080;
 bool showUI = true;
+bool showPerfOverlay = true;
+float exposure = 1.0f; // applied before tone mapping HDR environments
+float roughness = 0.0f; // of the ball's reflections
+float diffuse = 0.0f;   // SH irradiance mixed into the ball's shading
 const char *project_name = "Lab 2 - Transmitance Effects";
 
 // camera at +Z looking toward origin (-Z)
@@ -34,12 +50,17 @@ float lastFrame = 0.0f;
 const char *faces[6] = {"assets/skybox/right.jpg", "assets/skybox/left.jpg",
                         "assets/skybox/top.jpg",   "assets/skybox/bottom.jpg",
                         "assets/skybox/front.jpg", "assets/skybox/back.jpg"};
+// built from the faces by tools/texcompress; used when present
+const char *skyboxBC7 = "assets/skybox/skybox_bc7.dds";
+const char *skyboxBC1 = "assets/skybox/skybox_bc1.dds";
+const char *skyboxPrefiltered = "assets/skybox/skybox.prefilter";
 
 // --- globals for input ---
 Camera *gCamera = nullptr;
 float gLastX = 0.0f;
 float gLastY = 0.0f;
 bool gFirstMouse = true;
+InputLog inputLog; // --record / --replay
 
 glm::vec3 lightPos(50.0f, 50.0f, 50.0f);
 glm::vec3 lightColor(1.0f);
@@ -59,6 +80,9 @@ void framebuffer_size_callback(GLFWwindow *window, int w, int h) {
 
 void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
 
+  if (!inputLog.OnCursor(xpos, ypos))
+    return;
+
   if (showUI)
     return;
 
@@ -82,11 +106,16 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
   if (!gCamera)
     return;
+  if (!inputLog.OnScroll(xoffset, yoffset))
+    return;
   gCamera->ProcessMouseScroll((float)yoffset);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action,
                   int mods) {
+  if (!inputLog.OnKey(key, action, mods))
+    return;
+
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
 
@@ -107,24 +136,302 @@ void processInput(GLFWwindow *window) {
   if (!gCamera)
     return;
 
-  if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_W))
     gCamera->ProcessKeyboard(FRONT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_S))
     gCamera->ProcessKeyboard(BACK, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_A))
     gCamera->ProcessKeyboard(LEFT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_D))
     gCamera->ProcessKeyboard(RIGHT, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_SPACE))
     gCamera->ProcessKeyboard(UP, deltaTime);
-  if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
+  if (inputLog.KeyDown(window, GLFW_KEY_LEFT_SHIFT))
     gCamera->ProcessKeyboard(DOWN, deltaTime);
 }
 
-int main() {
+int main(int argc, char **argv) {
+  chrono::steady_clock::time_point startupTime = chrono::steady_clock::now();
+
+  bool runBenchmark = false;
+  bool allocTest = false;
+  bool headless = false;
+  string benchmarkOut = "benchmark";
+  string recordPath, replayPath, profilePath;
+  int decodeThreads = 6;
+  bool streamSkybox = true;
+  bool useCompressedSkybox = true;
+  string hdrPath;
+  int hdrFaceSize = 1024;
+  HdrFormat hdrFormat = HDR_FORMAT_RGB9E5;
+  string exportSHPath;
+  string packPath;
+  bool coldModel = false;
+  string modelPath = "assets/models/ball/source/ball_lp_uw.obj";
+  bool prefetch = true;
+  bool serialStartup = false;
+  int shaderBenchmarkVariants = -1;
+  bool bindToEdit = false;
+  int directStateBenchmarkCount = 0;
+  bool pipelineWarmup = true;
+  IoBackend ioBackend = IO_BACKEND_AUTO;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--benchmark") {
+      runBenchmark = true;
+    } else if (arg == "--benchmark-out" && i + 1 < argc) {
+      benchmarkOut = argv[++i];
+    } else if (arg == "--record" && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (arg == "--profile" && i + 1 < argc) {
+      profilePath = argv[++i];
+    } else if (arg == "--decode-threads" && i + 1 < argc) {
+      decodeThreads = atoi(argv[++i]);
+    } else if (arg == "--decoder" && i + 1 < argc) {
+      string decoder = argv[++i];
+      DefaultImageDecoder() =
+          decoder == "libjpeg" ? DECODER_LIBJPEG : DECODER_STB;
+    } else if (arg == "--hdr" && i + 1 < argc) {
+      hdrPath = argv[++i];
+    } else if (arg == "--hdr-size" && i + 1 < argc) {
+      hdrFaceSize = atoi(argv[++i]);
+    } else if (arg == "--hdr-format" && i + 1 < argc) {
+      string format = argv[++i];
+      hdrFormat = format == "r11g11b10f" ? HDR_FORMAT_R11G11B10F
+                  : format == "rgb16f"   ? HDR_FORMAT_RGB16F
+                                         : HDR_FORMAT_RGB9E5;
+    } else if (arg == "--pack" && i + 1 < argc) {
+      packPath = argv[++i];
+    } else if (arg == "--export-sh" && i + 1 < argc) {
+      exportSHPath = argv[++i];
+    } else if (arg == "--cold-model") {
+      coldModel = true;
+    } else if (arg == "--no-prefetch") {
+      prefetch = false;
+    } else if (arg == "--serial-startup") {
+      serialStartup = true;
+    } else if (arg == "--no-warmup") {
+      pipelineWarmup = false;
+    } else if (arg == "--hitch-budget" && i + 1 < argc) {
+      PipelineWarmup::Default().budgetMs = (float)atof(argv[++i]);
+    } else if (arg == "--sync-shaders") {
+      SynchronousShaders() = true;
+    } else if (arg == "--original-shaders") {
+      UseOptimizedShaders() = false;
+    } else if (arg == "--shader-benchmark") {
+      // --shader-benchmark [variants]: needs the GL context, runs after it
+      shaderBenchmarkVariants = 100;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        shaderBenchmarkVariants = atoi(argv[++i]);
+    } else if (arg == "--bind-to-edit") {
+      bindToEdit = true;
+    } else if (arg == "--dsa-benchmark") {
+      // --dsa-benchmark [count]: needs the GL context, runs after it
+      directStateBenchmarkCount = 100;
+      if (i + 1 < argc && argv[i + 1][0] != '-')
+        directStateBenchmarkCount = atoi(argv[++i]);
+    } else if (arg == "--io-backend" && i + 1 < argc) {
+      string backend = argv[++i];
+      ioBackend = backend == "threads" ? IO_BACKEND_THREADS
+                  : backend == "sync"  ? IO_BACKEND_SYNC
+                                       : IO_BACKEND_AUTO;
+    } else if (arg == "--assimp-obj") {
+      NativeObjLoader() = false;
+    } else if (arg == "--assimp-gltf") {
+      NativeGltfLoader() = false;
+    } else if (arg == "--model" && i + 1 < argc) {
+      modelPath = argv[++i];
+    } else if (arg == "--obj-benchmark" && i + 1 < argc) {
+      // --obj-benchmark file.obj [threads]: native loader against Assimp
+      int threads = i + 2 < argc ? atoi(argv[i + 2]) : 0;
+      Model::BenchmarkObj(argv[i + 1], threads);
+      return 0;
+    } else if (arg == "--mesh-benchmark" && i + 1 < argc) {
+      // --mesh-benchmark model [threads]: baked mesh ratio and decode speed
+      int threads = i + 2 < argc ? atoi(argv[i + 2]) : 1;
+      Model::BenchmarkCodec(argv[i + 1], threads);
+      return 0;
+    } else if (arg == "--io-benchmark") {
+      // --io-benchmark [directory]: cold and warm reads of every file in it
+      vector<string> paths;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        ListFilesRecursive(argv[i + 1], paths);
+      } else {
+        ListFilesRecursive("assets", paths);
+        ListFilesRecursive("shaders", paths);
+      }
+      AsyncFileReader::Benchmark(paths);
+      return 0;
+    } else if (arg == "--no-compressed") {
+      useCompressedSkybox = false;
+    } else if (arg == "--no-stream") {
+      streamSkybox = false;
+    } else if (arg == "--alloc-test") {
+      allocTest = true;
+    } else if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--compare" && i + 2 < argc) {
+      // --compare baseline.csv current.csv [--tolerance percent]
+      double tolerance = 5.0;
+      if (i + 4 < argc && string(argv[i + 3]) == "--tolerance")
+        tolerance = atof(argv[i + 4]);
+      int regressions = Benchmark::Compare(argv[i + 1], argv[i + 2], tolerance);
+      return regressions == 0 ? 0 : 1;
+    }
+  }
 
+  AllocTracker::SetRenderThread();
+
+  if (!profilePath.empty())
+    Profiler::Enable(true);
+  Profiler::SetThreadName("main");
+
+  // baked shaders, textures and models from tools/asset_bake replace the
+  // loose files they were made from
+  if (!packPath.empty() && AssetPack::Default().Open(packPath))
+    cout << "Asset pack " << packPath << ": "
+         << AssetPack::Default().Entries().size() << " entries" << endl;
+
+  // Read everything the scene loads in one batch, in the background while
+  // the window and GL context come up. Files the pack has are skipped.
+  if (prefetch) {
+    vector<string> paths = {ShaderSourcePath("shaders/main.vert"),
+                            ShaderSourcePath("shaders/main.frag"),
+                            ShaderSourcePath("shaders/skybox.vert"),
+                            ShaderSourcePath("shaders/skybox.frag")};
+    struct stat st;
+    bool compressed = useCompressedSkybox && (stat(skyboxBC7, &st) == 0 ||
+                                              stat(skyboxBC1, &st) == 0);
+    bool needFaces = hdrPath.empty() &&
+                     (!compressed || stat(skyboxPrefiltered, &st) != 0);
+    if (needFaces)
+      paths.insert(paths.end(), faces, faces + 6);
+    if (!coldModel)
+      ListFilesRecursive(modelPath.substr(0, modelPath.find_last_of('/')),
+                         paths);
+    const AssetPack &pack = AssetPack::Default();
+    vector<string> unpacked;
+    for (size_t i = 0; i < paths.size(); i++)
+      if (!pack.IsOpen() || !pack.Find(paths[i]))
+        unpacked.push_back(paths[i]);
+    AsyncFileReader::Default().Submit(unpacked, ioBackend);
+  }
+
+  // --cold-model drops the model's files from the page cache first so the
+  // import time printed covers disk reads
+  if (coldModel)
+    cout << "Evicted "
+         << EvictDirectoryFromPageCache(
+                modelPath.substr(0, modelPath.find_last_of('/')))
+         << " model files from the page cache" << endl;
+
+  // What the startup tasks below fill in. Declared ahead of the tasks so
+  // that on an early return ~StartupTasks joins the workers before any of
+  // this is destroyed.
+  ModelSource modelSource;
+  Model *ball = NULL;
+
+  // An --hdr environment replaces the skybox. Otherwise prefer the
+  // compressed cubemaps from tools/texcompress, or show a low-resolution
+  // preview now and stream the JPEG faces in over the next frames (or load
+  // them up front with --no-stream).
+  CubemapStreamer skybox;
+  unsigned int cubemapTexture = 0;
+  bool hdrSkybox = false;
+  DdsCubemap skyboxDDS; // BC7, or BC1 when there is no BC7 file
+  bool skyboxCompressed = false;
+  bool skyboxPrepared = false;
+  double skyboxMs = 0.0;
+  Shader *skyboxShaderPtr = NULL; // created once the context exists
+
+  // Roughness-indexed mip chain for blurred reflections and SH irradiance
+  // for diffuse ambient, cached on disk
+  EnvironmentPrefilter prefilter;
+  bool prefilterReady = false;
+  SHIrradiance irradiance;
+  unsigned int prefilteredTexture = 0;
+
+  // Start the model import, the skybox decode and the environment prefilter
+  // on workers now, while the window and GL context come up; their GL
+  // uploads run on this thread once the context exists (--serial-startup
+  // runs them all in turn after it instead).
+  StartupTasks startup(startupTime, serialStartup);
+  startup.Add(
+      "model", [&]() { Model::Load(modelPath, modelSource); },
+      [&]() { ball = new Model(modelSource); });
+  startup.Add(
+      "skybox",
+      [&]() {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        struct stat st;
+        if (hdrPath.empty() && useCompressedSkybox) {
+          skyboxCompressed =
+              stat(skyboxBC7, &st) == 0 && skyboxDDS.Read(skyboxBC7);
+          if (!skyboxCompressed && stat(skyboxBC1, &st) == 0)
+            skyboxCompressed = skyboxDDS.Read(skyboxBC1);
+        }
+        if (hdrPath.empty() && !skyboxCompressed)
+          skyboxPrepared = skybox.Prepare(faces, decodeThreads);
+        skyboxMs += chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - start)
+                        .count();
+      },
+      [&]() {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const char *skyboxSource = "loaded (HDR)";
+        if (!hdrPath.empty())
+          cubemapTexture = skyboxShaderPtr->loadCubemapHDR(
+              hdrPath.c_str(), hdrFaceSize, hdrFormat);
+        hdrSkybox = cubemapTexture != 0;
+        if (!cubemapTexture && skyboxCompressed) {
+          skyboxSource = "loaded (compressed)";
+          cubemapTexture = skyboxShaderPtr->loadCubemapDDS(skyboxDDS);
+          // the GPU cannot sample BC7: try BC1 before the JPEG faces
+          if (!cubemapTexture && skyboxDDS.format != BC_FORMAT_BC1)
+            cubemapTexture = skyboxShaderPtr->loadCubemapDDS(skyboxBC1);
+        }
+        if (!cubemapTexture) {
+          skyboxSource = streamSkybox ? "preview" : "loaded";
+          cubemapTexture = skyboxPrepared
+                               ? skybox.Start()
+                               : skybox.Start(faces, decodeThreads);
+          if (!streamSkybox)
+            skybox.Finish();
+        }
+        skyboxMs += chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - start)
+                        .count();
+        cout << "Skybox " << skyboxSource << " in " << skyboxMs << " ms ("
+             << decodeThreads << " decode threads)" << endl;
+      });
+  startup.Add(
+      "prefilter",
+      [&]() {
+        if (!hdrPath.empty())
+          prefilterReady = Shader::PreparePrefilteredHDR(
+              hdrPath.c_str(), hdrPath + ".prefilter", prefilter);
+        if (!prefilterReady)
+          prefilterReady = Shader::PreparePrefilteredCubemap(
+              faces, skyboxPrefiltered, prefilter, decodeThreads);
+      },
+      [&]() {
+        if (!prefilterReady)
+          return;
+        irradiance = prefilter.irradiance;
+        prefilteredTexture = prefilter.Upload();
+      });
+  // the benchmarks exit before the scene loads, so nothing is started
+  if (shaderBenchmarkVariants < 0 && directStateBenchmarkCount == 0)
+    startup.Start();
+
+  startup.Phase("glfwInit");
+  ProfileZone glfwInitZone("glfwInit");
   if (!glfwInit())
     return -1;
+  glfwInitZone.End();
 
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -134,8 +441,15 @@ int main() {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+  // headless runs still need a GL context, just not a visible window
+  if (headless)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+  startup.Phase("window");
+  ProfileZone windowZone("glfwCreateWindow");
   GLFWwindow *window =
       glfwCreateWindow(width, height, project_name, nullptr, nullptr);
+  windowZone.End();
 
   if (!window) {
     cerr << "Failed to create window\n";
@@ -151,18 +465,47 @@ int main() {
 
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 
+  startup.Phase("glad");
+  ProfileZone gladZone("gladLoadGLLoader");
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
     cerr << "Failed to initialize GLAD\n";
     return -1;
   }
+  gladZone.End();
+  // the driver compiles on its own threads while startup carries on
+  if (LoadParallelShaderCompile((GLADloadproc)glfwGetProcAddress))
+    SetShaderCompilerThreads(0xFFFFFFFFu);
+  if (shaderBenchmarkVariants >= 0) {
+    Shader::BenchmarkCompile(shaderBenchmarkVariants);
+    glfwTerminate();
+    return 0;
+  }
+  // meshes and cubemaps are created by name into immutable storage where
+  // the context has direct state access, unless --bind-to-edit
+  bool directState = DirectStateGL::Load((GLADloadproc)glfwGetProcAddress);
+  DirectStateAccess() = directState && !bindToEdit;
+  if (directStateBenchmarkCount > 0) {
+    if (!directState) {
+      cout << "ERROR::GL::DIRECT_STATE_ACCESS::NOT_SUPPORTED" << endl;
+      return -1;
+    }
+    Mesh::BenchmarkDirectState(directStateBenchmarkCount, 100000);
+    glfwTerminate();
+    return 0;
+  }
 
+  startup.Phase("ImGui");
+  ProfileZone imguiZone("ImGui init");
   IMGUI_CHECKVERSION();
+  ImGui::SetAllocatorFunctions(AllocTracker::ImGuiAlloc,
+                               AllocTracker::ImGuiFree);
   ImGui::CreateContext();
   ImGui::StyleColorsDark();
   ApplyCustomStyle();
 
   ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init("#version 330 core");
+  imguiZone.End();
 
   gCamera = &camera;
   gLastX = width / 2.0f;
@@ -172,15 +515,28 @@ int main() {
 
   // Configure OpenGL
   glEnable(GL_DEPTH_TEST);
+  // filter across cube face edges, which mipmapped cubemaps need
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
   // Load shaders
+  startup.Phase("shaders");
   Shader shader("shaders/main.vert", "shaders/main.frag");
   Shader skyboxShader("shaders/skybox.vert", "shaders/skybox.frag");
-  unsigned int cubemapTexture = skyboxShader.loadCubemap(faces);
-
-  // Load Model
-  Model ball("assets/models/ball/source/ball_lp_uw.obj");
-
+  skyboxShaderPtr = &skyboxShader;
+
+  // uploads each startup task's result as it becomes ready
+  startup.RunUploads();
+  if (!exportSHPath.empty())
+    irradiance.Write(exportSHPath);
+  irradiance.CreateUniformBuffer(); // stays bound for the whole run
+  shader.bindUniformBlock("SHIrradiance", SHIrradiance::BINDING);
+  if (prefetch) {
+    AsyncFileReader &reader = AsyncFileReader::Default();
+    reader.Wait();
+    cout << "Prefetched " << reader.BatchBytes() / 1024 << " KB in "
+         << reader.BatchMs() << " ms (" << IoBackendName(reader.Backend())
+         << ")" << endl;
+  }
   float skyboxVertices[] = {
       // positions
       -1.0f, 1.0f,  -1.0f, -1.0f, -1.0f, -1.0f, 1.0f,  -1.0f, -1.0f,
@@ -208,18 +564,102 @@ int main() {
   glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), skyboxVertices,
                GL_STATIC_DRAW);
+  RenderStats::Frame().bufferBytes += sizeof(skyboxVertices);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
   glBindVertexArray(0);
 
+  // Every program x vertex format x render state the scene draws with, so
+  // the driver finishes them now instead of in the first frames that use
+  // them (--no-warmup leaves that to the hitch log).
+  PipelineWarmup &pipeline = PipelineWarmup::Default();
+  pipeline.AddProgram("main", shader.ID);
+  pipeline.AddProgram("skybox", skyboxShader.ID);
+  ball->AddVertexArrays(pipeline);
+  pipeline.AddVertexArray("skybox cube", skyboxVAO, 36);
+  PipelineWarmup::State opaque = {true, GL_LESS, true, false, false};
+  PipelineWarmup::State background = {true, GL_LEQUAL, false, false, false};
+  int opaqueState = pipeline.AddState("opaque", opaque);
+  int skyboxState = pipeline.AddState("skybox", background);
+  if (pipelineWarmup) {
+    startup.Phase("pipeline warm-up");
+    pipeline.Run();
+  } else {
+    pipeline.ApplyState(opaqueState);
+  }
+  startup.Phase("first frame");
+
+  Benchmark benchmark;
+  GpuPassTimer gpuTimer;
+  gpuTimer.Init();
+  gpuTimer.onResult = [&benchmark](int tag, const string &series, double ms) {
+    benchmark.AddSceneSample(tag, series, ms);
+  };
+
+  if (runBenchmark) {
+    glfwSwapInterval(0); // measure frame cost, not vsync
+    benchmark.Start(camera);
+  }
+
+  if (!replayPath.empty()) {
+    if (!inputLog.StartReplay(replayPath))
+      return -1;
+    // live input must not leak into the replayed session
+    ImGui::GetIO().ConfigFlags |=
+        ImGuiConfigFlags_NoMouse | ImGuiConfigFlags_NoKeyboard;
+    if (headless)
+      glfwSwapInterval(0);
+  } else if (!recordPath.empty()) {
+    inputLog.StartRecording(recordPath);
+  }
+
+  // measured and replayed runs start with the final skybox
+  if (runBenchmark || allocTest || !replayPath.empty())
+    skybox.Finish();
+  // The loaders release each prefetched file they read; what is left (other
+  // files of the model directory) is dropped once the skybox stream has
+  // decoded its faces, here or when streaming ends below.
+  if (skybox.Done())
+    AsyncFileReader::Default().Clear();
+  float streamWorstMs = 0.0f;
+  bool firstFrame = true;
+
+  // --alloc-test: after warmup, the render loop must not allocate
+  const int allocWarmupFrames = 120;
+  const int allocTestFrames = 600;
+  int frameNumber = 0;
+  unsigned long steadyAllocations = 0;
+  if (allocTest)
+    glfwSwapInterval(0);
+  pipeline.Arm();
+
   // Render loop
   while (!glfwWindowShouldClose(window)) {
+    PROFILE_SCOPE("frame");
+
     float currentFrame = glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
-    processInput(window);
-
+    if (benchmark.Active())
+      deltaTime = benchmark.fixedDelta;
+    else if (inputLog.Recording() || inputLog.Replaying())
+      deltaTime = inputLog.fixedDelta;
+    else if (allocTest)
+      deltaTime = 1.0f / 60.0f;
+
+    ProfileZone inputZone("input");
+    benchmark.BeginFrame(camera);
+    gpuTimer.BeginFrame(benchmark.FrameTag());
+    inputLog.BeginFrame();
+    if (inputLog.Finished())
+      glfwSetWindowShouldClose(window, true);
+
+    if (!benchmark.Active())
+      processInput(window);
+    inputZone.End();
+
+    ProfileZone uiZone("UI build");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -233,13 +673,27 @@ int main() {
       ImGui::Begin("Scene Controls");
       ImGui::Text("OpenGL Starter Template");
       ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
+      DrawRenderStats();
       ImGui::Separator();
       ImGui::Text("Camera Position: (%.1f, %.1f, %.1f)", camera.position.x,
                   camera.position.y, camera.position.z);
       ImGui::Text("Press TAB to toggle UI/Camera control");
+      ImGui::Checkbox("Performance Overlay", &showPerfOverlay);
+      if (hdrSkybox)
+        ImGui::SliderFloat("Exposure", &exposure, 0.1f, 8.0f);
+      if (prefilteredTexture) {
+        ImGui::SliderFloat("Roughness", &roughness, 0.0f, 1.0f);
+        ImGui::SliderFloat("Diffuse", &diffuse, 0.0f, 1.0f);
+      }
       ImGui::End();
+
+      if (showPerfOverlay)
+        DrawPerfOverlay(gpuTimer);
     }
 
+    inputLog.EndFrame();
+    uiZone.End();
+
     // Set transformations
     glm::mat4 projection = glm::perspective(
         glm::radians(camera.zoom), (float)width / (float)height, 0.1f, 100.0f);
@@ -248,44 +702,122 @@ int main() {
     glm::mat4 model = glm::mat4(1.0f);
 
     // Use shader and set uniforms
+    ProfileZone meshZone("mesh pass");
+    gpuTimer.Begin("mesh");
     shader.use();
     shader.setMat4("projection", projection);
     shader.setMat4("view", view);
     shader.setMat4("model", model);
-
-    ball.Draw(shader);
-
-    glDepthFunc(GL_LEQUAL);
-    glDepthMask(GL_FALSE);
+    shader.setFloat("exposure", exposure);
+    shader.setBool("tonemap", hdrSkybox);
+    shader.setInt("skybox", 0);
+    shader.setInt("prefiltered", 1);
+    shader.setFloat("roughness", prefilteredTexture ? roughness : 0.0f);
+    shader.setFloat("maxLod", EnvironmentPrefilter::MaxLod());
+    shader.setFloat("diffuse", prefilteredTexture ? diffuse : 0.0f);
+
+    BindTextureUnit(1, GL_TEXTURE_CUBE_MAP, prefilteredTexture);
+    BindTextureUnit(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    RenderStats::Frame().textureBinds += 2;
+
+    ball->Draw(shader);
+    gpuTimer.End();
+    meshZone.End();
+
+    ProfileZone skyboxZone("skybox pass");
+    gpuTimer.Begin("skybox");
+    bool streaming = !skybox.Done();
+    skybox.Update();
+    pipeline.ApplyState(skyboxState);
 
     skyboxShader.use();
     skyboxShader.setMat4("projection", projection);
     skyboxShader.setMat4("view", view);
     skyboxShader.setInt("skybox", 0);
+    skyboxShader.setFloat("exposure", exposure);
+    skyboxShader.setBool("tonemap", hdrSkybox);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    BindTextureUnit(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
 
     glBindVertexArray(skyboxVAO);
+    pipeline.Draw(skyboxVAO);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glBindVertexArray(0);
 
-    glDepthMask(GL_TRUE);
-    glDepthFunc(GL_LESS);
+    RenderStats &stats = RenderStats::Frame();
+    stats.textureBinds++;
+    stats.vaoBinds++;
+    stats.CountDraw(36);
+
+    pipeline.ApplyState(opaqueState);
+    gpuTimer.End();
+    skyboxZone.End();
 
     if (showUI) {
+      PROFILE_SCOPE("ImGui render");
+      gpuTimer.Begin("imgui");
       ImGui::Render();
       ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+      gpuTimer.End();
+    }
+
+    gpuTimer.EndFrame();
+    if (streaming) {
+      float ms = gpuTimer.FrameCpuMs()[gpuTimer.HistoryPos()];
+      streamWorstMs = ms > streamWorstMs ? ms : streamWorstMs;
+      if (skybox.Done()) {
+        cout << "Skybox streamed over " << skybox.StreamFrames()
+             << " frames, slowest frame " << streamWorstMs << " ms" << endl;
+        AsyncFileReader::Default().Clear();
+      }
+    }
+    if (benchmark.Active())
+      RenderStats::Frame().ForEach([&benchmark](const char *name, double v) {
+        benchmark.AddSample(name, v);
+      });
+    benchmark.EndFrame(camera);
+    if (benchmark.Finished()) {
+      gpuTimer.Flush();
+      benchmark.WriteResults(benchmarkOut + ".csv", benchmarkOut + ".json");
+      glfwSetWindowShouldClose(window, true);
     }
+
+    PROFILE_SCOPE("swap");
     glfwSwapBuffers(window);
-    glfwPollEvents();
+    inputLog.PollEvents(window, key_callback, mouse_callback, scroll_callback);
+    if (firstFrame) {
+      cout << "First frame after "
+           << chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                              startupTime)
+                  .count()
+           << " ms" << endl;
+      startup.Report();
+      firstFrame = false;
+    }
+    RenderStats::EndFrame();
+    AllocTracker::EndFrame();
+    pipeline.EndFrame();
+
+    frameNumber++;
+    if (allocTest && frameNumber == allocWarmupFrames)
+      AllocTracker::BeginSteadyState();
+    if (allocTest && frameNumber == allocWarmupFrames + allocTestFrames) {
+      steadyAllocations = AllocTracker::EndSteadyState();
+      glfwSetWindowShouldClose(window, true);
+    }
   }
 
+  if (inputLog.Recording())
+    inputLog.Save();
+  if (!profilePath.empty())
+    Profiler::WriteChromeTrace(profilePath);
+
   // Cleanup
+  delete ball;
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
   glfwTerminate();
 
-  return 0;
+  return steadyAllocations == 0 ? 0 : 1;
 }
@@ -0,0 +1,218 @@
+// Offline asset baker: converts textures, models and shaders into
+// engine-ready blobs and packs them into one LZ4-compressed archive that
+// lab2 maps with --pack.
+//
+//   asset_bake [--threads N] [--force] [--raw-models] -o assets.pack
+//              <files or directories>
+//
+// Textures are decoded to raw pixels, models to compressed mesh blobs (see
+// mesh_codec.h), shaders are kept as text and other files explicitly listed
+// are stored raw.
+// With --raw-models, models are stored as source instead and lab2 imports
+// them from the pack through Assimp; material and buffer files next to them
+// are always stored raw for that case.
+// Entries are named by their path as given, so bake from the directory lab2
+// runs in. When the output exists, entries whose source hash is unchanged are
+// copied from it without rebaking (--force rebakes everything).
+
+// model.h brings in shaders.h, which holds the stb_image implementation
+#include "model.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "asset_pack.h"
+#include "image_decode.h"
+
+using namespace std;
+
+// bumped whenever a blob format changes, so old entries are rebaked
+const uint64_t BAKE_VERSION = 2;
+
+struct BakeItem {
+  string path;
+  AssetType type;
+  uint64_t sourceHash;
+  const AssetEntry *previous; // unchanged entry of the old pack
+  vector<unsigned char> blob;
+  bool ok;
+};
+
+static double elapsedMs(chrono::steady_clock::time_point since) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - since)
+      .count();
+}
+
+static bool hasExtension(const string &path, const char *const *extensions) {
+  size_t dot = path.find_last_of('.');
+  if (dot == string::npos)
+    return false;
+  string ext = path.substr(dot);
+  for (size_t i = 0; i < ext.size(); i++)
+    ext[i] = (char)tolower(ext[i]);
+  for (int i = 0; extensions[i]; i++)
+    if (ext == extensions[i])
+      return true;
+  return false;
+}
+
+static const char *textureExtensions[] = {".jpg", ".jpeg", ".png", ".tga",
+                                          ".bmp", NULL};
+static const char *modelExtensions[] = {".obj", ".fbx", ".gltf", ".glb",
+                                        ".dae", NULL};
+static const char *shaderExtensions[] = {".vert", ".frag", ".geom", ".glsl",
+                                         NULL};
+static const char *companionExtensions[] = {".mtl", ".bin", NULL};
+
+static bool isKnownAsset(const string &path) {
+  return hasExtension(path, textureExtensions) ||
+         hasExtension(path, modelExtensions) ||
+         hasExtension(path, shaderExtensions) ||
+         hasExtension(path, companionExtensions);
+}
+
+// expands directories to the known asset files below them
+static void collectInputs(const string &path, bool listed,
+                          vector<string> &inputs) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    cout << "ERROR::ASSET_BAKE::NOT_FOUND " << path << endl;
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    if (listed || isKnownAsset(path))
+      inputs.push_back(path);
+    return;
+  }
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  vector<string> names;
+  for (dirent *e = readdir(dir); e; e = readdir(dir))
+    if (e->d_name[0] != '.')
+      names.push_back(e->d_name);
+  closedir(dir);
+  sort(names.begin(), names.end()); // stable pack layout
+  for (size_t i = 0; i < names.size(); i++)
+    collectInputs(path + "/" + names[i], false, inputs);
+}
+
+static void bake(BakeItem &item) {
+  if (item.type == ASSET_TEXTURE) {
+    DecodedImage image;
+    item.ok = DecodeImage(item.path.c_str(), image);
+    if (item.ok)
+      EncodeImageBlob(image, item.blob);
+  } else if (item.type == ASSET_MESH) {
+    item.ok = Model::Bake(item.path, item.blob);
+  } else {
+    item.ok = ReadFileBytes(item.path, item.blob);
+  }
+  if (!item.ok)
+    cout << "ERROR::ASSET_BAKE::CANNOT_BAKE " << item.path << endl;
+}
+
+int main(int argc, char **argv) {
+  int threads = 0;
+  bool force = false;
+  bool rawModels = false;
+  string outPath;
+  vector<string> inputs;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (arg == "--force") {
+      force = true;
+    } else if (arg == "--raw-models") {
+      rawModels = true;
+    } else if (arg == "-o" && i + 1 < argc) {
+      outPath = argv[++i];
+    } else {
+      collectInputs(arg, true, inputs);
+    }
+  }
+  if (inputs.empty() || outPath.empty()) {
+    cout << "usage: asset_bake [--threads N] [--force] [--raw-models] -o "
+            "assets.pack <files or directories>"
+         << endl;
+    return 1;
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  AssetPack previous;
+  if (!force)
+    previous.Open(outPath);
+
+  // hash sources and decide what needs baking
+  vector<BakeItem> items(inputs.size());
+  ParallelFor(
+      (int)items.size(),
+      [&](int i) {
+        BakeItem &item = items[i];
+        item.path = inputs[i];
+        item.type =
+            hasExtension(item.path, textureExtensions) ? ASSET_TEXTURE
+            : hasExtension(item.path, modelExtensions) && !rawModels
+                ? ASSET_MESH
+            : hasExtension(item.path, shaderExtensions) ? ASSET_SHADER
+                                                        : ASSET_RAW;
+        vector<unsigned char> source;
+        item.ok = ReadFileBytes(item.path, source);
+        if (!item.ok)
+          cout << "ERROR::ASSET_BAKE::CANNOT_READ " << item.path << endl;
+        uint64_t salt[2] = {BAKE_VERSION, (uint64_t)item.type};
+        item.sourceHash = AssetHash(salt, sizeof(salt));
+        if (!source.empty())
+          item.sourceHash =
+              AssetHash(&source[0], source.size(), item.sourceHash);
+        const AssetEntry *old =
+            previous.IsOpen() ? previous.Find(item.path) : NULL;
+        item.previous =
+            old && old->sourceHash == item.sourceHash ? old : NULL;
+        if (item.ok && !item.previous)
+          bake(item);
+      },
+      threads, "bake");
+  double bakeMs = elapsedMs(start);
+
+  start = chrono::steady_clock::now();
+  AssetPackWriter writer;
+  int baked = 0, reused = 0, failed = 0;
+  for (size_t i = 0; i < items.size(); i++) {
+    BakeItem &item = items[i];
+    if (item.previous) {
+      writer.Reuse(previous, *item.previous);
+      reused++;
+    } else if (item.ok) {
+      writer.Add(item.path, item.type, item.sourceHash, item.blob, threads);
+      vector<unsigned char>().swap(item.blob);
+      baked++;
+    } else {
+      failed++;
+    }
+  }
+  double compressMs = elapsedMs(start);
+
+  uint64_t raw, stored;
+  writer.Sizes(raw, stored);
+  previous.Close();
+  if (!writer.Write(outPath))
+    return 1;
+
+  cout << outPath << ": " << baked << " baked, " << reused << " unchanged, "
+       << failed << " failed; " << raw / 1048576.0 << " MB -> "
+       << stored / 1048576.0 << " MB (" << (stored ? (double)raw / stored : 0)
+       << "x); bake " << bakeMs << " ms, compress " << compressMs << " ms"
+       << endl;
+  return failed ? 1 : 0;
+}
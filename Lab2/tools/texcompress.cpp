@@ -0,0 +1,129 @@
+// Offline cubemap compressor: six LDR faces in, one BC1 or BC7 DDS with a
+// full sRGB-correct mip chain out.
+//
+//   texcompress [--format bc1|bc7] [--threads N] -o skybox_bc7.dds
+//               right.jpg left.jpg top.jpg bottom.jpg front.jpg back.jpg
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "image_decode.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bc_codec.h"
+#include "dds.h"
+
+using namespace std;
+
+static double elapsedMs(chrono::steady_clock::time_point since) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - since)
+      .count();
+}
+
+int main(int argc, char **argv) {
+  BcFormat format = BC_FORMAT_BC7;
+  int threads = 0;
+  string outPath;
+  vector<const char *> faces;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--format" && i + 1 < argc) {
+      format = string(argv[++i]) == "bc1" ? BC_FORMAT_BC1 : BC_FORMAT_BC7;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (arg == "-o" && i + 1 < argc) {
+      outPath = argv[++i];
+    } else {
+      faces.push_back(argv[i]);
+    }
+  }
+  if (faces.size() != 6 || outPath.empty()) {
+    cout << "usage: texcompress [--format bc1|bc7] [--threads N] -o out.dds "
+            "+x -x +y -y +z -z"
+         << endl;
+    return 1;
+  }
+
+  vector<DecodedImage> images;
+  DecodeImagesParallel(&faces[0], 6, images, threads ? threads : 6);
+
+  DdsCubemap cube;
+  cube.format = format;
+  cube.size = images[0].width;
+  for (int face = 0; face < 6; face++) {
+    const DecodedImage &image = images[face];
+    if (!image.ok || image.width != cube.size || image.height != cube.size) {
+      cout << "ERROR::TEXCOMPRESS::BAD_FACE " << faces[face] << endl;
+      return 1;
+    }
+  }
+  cube.mipCount = 1;
+  while ((cube.size >> cube.mipCount) > 0)
+    cube.mipCount++;
+  cube.data.resize(6 * cube.FaceBytes());
+
+  double mipMs = 0.0, encodeMs = 0.0, psnrSum = 0.0;
+  size_t texels = 0;
+  for (int face = 0; face < 6; face++) {
+    const DecodedImage &image = images[face];
+    vector<unsigned char> level((size_t)cube.size * cube.size * 4);
+    for (size_t p = 0; p < (size_t)cube.size * cube.size; p++) {
+      const unsigned char *src = &image.pixels[p * image.channels];
+      unsigned char *dst = &level[p * 4];
+      dst[0] = src[0];
+      dst[1] = image.channels >= 3 ? src[1] : src[0];
+      dst[2] = image.channels >= 3 ? src[2] : src[0];
+      dst[3] = image.channels == 4 ? src[3] : 255;
+    }
+
+    for (int mip = 0; mip < cube.mipCount; mip++) {
+      int size = cube.MipSize(mip);
+      vector<unsigned char> compressed;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      CompressImage(&level[0], size, format, compressed, threads);
+      encodeMs += elapsedMs(start);
+      texels += (size_t)size * size;
+      memcpy(&cube.data[cube.Offset(face, mip)], &compressed[0],
+             compressed.size());
+
+      if (mip == 0) {
+        vector<unsigned char> decoded;
+        DecompressImage(&compressed[0], size, format, decoded);
+        psnrSum += ImagePsnr(&level[0], &decoded[0], (size_t)size * size);
+      }
+
+      if (mip + 1 < cube.mipCount) {
+        start = chrono::steady_clock::now();
+        vector<unsigned char> next;
+        DownsampleSrgb(level, size, next);
+        level.swap(next);
+        mipMs += elapsedMs(start);
+      }
+    }
+  }
+
+  if (!cube.Write(outPath))
+    return 1;
+
+  size_t rgbBytes = (size_t)cube.size * cube.size * 3 * 6;
+  size_t rgbaMipBytes = 0;
+  for (int mip = 0; mip < cube.mipCount; mip++)
+    rgbaMipBytes += (size_t)cube.MipSize(mip) * cube.MipSize(mip) * 4 * 6;
+
+  printf("%s: %dx%d x6, %d mips, %d threads\n",
+         format == BC_FORMAT_BC1 ? "BC1" : "BC7", cube.size, cube.size,
+         cube.mipCount, threads ? threads : HardwareThreads());
+  printf("  encode %.0f ms (%.2f Mtexel/s), mips %.0f ms\n", encodeMs,
+         texels / encodeMs / 1000.0, mipMs);
+  printf("  PSNR (level 0, RGB) %.2f dB\n", psnrSum / 6.0);
+  printf("  size %.1f MB vs %.1f MB RGB8 without mips, %.1f MB RGBA8 with "
+         "mips\n",
+         cube.data.size() / 1048576.0, rgbBytes / 1048576.0,
+         rgbaMipBytes / 1048576.0);
+  printf("  written to %s\n", outPath.c_str());
+  return 0;
+}